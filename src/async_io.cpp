@@ -0,0 +1,414 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "async_io.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "exceptions/io_error_exception.h"
+
+namespace badgerdb {
+
+// Number of queued io_uring entries at which they are passed to the kernel
+// without waiting for the next reap
+static const unsigned SUBMIT_BATCH = 16;
+
+// Most threads a ThreadPoolAsyncIo starts
+static const unsigned MAX_WORKERS = 16;
+
+AsyncIo* AsyncIo::create(const unsigned depth, const bool useIoUring)
+{
+  if (useIoUring)
+  {
+    UringAsyncIo* io = new UringAsyncIo(depth);
+    if (io->isOpen())
+      return io;
+    delete io;
+  }
+  return new ThreadPoolAsyncIo(depth);
+}
+
+AsyncIo::AsyncIo(const unsigned depth)
+  : depth_(depth > 0 ? depth : 1), requests_(depth_), inFlight_(0)
+{
+  for (unsigned i = depth_; i > 0; i--)
+    freeSlots_.push_back(i - 1);
+}
+
+void AsyncIo::read(const std::shared_ptr<IoHandle>& handle, const off_t offset,
+                   char* buffer, const std::size_t length, void* tag)
+{
+  start(false, handle, offset, buffer, length, tag);
+}
+
+void AsyncIo::write(const std::shared_ptr<IoHandle>& handle, const off_t offset,
+                    const char* buffer, const std::size_t length, void* tag)
+{
+  start(true, handle, offset, const_cast<char*>(buffer), length, tag);
+}
+
+void AsyncIo::start(const bool isWrite, const std::shared_ptr<IoHandle>& handle,
+                    const off_t offset, char* buffer, const std::size_t length, void* tag)
+{
+  // make room by waiting for a request to complete
+  while (freeSlots_.empty())
+    reap(1);
+
+  const unsigned slot = freeSlots_.back();
+  freeSlots_.pop_back();
+  inFlight_++;
+
+  Request& req = requests_[slot];
+  req.isWrite = isWrite;
+  req.handle = handle;
+  req.offset = offset;
+  req.buffer = buffer;
+  req.length = length;
+  req.done = 0;
+  req.tag = tag;
+  submit(slot);
+}
+
+void AsyncIo::transferred(const unsigned slot, const long result, const std::string& error)
+{
+  Request& req = requests_[slot];
+  if (result == -EINTR || result == -EAGAIN)
+  {
+    submit(slot);
+    return;
+  }
+  if (result < 0 || (result == 0 && req.isWrite))
+  {
+    if (error_.empty())
+    {
+      error_ = !error.empty() ? error : result < 0 ? strerror(-result) : "nothing written";
+      errorFile_ = req.handle->filename();
+    }
+    finish(slot, false);
+    return;
+  }
+  if (result == 0)
+  {
+    // Ran into the end of the file.
+    memset(req.buffer + req.done, 0, req.length - req.done);
+    finish(slot, true);
+    return;
+  }
+
+  req.done += result;
+  if (req.done < req.length)
+    submit(slot);
+  else
+    finish(slot, true);
+}
+
+void AsyncIo::finish(const unsigned slot, const bool succeeded)
+{
+  Request& req = requests_[slot];
+  if (succeeded)
+    completed_.push_back(req.tag);
+  req.handle.reset();
+  freeSlots_.push_back(slot);
+  inFlight_--;
+}
+
+std::size_t AsyncIo::wait(std::vector<void*>& tags, const std::size_t minimum)
+{
+  while (completed_.size() < minimum && inFlight_ > 0)
+    reap(1);
+
+  const std::size_t count = completed_.size();
+  tags.insert(tags.end(), completed_.begin(), completed_.end());
+  completed_.clear();
+
+  if (!error_.empty())
+  {
+    const std::string error = error_;
+    error_.clear();
+    throw IoErrorException(errorFile_, error);
+  }
+  return count;
+}
+
+//----------------------------------------
+// UringAsyncIo
+//----------------------------------------
+
+UringAsyncIo::UringAsyncIo(const unsigned depth)
+  : AsyncIo(depth), ringFd_(-1), sqRing_(MAP_FAILED), sqRingSize_(0),
+    cqRing_(MAP_FAILED), cqRingSize_(0), sqes_(NULL), sqesSize_(0),
+    unsubmitted_(0)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(__NR_io_uring_setup, depth_, &params);
+  if (fd < 0)
+    return;
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap)
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+
+  sqRing_ = mmap(NULL, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 fd, IORING_OFF_SQ_RING);
+  if (sqRing_ != MAP_FAILED)
+  {
+    cqRing_ = singleMap ? sqRing_
+        : mmap(NULL, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               fd, IORING_OFF_CQ_RING);
+  }
+  sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = MAP_FAILED;
+  if (cqRing_ != MAP_FAILED)
+  {
+    sqes = mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, IORING_OFF_SQES);
+  }
+  if (sqes == MAP_FAILED)
+  {
+    if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+      munmap(cqRing_, cqRingSize_);
+    if (sqRing_ != MAP_FAILED)
+      munmap(sqRing_, sqRingSize_);
+    ::close(fd);
+    return;
+  }
+
+  char* sq = static_cast<char*>(sqRing_);
+  char* cq = static_cast<char*>(cqRing_);
+  sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+  sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sqMask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqMask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  ringFd_ = fd;
+}
+
+UringAsyncIo::~UringAsyncIo()
+{
+  if (ringFd_ < 0)
+    return;
+
+  std::vector<void*> tags;
+  try
+  {
+    waitAll(tags);
+  }
+  catch (...)
+  {
+  }
+  munmap(sqes_, sqesSize_);
+  if (cqRing_ != sqRing_)
+    munmap(cqRing_, cqRingSize_);
+  munmap(sqRing_, sqRingSize_);
+  ::close(ringFd_);
+}
+
+void UringAsyncIo::submit(const unsigned slot)
+{
+  Request& req = requests_[slot];
+  const int fd = req.handle->fd();
+  const std::size_t alignment = req.handle->alignment();
+  if (fd < 0
+      || (req.offset + req.done) % alignment != 0
+      || (req.length - req.done) % alignment != 0
+      || reinterpret_cast<std::uintptr_t>(req.buffer + req.done) % alignment != 0)
+  {
+    // No descriptor to hand to the kernel, or the transfer is not aligned as
+    // the descriptor needs; do the transfer here.
+    const std::size_t length = req.length - req.done;
+    try
+    {
+      if (req.isWrite)
+      {
+        req.handle->write(req.offset + req.done, req.buffer + req.done, length);
+        req.handle->flush();
+      }
+      else
+      {
+        req.handle->read(req.offset + req.done, req.buffer + req.done, length);
+      }
+      transferred(slot, length);
+    }
+    catch (const IoErrorException &e)
+    {
+      transferred(slot, -EIO, e.message());
+    }
+    return;
+  }
+
+  // Only this thread adds entries, so the tail can be read plainly.
+  const unsigned tail = *sqTail_;
+  const unsigned index = tail & *sqMask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  req.iov.iov_base = req.buffer + req.done;
+  req.iov.iov_len = req.length - req.done;
+  sqe->opcode = req.isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<unsigned long>(&req.iov);
+  sqe->len = 1;
+  sqe->off = req.offset + req.done;
+  sqe->user_data = slot;
+  sqArray_[index] = index;
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+
+  if (++unsubmitted_ >= SUBMIT_BATCH)
+  {
+    int ret = (int)syscall(__NR_io_uring_enter, ringFd_, unsubmitted_, 0, 0, NULL, 0);
+    if (ret > 0)
+      unsubmitted_ -= ret;
+  }
+}
+
+void UringAsyncIo::reap(const std::size_t minimum)
+{
+  std::size_t reaped = 0;
+  while (true)
+  {
+    unsigned head = *cqHead_;
+    while (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE))
+    {
+      const struct io_uring_cqe* cqe = &cqes_[head & *cqMask_];
+      const unsigned slot = (unsigned)cqe->user_data;
+      const long result = cqe->res;
+      head++;
+      __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+      // may queue the rest of a partial transfer
+      transferred(slot, result);
+      reaped++;
+    }
+    if (reaped >= minimum && unsubmitted_ == 0)
+      break;
+
+    const unsigned waitFor = reaped >= minimum ? 0 : 1;
+    int ret = (int)syscall(__NR_io_uring_enter, ringFd_, unsubmitted_, waitFor,
+                           waitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        continue;
+      throw IoErrorException("io_uring", strerror(errno));
+    }
+    unsubmitted_ -= ret;
+  }
+}
+
+//----------------------------------------
+// ThreadPoolAsyncIo
+//----------------------------------------
+
+ThreadPoolAsyncIo::ThreadPoolAsyncIo(const unsigned depth)
+  : AsyncIo(depth), stopping_(false)
+{
+  const unsigned workers = std::min(depth_, MAX_WORKERS);
+  for (unsigned i = 0; i < workers; i++)
+    workers_.push_back(std::thread(&ThreadPoolAsyncIo::work, this));
+}
+
+ThreadPoolAsyncIo::~ThreadPoolAsyncIo()
+{
+  std::vector<void*> tags;
+  try
+  {
+    waitAll(tags);
+  }
+  catch (...)
+  {
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queued_.notify_all();
+  for (std::size_t i = 0; i < workers_.size(); i++)
+    workers_[i].join();
+}
+
+void ThreadPoolAsyncIo::submit(const unsigned slot)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(slot);
+  }
+  queued_.notify_one();
+}
+
+void ThreadPoolAsyncIo::reap(const std::size_t minimum)
+{
+  std::deque<Result> results;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (results_.size() < minimum)
+      finished_.wait(lock);
+    results.swap(results_);
+  }
+  for (std::size_t i = 0; i < results.size(); i++)
+    transferred(results[i].slot, results[i].result, results[i].error);
+}
+
+void ThreadPoolAsyncIo::work()
+{
+  while (true)
+  {
+    unsigned slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (queue_.empty() && !stopping_)
+        queued_.wait(lock);
+      if (queue_.empty())
+        return;
+      slot = queue_.front();
+      queue_.pop_front();
+    }
+
+    // The slot is not touched by the submitting thread until its result has
+    // been reaped.
+    Request& req = requests_[slot];
+    Result result;
+    result.slot = slot;
+    result.result = req.length - req.done;
+    try
+    {
+      if (req.isWrite)
+      {
+        req.handle->write(req.offset + req.done, req.buffer + req.done, req.length - req.done);
+        req.handle->flush();
+      }
+      else
+      {
+        req.handle->read(req.offset + req.done, req.buffer + req.done, req.length - req.done);
+      }
+    }
+    catch (const IoErrorException &e)
+    {
+      result.result = -EIO;
+      result.error = e.message();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      results_.push_back(result);
+    }
+    finished_.notify_one();
+  }
+}
+
+}
@@ -0,0 +1,276 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "io_handle.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace badgerdb {
+
+/**
+ * @brief Keeps many reads and writes in flight at once and reports them as
+ *        they complete.
+ *
+ * Requests are started with read() and write() and identified by a caller
+ * chosen tag, which wait() hands back once the request has completed.  At most
+ * depth() requests are in flight; starting another one first waits for one to
+ * complete.  Buffers must stay valid until their request completes.
+ *
+ * create() uses io_uring when the kernel allows it, and otherwise a pool of
+ * threads doing blocking I/O.  Requests on handles without a file descriptor
+ * (STREAM_BACKEND) are done by the thread pool, or on the spot under io_uring.
+ * Asynchronous requests are not admitted by the IoScheduler; the depth bounds
+ * them instead.
+ *
+ * @warning An AsyncIo must only be used by one thread at a time.
+ */
+class AsyncIo
+{
+ public:
+	/**
+	 * Creates an AsyncIo.
+	 *
+	 * @param depth				Maximum number of requests in flight.
+	 * @param useIoUring	Whether to try io_uring before falling back to threads.
+	 */
+  static AsyncIo* create(const unsigned depth = 64, const bool useIoUring = true);
+
+	/**
+	 * Waits for all requests in flight to complete.
+	 */
+  virtual ~AsyncIo() {}
+
+	/**
+	 * Returns true if requests go through io_uring.
+	 */
+  virtual bool usesIoUring() const = 0;
+
+	/**
+	 * Starts reading <length> bytes at <offset> into <buffer>.  Bytes past the
+	 * end of the file are read as zeros.
+	 */
+  void read(const std::shared_ptr<IoHandle>& handle, const off_t offset,
+            char* buffer, const std::size_t length, void* tag);
+
+	/**
+	 * Starts writing <length> bytes from <buffer> at <offset>.
+	 */
+  void write(const std::shared_ptr<IoHandle>& handle, const off_t offset,
+             const char* buffer, const std::size_t length, void* tag);
+
+	/**
+	 * Has the next wait() hand back <tag> as a completed request, for a
+	 * transfer the caller had to do synchronously.
+	 */
+  void complete(void* tag) { completed_.push_back(tag); }
+
+	/**
+	 * Waits until at least <minimum> requests have completed (or none are left
+	 * in flight) and appends the tags of all completed requests to <tags>.
+	 *
+	 * @return	Number of tags appended.
+	 * @throws  IoErrorException  If a completed request failed.  Tags of failed
+	 *                            requests are never handed back; those of the
+	 *                            other completed requests are still appended.
+	 */
+  std::size_t wait(std::vector<void*>& tags, const std::size_t minimum);
+
+	/**
+	 * Waits for all requests in flight and appends their tags to <tags>.
+	 */
+  std::size_t waitAll(std::vector<void*>& tags)
+  {
+    return wait(tags, (std::size_t)-1);
+  }
+
+	/**
+	 * Returns the number of requests started but not yet handed back by wait().
+	 */
+  std::size_t pending() const { return inFlight_ + completed_.size(); }
+
+	/**
+	 * Returns the maximum number of requests in flight.
+	 */
+  unsigned depth() const { return depth_; }
+
+ protected:
+  explicit AsyncIo(const unsigned depth);
+
+	/**
+	 * @brief A request in flight.
+	 */
+  struct Request
+  {
+    bool isWrite;
+    std::shared_ptr<IoHandle> handle;	/* kept open until the request completes */
+    off_t offset;
+    char* buffer;
+    std::size_t length;
+    std::size_t done;			/* bytes transferred so far */
+    void* tag;
+    struct iovec iov;			/* what remains to be transferred, for io_uring */
+  };
+
+	/**
+	 * Hands a request (or what remains of it) to the implementation.
+	 */
+  virtual void submit(const unsigned slot) = 0;
+
+	/**
+	 * Waits for at least <minimum> transfers to finish, calling transferred()
+	 * for each.
+	 */
+  virtual void reap(const std::size_t minimum) = 0;
+
+	/**
+	 * Records the result of a transfer: the number of bytes moved, 0 at end of
+	 * file, or -errno.  Resubmits the rest of a partial transfer.
+	 *
+	 * @param error  Error message if the transfer failed, otherwise empty.
+	 */
+  void transferred(const unsigned slot, const long result, const std::string& error = "");
+
+	/**
+   * Maximum number of requests in flight
+	 */
+  const unsigned depth_;
+
+	/**
+   * One slot per request that can be in flight
+	 */
+  std::vector<Request> requests_;
+
+ private:
+  void start(const bool isWrite, const std::shared_ptr<IoHandle>& handle,
+             const off_t offset, char* buffer, const std::size_t length, void* tag);
+  void finish(const unsigned slot, const bool succeeded);
+
+	/**
+   * Slots not in use
+	 */
+  std::vector<unsigned> freeSlots_;
+
+	/**
+   * Number of slots in use
+	 */
+  std::size_t inFlight_;
+
+	/**
+   * Tags of completed requests not yet handed back by wait()
+	 */
+  std::deque<void*> completed_;
+
+	/**
+   * First error since the last wait(), empty if none
+	 */
+  std::string error_;
+
+	/**
+   * File the first error happened on
+	 */
+  std::string errorFile_;
+};
+
+/**
+ * @brief AsyncIo submitting requests to an io_uring set up with raw system
+ *        calls.
+ */
+class UringAsyncIo : public AsyncIo
+{
+ public:
+	/**
+	 * Sets up the ring; isOpen() is false if the kernel refused.
+	 */
+  explicit UringAsyncIo(const unsigned depth);
+  ~UringAsyncIo();
+
+  bool isOpen() const { return ringFd_ >= 0; }
+  bool usesIoUring() const override { return true; }
+
+ protected:
+  void submit(const unsigned slot) override;
+  void reap(const std::size_t minimum) override;
+
+ private:
+  int ringFd_;
+  void* sqRing_;
+  std::size_t sqRingSize_;
+  void* cqRing_;
+  std::size_t cqRingSize_;
+  ::io_uring_sqe* sqes_;
+  std::size_t sqesSize_;
+  unsigned* sqHead_;
+  unsigned* sqTail_;
+  unsigned* sqMask_;
+  unsigned* sqArray_;
+  unsigned* cqHead_;
+  unsigned* cqTail_;
+  unsigned* cqMask_;
+  ::io_uring_cqe* cqes_;
+
+	/**
+   * Entries added to the submission queue but not yet passed to the kernel
+	 */
+  unsigned unsubmitted_;
+};
+
+/**
+ * @brief AsyncIo handing requests to a pool of threads doing blocking I/O.
+ */
+class ThreadPoolAsyncIo : public AsyncIo
+{
+ public:
+  explicit ThreadPoolAsyncIo(const unsigned depth);
+  ~ThreadPoolAsyncIo();
+
+  bool usesIoUring() const override { return false; }
+
+ protected:
+  void submit(const unsigned slot) override;
+  void reap(const std::size_t minimum) override;
+
+ private:
+	/**
+	 * @brief Result of a transfer done by a worker.
+	 */
+  struct Result
+  {
+    unsigned slot;
+    long result;
+    std::string error;
+  };
+
+  void work();
+
+  std::vector<std::thread> workers_;
+
+	/**
+   * Protects the members below
+	 */
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable finished_;
+  std::deque<unsigned> queue_;
+  std::deque<Result> results_;
+  bool stopping_;
+};
+
+}
@@ -0,0 +1,1484 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "async_io.h"
+#include "btree.h"
+#include "crc32c.h"
+#include "page.h"
+#include "file_iterator.h"
+#include "io_scheduler.h"
+#include "log_manager.h"
+#include "filescan.h"
+#include "page_iterator.h"
+#include "exceptions/insufficient_space_exception.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/end_of_file_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+
+using namespace badgerdb;
+
+// -----------------------------------------------------------------------------
+// Benchmarks of BadgerDB.  Run as
+//   badgerdb_bench <benchmark> [arguments]
+// with no arguments to list the benchmarks.
+// -----------------------------------------------------------------------------
+
+typedef struct tuple {
+	int i;
+	double d;
+	char s[64];
+} RECORD;
+
+typedef std::chrono::steady_clock Clock;
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+/**
+ * Removes a file if it exists.
+ */
+void removeFile(const std::string& filename)
+{
+	try
+	{
+		File::remove(filename);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+}
+
+/**
+ * Creates a relation of <relationSize> records with keys 0 .. relationSize-1
+ * in order.
+ */
+void createRelation(const std::string& relationName, int relationSize)
+{
+	removeFile(relationName);
+	PageFile file = PageFile::create(relationName);
+
+	RECORD record;
+	memset(record.s, ' ', sizeof(record.s));
+	PageId pageNumber;
+	Page page = file.allocatePage(pageNumber);
+
+	for(int i = 0; i < relationSize; i++)
+	{
+		sprintf(record.s, "%05d string record", i);
+		record.i = i;
+		record.d = (double)i;
+		std::string data(reinterpret_cast<char*>(&record), sizeof(record));
+
+		while(1)
+		{
+			try
+			{
+				page.insertRecord(data);
+				break;
+			}
+			catch(const InsufficientSpaceException &e)
+			{
+				file.writePage(pageNumber, page);
+				page = file.allocatePage(pageNumber);
+			}
+		}
+	}
+
+	file.writePage(pageNumber, page);
+}
+
+/**
+ * Returns the given percentile of a set of latencies in microseconds.
+ */
+double percentile(std::vector<double>& latencies, double p)
+{
+	if (latencies.empty())
+		return 0;
+	std::sort(latencies.begin(), latencies.end());
+	std::size_t index = (std::size_t)(p * (latencies.size() - 1));
+	return latencies[index];
+}
+
+// -----------------------------------------------------------------------------
+// scheduler: point lookups on one index while another index is being built
+// -----------------------------------------------------------------------------
+
+struct LookupResult {
+	std::size_t lookups;
+	double meanMicros;
+	double p99Micros;
+	double buildSeconds;
+};
+
+/**
+ * Builds an index on relation "benchB" in a background thread while the
+ * calling thread does random point lookups on the index of "benchA" through a
+ * small buffer pool, so that most lookups read from disk.
+ */
+LookupResult runMixedWorkload(int relationSize)
+{
+	std::string indexNameA, indexNameB;
+	BufMgr lookupBufMgr(10);
+	BTreeIndex lookupIndex("benchA", indexNameA, &lookupBufMgr, offsetof(tuple,i), INTEGER);
+
+	removeFile("benchB." + std::to_string(offsetof(tuple,i)));
+
+	std::atomic<bool> building(true);
+	double buildSeconds = 0;
+	std::thread builder([&]() {
+		IoClassScope scope(BACKGROUND_WRITE);
+		Clock::time_point start = Clock::now();
+		{
+			BufMgr buildBufMgr(50);
+			BTreeIndex buildIndex("benchB", indexNameB, &buildBufMgr, offsetof(tuple,i), INTEGER);
+		}
+		buildSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+		building = false;
+	});
+
+	std::mt19937 random(564);
+	std::uniform_int_distribution<int> keys(0, relationSize - 1);
+	std::vector<double> latencies;
+	while (building)
+	{
+		int key = keys(random);
+		RecordId rid;
+		Clock::time_point start = Clock::now();
+		lookupIndex.startScan(&key, GTE, &key, LTE);
+		lookupIndex.scanNext(rid);
+		lookupIndex.endScan();
+		latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+	builder.join();
+
+	LookupResult result;
+	result.lookups = latencies.size();
+	result.meanMicros = 0;
+	for (std::size_t i = 0; i < latencies.size(); i++)
+		result.meanMicros += latencies[i];
+	if (!latencies.empty())
+		result.meanMicros /= latencies.size();
+	result.p99Micros = percentile(latencies, 0.99);
+	result.buildSeconds = buildSeconds;
+	return result;
+}
+
+void printResult(const char* label, const LookupResult& result)
+{
+	IoScheduler& scheduler = IoScheduler::instance();
+	std::cout << label << ": " << result.lookups << " lookups, mean "
+		<< result.meanMicros << " us, p99 " << result.p99Micros << " us; build took "
+		<< result.buildSeconds << " s, background writes waited "
+		<< scheduler.getStats(BACKGROUND_WRITE).waitMicros / 1000 << " ms\n";
+}
+
+/**
+ * Usage: scheduler [records] [write limit in bytes/s] [queue depth]
+ */
+int benchScheduler(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 100000;
+	std::uint64_t writeLimit = argc > 1 ? strtoull(argv[1], NULL, 10) : 16 * 1024 * 1024;
+	unsigned queueDepth = argc > 2 ? atoi(argv[2]) : 1;
+
+	createRelation("benchA", relationSize);
+	createRelation("benchB", relationSize);
+	{
+		std::string indexName;
+		BufMgr bufMgr(100);
+		BTreeIndex index("benchA", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+	}
+
+	IoScheduler& scheduler = IoScheduler::instance();
+	scheduler.clearStats();
+	printResult("unscheduled", runMixedWorkload(relationSize));
+
+	scheduler.setQueueDepth(queueDepth);
+	scheduler.setRateLimit(BACKGROUND_WRITE, writeLimit);
+	scheduler.clearStats();
+	printResult("scheduled  ", runMixedWorkload(relationSize));
+	scheduler.setQueueDepth(0);
+	scheduler.setRateLimit(BACKGROUND_WRITE, 0);
+
+	removeFile("benchA");
+	removeFile("benchB");
+	removeFile("benchA." + std::to_string(offsetof(tuple,i)));
+	removeFile("benchB." + std::to_string(offsetof(tuple,i)));
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// load: time to load relations of growing size
+// -----------------------------------------------------------------------------
+
+/**
+ * Usage: load [max records] [min records]
+ *
+ * Loads relations of min records, doubling up to max records, and prints the
+ * time each load took.  Loading should take time linear in the number of
+ * records.
+ */
+int benchLoad(int argc, char **argv)
+{
+	long maxRecords = argc > 0 ? atol(argv[0]) : 1000000;
+	long minRecords = argc > 1 ? atol(argv[1]) : 10000;
+
+	std::cout << "records\tpages\tseconds\trecords/s\n";
+	for (long records = minRecords; records <= maxRecords; records *= 2)
+	{
+		Clock::time_point start = Clock::now();
+		createRelation("benchLoad", records);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		PageId pages = 0;
+		{
+			PageFile file = PageFile::open("benchLoad");
+			for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+				pages++;
+		}
+		std::cout << records << "\t" << pages << "\t" << seconds << "\t"
+			<< (long)(records / seconds) << std::endl;
+	}
+
+	removeFile("benchLoad");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// durability: relation loads in each durability mode
+// -----------------------------------------------------------------------------
+
+/**
+ * Usage: durability [records] [group interval in ms]
+ */
+int benchDurability(int argc, char **argv)
+{
+	long records = argc > 0 ? atol(argv[0]) : 100000;
+	int interval = argc > 1 ? atoi(argv[1]) : 10;
+
+	const DurabilityMode modes[] = {DURABILITY_NONE, DURABILITY_ON_CLOSE,
+	                                DURABILITY_GROUP, DURABILITY_PER_COMMIT};
+	const char* labels[] = {"none       ", "on close   ", "group      ", "per commit "};
+	for (int i = 0; i < 4; i++)
+	{
+		File::setDurability(modes[i], interval);
+		Clock::time_point start = Clock::now();
+		createRelation("benchDurability", records);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		std::cout << labels[i] << ": " << records << " records in " << seconds
+			<< " s, " << (long)(records / seconds) << " records/s\n";
+	}
+	File::setDurability(DURABILITY_NONE);
+
+	removeFile("benchDurability");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// wal: small transactions made durable by page writes or by the log
+// -----------------------------------------------------------------------------
+
+/**
+ * Runs <transactions> transactions that each change a few bytes of <pages>
+ * random pages of "benchWal" and make the change durable, either by writing
+ * the pages and syncing them or by committing to a write-ahead log, and
+ * prints the commit rate.
+ */
+void runWal(const char* label, bool useLog, int transactions, int pages)
+{
+	removeFile("benchWal");
+	{
+		BlobFile file("benchWal", true);
+		for (int i = 0; i < 1000; i++)
+		{
+			PageId pageNo;
+			file.allocatePage(pageNo);
+		}
+	}
+	unlink("benchWal.log");
+	LogManager* log = NULL;
+	if (useLog)
+	{
+		log = new LogManager("benchWal.log");
+		File::setLogManager(log);
+	}
+	else
+	{
+		File::setDurability(DURABILITY_PER_COMMIT);
+	}
+
+	{
+		BlobFile file("benchWal", false);
+		BufMgr bufMgr(1000);
+		std::mt19937 random(564);
+		std::uniform_int_distribution<int> pageNos(1, 1000);
+		Clock::time_point start = Clock::now();
+		for (int t = 0; t < transactions; t++)
+		{
+			for (int p = 0; p < pages; p++)
+			{
+				PageId pageNo = pageNos(random);
+				Page* page;
+				bufMgr.readPage(&file, pageNo, page);
+				reinterpret_cast<int*>(page)[t % 100] = t;
+				bufMgr.unPinPage(&file, pageNo, true);
+			}
+			if (useLog)
+				log->commit();
+			else
+				bufMgr.flushFile(&file);
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		std::cout << label << ": " << (long)(transactions / seconds) << " commits/s";
+		if (useLog)
+			std::cout << ", " << log->getStats().bytes / transactions << " log bytes each";
+		std::cout << "\n";
+	}
+
+	File::setLogManager(NULL);
+	File::setDurability(DURABILITY_NONE);
+	delete log;
+	unlink("benchWal.log");
+	removeFile("benchWal");
+}
+
+/**
+ * Usage: wal [transactions] [pages per transaction]
+ */
+int benchWal(int argc, char **argv)
+{
+	int transactions = argc > 0 ? atoi(argv[0]) : 2000;
+	int pages = argc > 1 ? atoi(argv[1]) : 4;
+
+	runWal("page writes", false, transactions, pages);
+	runWal("write-ahead", true, transactions, pages);
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// io: page reads and writes with each I/O backend
+// -----------------------------------------------------------------------------
+
+/**
+ * Writes <pages> pages of a blob file, then does <reads> random page reads
+ * from each of <threads> threads, and prints the throughput of both.
+ */
+void runIoBackend(const char* label, IoBackend backend, int pages, int reads,
+                  int threads)
+{
+	File::setIoBackend(backend);
+	removeFile("benchIo");
+
+	Clock::time_point start = Clock::now();
+	{
+		BlobFile file = BlobFile::create("benchIo");
+		Page page;
+		for (int i = 0; i < pages; i++)
+		{
+			PageId pageNumber;
+			file.allocatePage(pageNumber);
+			file.writePage(pageNumber, page);
+		}
+	}
+	double writeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	start = Clock::now();
+	{
+		std::vector<std::thread> readers;
+		for (int t = 0; t < threads; t++)
+		{
+			readers.push_back(std::thread([=]() {
+				BlobFile file = BlobFile::open("benchIo");
+				std::mt19937 random(t);
+				std::uniform_int_distribution<int> pageNumbers(1, pages);
+				for (int i = 0; i < reads; i++)
+					file.readPage(pageNumbers(random));
+			}));
+		}
+		for (int t = 0; t < threads; t++)
+			readers[t].join();
+	}
+	double readSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << label << ": writes " << (long)(pages / writeSeconds) << " pages/s, "
+		<< threads << " thread reads " << (long)((double)reads * threads / readSeconds)
+		<< " pages/s\n";
+	removeFile("benchIo");
+}
+
+/**
+ * Usage: io [pages] [reads per thread] [threads]
+ */
+int benchIo(int argc, char **argv)
+{
+	int pages = argc > 0 ? atoi(argv[0]) : 10000;
+	int reads = argc > 1 ? atoi(argv[1]) : 100000;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+
+	runIoBackend("fstream    ", STREAM_BACKEND, pages, reads, 1);
+	runIoBackend("pread      ", POSIX_BACKEND, pages, reads, 1);
+	runIoBackend("fstream    ", STREAM_BACKEND, pages, reads, threads);
+	runIoBackend("pread      ", POSIX_BACKEND, pages, reads, threads);
+	File::setIoBackend(POSIX_BACKEND);
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// mmap: full file scans and index range scans with each I/O backend
+// -----------------------------------------------------------------------------
+
+/**
+ * Scans all of relation "benchScan" and then does <scans> index range scans of
+ * <width> keys each, through a buffer pool of 100 pages, and prints the time
+ * of each.
+ */
+void runScans(const char* label, IoBackend backend, int relationSize, int scans,
+              int width)
+{
+	File::setIoBackend(backend);
+	BufMgr bufMgr(100);
+
+	Clock::time_point start = Clock::now();
+	long records = 0;
+	{
+		FileScan scan("benchScan", &bufMgr);
+		try
+		{
+			RecordId rid;
+			while (1)
+			{
+				scan.scanNext(rid);
+				records++;
+			}
+		}
+		catch(const EndOfFileException &e)
+		{
+		}
+	}
+	double scanSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	start = Clock::now();
+	long entries = 0;
+	{
+		std::string indexName;
+		BTreeIndex index("benchScan", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+		std::mt19937 random(564);
+		std::uniform_int_distribution<int> keys(0, relationSize - width);
+		for (int i = 0; i < scans; i++)
+		{
+			int low = keys(random);
+			int high = low + width;
+			index.startScan(&low, GTE, &high, LT);
+			try
+			{
+				RecordId rid;
+				while (1)
+				{
+					index.scanNext(rid);
+					entries++;
+				}
+			}
+			catch(const IndexScanCompletedException &e)
+			{
+			}
+			index.endScan();
+		}
+	}
+	double indexSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << label << ": file scan of " << records << " records " << scanSeconds
+		<< " s, " << scans << " index range scans (" << entries << " entries) "
+		<< indexSeconds << " s\n";
+}
+
+/**
+ * Usage: mmap [records] [range scans] [range width]
+ */
+int benchMmap(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 1000000;
+	int scans = argc > 1 ? atoi(argv[1]) : 1000;
+	int width = argc > 2 ? atoi(argv[2]) : 10000;
+
+	createRelation("benchScan", relationSize);
+	const std::string indexName = "benchScan." + std::to_string(offsetof(tuple,i));
+	removeFile(indexName);
+	{
+		std::string name;
+		BufMgr bufMgr(100);
+		BTreeIndex index("benchScan", name, &bufMgr, offsetof(tuple,i), INTEGER);
+	}
+
+	runScans("fstream    ", STREAM_BACKEND, relationSize, scans, width);
+	runScans("pread      ", POSIX_BACKEND, relationSize, scans, width);
+	runScans("mmap       ", MMAP_BACKEND, relationSize, scans, width);
+	File::setIoBackend(POSIX_BACKEND);
+
+	removeFile("benchScan");
+	removeFile(indexName);
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// async: page reads and flushes one at a time and with AsyncIo
+// -----------------------------------------------------------------------------
+
+/**
+ * Drops the pages of a file from the OS page cache, so they are read from disk.
+ */
+void dropCache(const std::string& filename)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	::close(fd);
+}
+
+/**
+ * Reads every page of "benchAsync" in a random order through a buffer pool
+ * holding all of them, prefetching <batch> pages at a time with <io> (none if
+ * NULL), then dirties them all and flushes the file, and prints the time of
+ * each.
+ */
+void runAsync(const char* label, AsyncIo* io, int pages, int batch)
+{
+	std::vector<PageId> pageNos;
+	for (int i = 1; i <= pages; i++)
+		pageNos.push_back(i);
+	std::shuffle(pageNos.begin(), pageNos.end(), std::mt19937(564));
+
+	BlobFile file("benchAsync", false);
+	BufMgr bufMgr(pages);
+	if (io != NULL)
+		bufMgr.setAsyncIo(io);
+	dropCache("benchAsync");
+
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < pages; i += batch)
+	{
+		if (io != NULL)
+		{
+			std::vector<PageId> next(pageNos.begin() + i,
+			                         pageNos.begin() + std::min(i + batch, pages));
+			bufMgr.prefetch(&file, next);
+		}
+		for (int j = i; j < i + batch && j < pages; j++)
+		{
+			Page* page;
+			bufMgr.readPage(&file, pageNos[j], page);
+			bufMgr.unPinPage(&file, pageNos[j], false);
+		}
+	}
+	double readSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	for (int i = 0; i < pages; i++)
+	{
+		Page* page;
+		bufMgr.readPage(&file, pageNos[i], page);
+		bufMgr.unPinPage(&file, pageNos[i], true);
+	}
+	start = Clock::now();
+	bufMgr.flushFile(&file);
+	double flushSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << label << ": reads " << (long)(pages / readSeconds) << " pages/s, flush "
+		<< (long)(pages / flushSeconds) << " pages/s\n";
+}
+
+/**
+ * Usage: async [pages] [prefetch batch] [depth]
+ */
+int benchAsync(int argc, char **argv)
+{
+	int pages = argc > 0 ? atoi(argv[0]) : 20000;
+	int batch = argc > 1 ? atoi(argv[1]) : 256;
+	int depth = argc > 2 ? atoi(argv[2]) : 64;
+
+	removeFile("benchAsync");
+	{
+		BlobFile file("benchAsync", true);
+		for (int i = 0; i < pages; i++)
+		{
+			PageId pageNo;
+			file.allocatePage(pageNo);
+		}
+	}
+
+	AsyncIo* uring = AsyncIo::create(depth, true);
+	if (!uring->usesIoUring())
+		std::cout << "io_uring is not available, using threads\n";
+	runAsync("one at a time", AsyncIo::create(1, false), pages, 1);
+	runAsync("threads      ", AsyncIo::create(depth, false), pages, batch);
+	runAsync("io_uring     ", uring, pages, batch);
+
+	removeFile("benchAsync");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// checksum: full scans of a relation with and without page checksums
+// -----------------------------------------------------------------------------
+
+/**
+ * Creates relation "benchChecksum" of <relationSize> records with or without
+ * page checksums, scans all of it <scans> times through a buffer pool of 100
+ * pages, and prints the time of the load and of the fastest scan.
+ */
+void runChecksumScans(const char* label, bool checksums, int relationSize, int scans)
+{
+	File::setPageChecksums(checksums);
+	Clock::time_point start = Clock::now();
+	createRelation("benchChecksum", relationSize);
+	double loadSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	File::setPageChecksums(false);
+
+	double best = 0;
+	long records = 0;
+	for (int i = 0; i < scans; i++)
+	{
+		BufMgr bufMgr(100);
+		records = 0;
+		start = Clock::now();
+		{
+			FileScan scan("benchChecksum", &bufMgr);
+			try
+			{
+				RecordId rid;
+				while (1)
+				{
+					scan.scanNext(rid);
+					records++;
+				}
+			}
+			catch(const EndOfFileException &e)
+			{
+			}
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		if (i == 0 || seconds < best)
+			best = seconds;
+	}
+
+	std::cout << label << ": load " << loadSeconds << " s, scan of " << records
+		<< " records " << best << " s (" << (long)(records / best) << " records/s)\n";
+	removeFile("benchChecksum");
+}
+
+/**
+ * Usage: checksum [records] [scans]
+ */
+int benchChecksum(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	int scans = argc > 1 ? atoi(argv[1]) : 5;
+
+	// raw checksum speed, on one page
+	Page page;
+	const int rounds = 100000;
+	Clock::time_point start = Clock::now();
+	std::uint32_t crc = 0;
+	for (int i = 0; i < rounds; i++)
+		crc = crc32c(&page, Page::SIZE, crc);
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << "crc32c (" << (crc32cAccelerated() ? "sse4.2" : "tables") << "): "
+		<< (long)(rounds * (double)Page::SIZE / seconds / 1e6) << " MB/s\n";
+
+	runChecksumScans("no checksums", false, relationSize, scans);
+	runChecksumScans("checksums   ", true, relationSize, scans);
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// fsm: record inserts into the holes left by deletes
+// -----------------------------------------------------------------------------
+
+/**
+ * Returns the number of used pages of a file.
+ */
+int countPages(PageFile& file)
+{
+	int pages = 0;
+	for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+		pages++;
+	return pages;
+}
+
+/**
+ * Usage: fsm [records] [fraction deleted]
+ */
+int benchFsm(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	double fraction = argc > 1 ? atof(argv[1]) : 0.5;
+
+	createRelation("benchFsm", relationSize);
+	{
+		PageFile file = PageFile::open("benchFsm");
+		const int pagesLoaded = countPages(file);
+
+		// Delete the given fraction of the records of every page.
+		std::vector<std::string> deleted;
+		for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+		{
+			Page page = *iter;
+			std::vector<RecordId> rids;
+			for (PageIterator pageIter = page.begin(); pageIter != page.end(); ++pageIter)
+				rids.push_back(pageIter.getCurrentRecord());
+			for (std::size_t i = 0; i < rids.size() * fraction; i++)
+			{
+				deleted.push_back(page.getRecord(rids[i]));
+				page.deleteRecord(rids[i]);
+			}
+			file.writePage(page.page_number(), page);
+		}
+
+		Clock::time_point start = Clock::now();
+		for (std::size_t i = 0; i < deleted.size(); i++)
+			file.insertRecord(deleted[i]);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::cout << "loaded " << pagesLoaded << " pages, deleted " << deleted.size()
+			<< " records and inserted them again in " << seconds << " s ("
+			<< (long)(deleted.size() / seconds) << " inserts/s), now "
+			<< countPages(file) << " pages\n";
+	}
+
+	removeFile("benchFsm");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// extent: blob page allocation, on its own and while building an index
+// -----------------------------------------------------------------------------
+
+/**
+ * Usage: extent [pages] [records]
+ */
+int benchExtent(int argc, char **argv)
+{
+	int numPages = argc > 0 ? atoi(argv[0]) : 100000;
+	int relationSize = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	removeFile("benchExtent");
+	Clock::time_point start = Clock::now();
+	{
+		BlobFile blob = BlobFile::create("benchExtent");
+		PageId pageNo;
+		for (int i = 0; i < numPages; i++)
+		{
+			Page page = blob.allocatePage(pageNo);
+			blob.writePage(pageNo, page);
+		}
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << "allocated and wrote " << numPages << " blob pages in " << seconds
+		<< " s (" << (long)(numPages / seconds) << " pages/s)\n";
+	removeFile("benchExtent");
+
+	createRelation("benchExtent", relationSize);
+	const std::string indexName = "benchExtent." + std::to_string(offsetof(tuple,i));
+	removeFile(indexName);
+	start = Clock::now();
+	{
+		std::string name;
+		BufMgr bufMgr(100);
+		BTreeIndex index("benchExtent", name, &bufMgr, offsetof(tuple,i), INTEGER);
+	}
+	seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << "built an index on " << relationSize << " records in " << seconds
+		<< " s\n";
+
+	removeFile("benchExtent");
+	removeFile(indexName);
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// header: random page reads of a PageFile, which bounds-check against the
+// file header
+// -----------------------------------------------------------------------------
+
+/**
+ * Usage: header [records] [reads]
+ */
+int benchHeader(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	int reads = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	createRelation("benchHeader", relationSize);
+	{
+		PageFile file = PageFile::open("benchHeader");
+		std::vector<PageId> pageNumbers;
+		for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+			pageNumbers.push_back((*iter).page_number());
+
+		std::mt19937 random(564);
+		std::uniform_int_distribution<std::size_t> pick(0, pageNumbers.size() - 1);
+		Page page;
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < reads; i++)
+			file.readPageInto(pageNumbers[pick(random)], page);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::cout << reads << " random reads of " << pageNumbers.size() << " pages in "
+			<< seconds << " s (" << (long)(reads / seconds) << " pages/s)\n";
+	}
+
+	removeFile("benchHeader");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// direct: buffered against direct I/O for the same memory
+// -----------------------------------------------------------------------------
+
+/**
+ * Reads pages of "benchDirect" through a pool of <frames> frames, with the
+ * file's pages cold in the OS cache at the start.  Four reads in five go to
+ * the first fifth of the pages.
+ */
+void runPoolReads(const char* label, IoBackend backend, std::uint32_t frames,
+                  const std::vector<PageId>& pageNumbers, int reads)
+{
+	File::setIoBackend(backend);
+	dropCache("benchDirect");
+	PageFile file = PageFile::open("benchDirect");
+	BufMgr bufMgr(frames);
+
+	std::mt19937 random(564);
+	std::uniform_int_distribution<std::size_t> hot(0, pageNumbers.size() / 5);
+	std::uniform_int_distribution<std::size_t> any(0, pageNumbers.size() - 1);
+	std::uniform_int_distribution<int> percent(0, 99);
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < reads; i++)
+	{
+		const PageId pageNo = pageNumbers[percent(random) < 80 ? hot(random) : any(random)];
+		Page* page;
+		bufMgr.readPage(&file, pageNo, page);
+		bufMgr.unPinPage(&file, pageNo, false);
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << label << frames << " frames: " << (long)(reads / seconds)
+		<< " reads/s, " << bufMgr.getBufStats().diskreads << " pool misses\n";
+	bufMgr.flushFile(&file);
+}
+
+/**
+ * Usage: direct [records] [memory in pages] [reads]
+ *
+ * Buffered I/O splits the memory between the pool and the OS cache (which
+ * the run cannot cap, so it is shown at half and at all of it); direct I/O
+ * gives all of it to the pool.
+ */
+int benchDirect(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	std::uint32_t memory = argc > 1 ? atoi(argv[1]) : 2000;
+	int reads = argc > 2 ? atoi(argv[2]) : 200000;
+
+	createRelation("benchDirect", relationSize);
+	std::vector<PageId> pageNumbers;
+	{
+		PageFile file = PageFile::open("benchDirect");
+		for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+			pageNumbers.push_back((*iter).page_number());
+	}
+	std::cout << pageNumbers.size() << " pages, " << memory << " pages of memory\n";
+
+	runPoolReads("buffered, pool of ", POSIX_BACKEND, memory / 2, pageNumbers, reads);
+	runPoolReads("buffered, pool of ", POSIX_BACKEND, memory, pageNumbers, reads);
+	runPoolReads("direct,   pool of ", DIRECT_BACKEND, memory, pageNumbers, reads);
+	File::setIoBackend(POSIX_BACKEND);
+
+	removeFile("benchDirect");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// compress: disk footprint and reads of compressed pages
+// -----------------------------------------------------------------------------
+
+/**
+ * Prints the size of a file and the disk space it takes up.
+ */
+void printFootprint(const char* label, const std::string& filename)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return;
+	std::cout << "  " << label << ": " << st.st_size / 1024 << " KB, "
+		<< st.st_blocks * 512 / 1024 << " KB on disk\n";
+}
+
+/**
+ * Creates relation "benchCompress" of <relationSize> records and an index on
+ * its integer attribute, with or without page compression, and prints their
+ * footprint and the time of a scan of the relation with its pages cold in the
+ * OS cache and of the fastest of <scans> warm ones.
+ */
+void runCompressedScans(const char* label, bool compression, int relationSize, int scans)
+{
+	File::setPageCompression(compression);
+	Clock::time_point start = Clock::now();
+	createRelation("benchCompress", relationSize);
+	std::string indexName;
+	{
+		BufMgr bufMgr(100);
+		BTreeIndex index("benchCompress", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+	}
+	double loadSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	File::setPageCompression(false);
+
+	std::cout << label << ": load and index " << loadSeconds << " s\n";
+	printFootprint("relation", "benchCompress");
+	printFootprint("index   ", indexName);
+
+	dropCache("benchCompress");
+	double cold = 0, best = 0;
+	long records = 0;
+	for (int i = 0; i <= scans; i++)
+	{
+		BufMgr bufMgr(100);
+		records = 0;
+		start = Clock::now();
+		{
+			FileScan scan("benchCompress", &bufMgr);
+			try
+			{
+				RecordId rid;
+				while (1)
+				{
+					scan.scanNext(rid);
+					records++;
+				}
+			}
+			catch(const EndOfFileException &e)
+			{
+			}
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		if (i == 0)
+			cold = seconds;
+		else if (i == 1 || seconds < best)
+			best = seconds;
+	}
+
+	std::cout << "  scan of " << records << " records: cold " << cold << " s ("
+		<< (long)(records / cold) << " records/s), warm " << best << " s ("
+		<< (long)(records / best) << " records/s)\n";
+	removeFile("benchCompress");
+	removeFile(indexName);
+}
+
+/**
+ * Usage: compress [records] [scans]
+ */
+int benchCompress(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	int scans = argc > 1 ? atoi(argv[1]) : 5;
+
+	runCompressedScans("raw pages       ", false, relationSize, scans);
+	runCompressedScans("compressed pages", true, relationSize, scans);
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// pagesize: scans and point lookups at the page size the tree was built with
+// -----------------------------------------------------------------------------
+
+/**
+ * Usage: pagesize [records] [memory in KB] [lookups]
+ *
+ * Loads relation "benchPageSize" and indexes its integer attribute, then scans
+ * it with its pages cold in the OS cache and does random point lookups on the
+ * index, through a buffer pool of the same memory whatever the page size.
+ * Build with make PAGE_SIZE=... to compare page sizes.
+ */
+int benchPageSize(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	std::size_t memory = (argc > 1 ? atoi(argv[1]) : 4096) * 1024;
+	int lookups = argc > 2 ? atoi(argv[2]) : 200000;
+	const std::uint32_t frames = memory / Page::SIZE;
+
+	Clock::time_point start = Clock::now();
+	createRelation("benchPageSize", relationSize);
+	double loadSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::string indexName;
+	start = Clock::now();
+	{
+		BufMgr bufMgr(frames);
+		BTreeIndex index("benchPageSize", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+	}
+	double indexSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << Page::SIZE << " byte pages, leaf fanout " << INTARRAYLEAFSIZE
+		<< ", non-leaf fanout " << INTARRAYNONLEAFSIZE << ", pool of " << frames
+		<< " frames\n  load " << loadSeconds << " s, index " << indexSeconds << " s\n";
+
+	dropCache("benchPageSize");
+	long records = 0;
+	BufMgr bufMgr(frames);
+	start = Clock::now();
+	{
+		FileScan scan("benchPageSize", &bufMgr);
+		try
+		{
+			RecordId rid;
+			while (1)
+			{
+				scan.scanNext(rid);
+				records++;
+			}
+		}
+		catch(const EndOfFileException &e)
+		{
+		}
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << "  cold scan " << (long)(records / seconds) << " records/s, "
+		<< bufMgr.getBufStats().diskreads << " page reads\n";
+
+	dropCache(indexName);
+	bufMgr.clearBufStats();
+	{
+		BTreeIndex index("benchPageSize", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+		std::mt19937 random(564);
+		std::uniform_int_distribution<int> keys(0, relationSize - 1);
+		start = Clock::now();
+		for (int i = 0; i < lookups; i++)
+		{
+			int key = keys(random);
+			RecordId rid;
+			index.startScan(&key, GTE, &key, LTE);
+			index.scanNext(rid);
+			index.endScan();
+		}
+		seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	}
+	std::cout << "  point lookups " << (long)(lookups / seconds) << "/s, "
+		<< bufMgr.getBufStats().diskreads << " page reads\n";
+
+	removeFile("benchPageSize");
+	removeFile(indexName);
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// registry: concurrent open and close
+// -----------------------------------------------------------------------------
+
+/**
+ * Has each of <threads> threads open, read a page of and close files out of
+ * <files> files "benchRegistry<n>" <opens> times, and prints the opens per
+ * second for all of them.  With one file every thread opens the same one.
+ */
+void runOpens(int threads, int files, int opens)
+{
+	std::vector<std::thread> openers;
+	Clock::time_point start = Clock::now();
+	for (int t = 0; t < threads; t++)
+	{
+		openers.push_back(std::thread([=]() {
+			Page page;
+			for (int i = 0; i < opens; i++)
+			{
+				const std::string name = "benchRegistry" + std::to_string((t + i) % files);
+				BlobFile file = BlobFile::open(name);
+				file.readPageInto(1, page);
+			}
+		}));
+	}
+	for (int t = 0; t < threads; t++)
+		openers[t].join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << "  " << threads << " threads, " << files << " files: "
+		<< (long)(threads * opens / seconds) << " opens/s\n";
+}
+
+int benchRegistry(int argc, char **argv)
+{
+	int opens = argc > 0 ? atoi(argv[0]) : 100000;
+	int maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+
+	const int numFiles = 64;
+	for (int i = 0; i < numFiles; i++)
+	{
+		const std::string name = "benchRegistry" + std::to_string(i);
+		removeFile(name);
+		BlobFile file = BlobFile::create(name);
+		PageId pageNo;
+		Page page = file.allocatePage(pageNo);
+		file.writePage(pageNo, page);
+	}
+
+	// One file that stays open, so only the registry is exercised, then many
+	// that are opened for real.
+	{
+		BlobFile hot = BlobFile::open("benchRegistry0");
+		std::cout << "hot file, open elsewhere\n";
+		for (int threads = 1; threads <= maxThreads; threads *= 2)
+			runOpens(threads, 1, opens);
+	}
+	std::cout << "files opened and closed\n";
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+		runOpens(threads, numFiles, opens / 4);
+
+	for (int i = 0; i < numFiles; i++)
+		removeFile("benchRegistry" + std::to_string(i));
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// delete: deleting every page of a relation
+// -----------------------------------------------------------------------------
+
+int benchDelete(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+
+	createRelation("benchDelete", relationSize);
+	{
+		PageFile file = PageFile::open("benchDelete");
+		std::vector<PageId> pageNumbers;
+		for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+			pageNumbers.push_back((*iter).page_number());
+		std::mt19937 random(564);
+		std::shuffle(pageNumbers.begin(), pageNumbers.end(), random);
+
+		Clock::time_point start = Clock::now();
+		for (std::size_t i = 0; i < pageNumbers.size(); i++)
+			file.deletePage(pageNumbers[i]);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::cout << pageNumbers.size() << " pages deleted in random order in "
+			<< seconds << " s (" << (long)(pageNumbers.size() / seconds) << " pages/s)\n";
+	}
+
+	removeFile("benchDelete");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// directory: enumerating and partitioning the pages of a relation
+// -----------------------------------------------------------------------------
+
+int benchDirectory(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	int maxThreads = argc > 1 ? atoi(argv[1]) : 4;
+
+	createRelation("benchDirectory", relationSize);
+	{
+		PageFile file = PageFile::open("benchDirectory");
+		file.sync();
+		dropCache("benchDirectory");
+		Clock::time_point start = Clock::now();
+		std::size_t pages = 0;
+		for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+			pages++;
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		std::cout << pages << " pages enumerated cold in " << seconds * 1000 << " ms\n";
+
+		// Each thread reads the pages of its part of the file, cold.
+		for (int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			dropCache("benchDirectory");
+			std::vector<std::pair<FileIterator, FileIterator> > parts = file.partition(threads);
+			std::vector<std::thread> scanners;
+			start = Clock::now();
+			for (int t = 0; t < threads; t++)
+			{
+				scanners.push_back(std::thread([&, t]() {
+					for (FileIterator iter = parts[t].first; iter != parts[t].second; ++iter)
+						*iter;
+				}));
+			}
+			for (int t = 0; t < threads; t++)
+				scanners[t].join();
+			seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			std::cout << "  " << threads << " threads: " << (long)(pages / seconds)
+				<< " pages/s\n";
+		}
+	}
+
+	removeFile("benchDirectory");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// checkpoint: index builds under a write-ahead log, with and without a
+// background checkpointer
+// -----------------------------------------------------------------------------
+
+/**
+ * Builds an index on "benchCheckpoint" through a pool of <frames> frames with
+ * a write-ahead log, taking a checkpoint every <interval> ms (none if 0), and
+ * prints the build rate and how much of the log recovery would still read.
+ */
+void runCheckpoint(const char* label, int relationSize, std::uint32_t frames,
+                   unsigned interval, std::uint32_t maxDirty)
+{
+	LogManager* log = new LogManager("benchCheckpoint.log");
+	File::setLogManager(log);
+	{
+		BufMgr bufMgr(frames);
+		if (interval > 0)
+			bufMgr.startCheckpointer(interval, maxDirty);
+		std::string indexName;
+		Clock::time_point start = Clock::now();
+		{
+			BTreeIndex index("benchCheckpoint", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			bufMgr.stopCheckpointer();
+
+			struct stat st;
+			stat("benchCheckpoint.log", &st);
+			std::cout << label << ": " << (long)(relationSize / seconds) << " keys/s, "
+				<< bufMgr.getBufStats().checkpoints << " checkpoints, "
+				<< st.st_size / 1024 << " KB logged, "
+				<< st.st_blocks * 512 / 1024 << " KB left to recover from\n";
+		}
+		removeFile(indexName);
+	}
+	File::setLogManager(NULL);
+	delete log;
+	unlink("benchCheckpoint.log");
+	unlink("benchCheckpoint.log.checkpoint");
+}
+
+/**
+ * Usage: checkpoint [records] [frames] [interval in ms] [max dirty frames]
+ */
+int benchCheckpoint(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 100000;
+	std::uint32_t frames = argc > 1 ? atoi(argv[1]) : 1000;
+	unsigned interval = argc > 2 ? atoi(argv[2]) : 100;
+	std::uint32_t maxDirty = argc > 3 ? atoi(argv[3]) : frames / 4;
+
+	createRelation("benchCheckpoint", relationSize);
+	runCheckpoint("no checkpoints", relationSize, frames, 0, 0);
+	runCheckpoint("checkpointer  ", relationSize, frames, interval, maxDirty);
+	removeFile("benchCheckpoint");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// shadow: durable index inserts by write-ahead logging or by shadow paging
+// -----------------------------------------------------------------------------
+
+/**
+ * Builds an index on "benchShadow", then inserts <inserts> keys one durable
+ * insertEntry() at a time, either logging the changed nodes or copying them
+ * with shadow paging, and prints the insert rate and the bytes written.
+ */
+void runShadow(const char* label, bool shadow, int relationSize, int inserts)
+{
+	LogManager* log = NULL;
+	if (!shadow)
+	{
+		log = new LogManager("benchShadow.log");
+		File::setLogManager(log);
+	}
+	BTreeIndex::setShadowPaging(shadow);
+	{
+		BufMgr bufMgr(1000);
+		std::string indexName;
+		{
+			BTreeIndex index("benchShadow", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+			bufMgr.getBufStats().clear();
+			std::uint64_t logBytes = log != NULL ? log->getStats().bytes : 0;
+			std::mt19937 random(564);
+			std::uniform_int_distribution<int> keys(relationSize, 2 * relationSize);
+			RecordId rid = {1, 1, 0};
+			Clock::time_point start = Clock::now();
+			for (int i = 0; i < inserts; i++)
+			{
+				int key = keys(random);
+				index.insertEntry(&key, rid);
+			}
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			if (log != NULL)
+				logBytes = log->getStats().bytes - logBytes;
+			std::cout << label << ": " << (long)(inserts / seconds) << " inserts/s, "
+				<< (bufMgr.getBufStats().bytesWritten + logBytes) / inserts
+				<< " bytes written each\n";
+		}
+		removeFile(indexName);
+	}
+	BTreeIndex::setShadowPaging(false);
+	File::setLogManager(NULL);
+	delete log;
+	unlink("benchShadow.log");
+}
+
+/**
+ * Usage: shadow [records] [inserts]
+ */
+int benchShadow(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 100000;
+	int inserts = argc > 1 ? atoi(argv[1]) : 1000;
+
+	createRelation("benchShadow", relationSize);
+	runShadow("write-ahead log", false, relationSize, inserts);
+	runShadow("shadow paging  ", true, relationSize, inserts);
+	removeFile("benchShadow");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// hints: cold scans with and without access pattern hints to the OS
+// -----------------------------------------------------------------------------
+
+/**
+ * Scans "benchHints" with a FileScan and then its index over its whole key
+ * range, each from a cold OS cache through a small buffer pool, with hints
+ * on or off, and prints the record rates.
+ */
+void runHints(const char* label, bool hints, int relationSize, const std::string& indexName)
+{
+	File::setAccessHints(hints);
+	BufMgr bufMgr(100);
+
+	dropCache("benchHints");
+	Clock::time_point start = Clock::now();
+	{
+		FileScan scan("benchHints", &bufMgr);
+		RecordId rid;
+		try
+		{
+			while (true)
+				scan.scanNext(rid);
+		}
+		catch(const EndOfFileException &e)
+		{
+		}
+	}
+	double scanSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	dropCache(indexName);
+	start = Clock::now();
+	{
+		std::string name;
+		BTreeIndex index("benchHints", name, &bufMgr, offsetof(tuple,i), INTEGER);
+		int low = 0, high = relationSize;
+		RecordId rid;
+		index.startScan(&low, GTE, &high, LT);
+		try
+		{
+			while (true)
+				index.scanNext(rid);
+		}
+		catch(const IndexScanCompletedException &e)
+		{
+		}
+		index.endScan();
+	}
+	double indexSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << label << ": file scan " << (long)(relationSize / scanSeconds)
+		<< " records/s, index range scan " << (long)(relationSize / indexSeconds)
+		<< " entries/s\n";
+	File::setAccessHints(true);
+}
+
+/**
+ * Usage: hints [records] [runs]
+ */
+int benchHints(int argc, char **argv)
+{
+	int relationSize = argc > 0 ? atoi(argv[0]) : 470000;
+	int runs = argc > 1 ? atoi(argv[1]) : 3;
+
+	createRelation("benchHints", relationSize);
+	std::string indexName;
+	{
+		BufMgr bufMgr(1000);
+		BTreeIndex index("benchHints", indexName, &bufMgr, offsetof(tuple,i), INTEGER);
+	}
+	for (int i = 0; i < runs; i++)
+	{
+		runHints("no hints", false, relationSize, indexName);
+		runHints("hints   ", true, relationSize, indexName);
+	}
+	removeFile(indexName);
+	removeFile("benchHints");
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+struct Benchmark {
+	const char* name;
+	int (*run)(int argc, char **argv);
+	const char* usage;
+};
+
+const Benchmark benchmarks[] = {
+	{ "scheduler", benchScheduler, "[records] [write limit in bytes/s] [queue depth]" },
+	{ "load", benchLoad, "[max records] [min records]" },
+	{ "durability", benchDurability, "[records] [group interval in ms]" },
+	{ "wal", benchWal, "[transactions] [pages per transaction]" },
+	{ "io", benchIo, "[pages] [reads per thread] [threads]" },
+	{ "mmap", benchMmap, "[records] [range scans] [range width]" },
+	{ "async", benchAsync, "[pages] [prefetch batch] [depth]" },
+	{ "checksum", benchChecksum, "[records] [scans]" },
+	{ "fsm", benchFsm, "[records] [fraction deleted]" },
+	{ "extent", benchExtent, "[pages] [records]" },
+	{ "header", benchHeader, "[records] [reads]" },
+	{ "direct", benchDirect, "[records] [memory in pages] [reads]" },
+	{ "compress", benchCompress, "[records] [scans]" },
+	{ "pagesize", benchPageSize, "[records] [memory in KB] [lookups]" },
+	{ "registry", benchRegistry, "[opens per thread] [max threads]" },
+	{ "delete", benchDelete, "[records]" },
+	{ "directory", benchDirectory, "[records] [max threads]" },
+	{ "checkpoint", benchCheckpoint, "[records] [frames] [interval in ms] [max dirty frames]" },
+	{ "shadow", benchShadow, "[records] [inserts]" },
+	{ "hints", benchHints, "[records] [runs]" },
+};
+
+int main(int argc, char **argv)
+{
+	const std::size_t numBenchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	if (argc >= 2)
+	{
+		for (std::size_t i = 0; i < numBenchmarks; i++)
+		{
+			if (strcmp(argv[1], benchmarks[i].name) == 0)
+				return benchmarks[i].run(argc - 2, argv + 2);
+		}
+	}
+
+	std::cerr << "usage: " << argv[0] << " <benchmark> [arguments]\n";
+	for (std::size_t i = 0; i < numBenchmarks; i++)
+		std::cerr << "  " << benchmarks[i].name << " " << benchmarks[i].usage << "\n";
+	return 1;
+}
@@ -7,6 +7,8 @@
 
 #include "btree.h"
 #include "filescan.h"
+#include "crc32c.h"
+#include "log_manager.h"
 #include "exceptions/bad_index_info_exception.h"
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/bad_scanrange_exception.h"
@@ -15,12 +17,15 @@
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/page_checksum_exception.h"
 
 
 // #define DEBUG
 
 namespace badgerdb {
 
+bool BTreeIndex::newIndexShadowPaging = false;
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::BTreeIndex -- Constructor
 // -----------------------------------------------------------------------------
@@ -42,29 +47,54 @@ BTreeIndex::BTreeIndex(const std::string & relationName, std::string & outIndexN
 	this->attributeType = attrType;
 	this->attrByteOffset = attrByteOffset;
 	this->height = 0;
+	this->shadowPaging = newIndexShadowPaging;
 	this->scanExecuting = false;
 	this->currentPageNum = Page::INVALID_NUMBER;
-	this->leafOccupancy = (Page::SIZE - sizeof(PageId)) / (sizeof(int) + sizeof(RecordId));
-	this->nodeOccupancy = (Page::SIZE - sizeof(int) - sizeof(PageId) ) / (sizeof(int) + sizeof(PageId));
+	this->leafOccupancy = INTARRAYLEAFSIZE;
+	this->nodeOccupancy = INTARRAYNONLEAFSIZE;
 
 	// if index file exists, read
 	if(exist){
 
-		Page *headerPage;
 		this->headerPageNum = 1;
-		// reads header page
-		this->bufMgr->readPage(this->file, this->headerPageNum, headerPage);
+		// reads both meta pages, the newer whole copy is current
+		IndexMetaInfo metaInfos[2];
+		bool whole[2];
+		bool torn[2] = {false, false};
+		this->metaSequence = 0;
+		int current = -1;
+		for (int i = 0; i < 2; i++) {
+			try {
+				whole[i] = this->readMeta(this->headerPageNum + i, metaInfos[i]);
+			}
+			catch (const PageChecksumException &e) {
+				whole[i] = false;
+				torn[i] = true;
+			}
+			if (whole[i] && metaInfos[i].sequence > this->metaSequence) {
+				this->metaSequence = metaInfos[i].sequence;
+				current = i;
+			}
+		}
 
 		// checks if it matches meta page
-		IndexMetaInfo *indexMetaInf = (IndexMetaInfo*)headerPage;
-		if(strcmp(indexMetaInf->relationName, relationName.c_str()) != 0 || indexMetaInf->attrByteOffset != this->attrByteOffset || indexMetaInf->attrType != this->attributeType){
+		if(current < 0 || strcmp(metaInfos[current].relationName, relationName.c_str()) != 0 || metaInfos[current].attrByteOffset != this->attrByteOffset || metaInfos[current].attrType != this->attributeType){
 			throw BadIndexInfoException("BadIndexInfoException");
 		}
 
 		// updates attribute based on meta page
-		this->rootPageNum = indexMetaInf->rootPageNo;
-		// unpinning
-		this->bufMgr->unPinPage(this->file, this->headerPageNum, true);
+		this->rootPageNum = metaInfos[current].rootPageNo;
+		this->height = metaInfos[current].height;
+		this->shadowPaging = metaInfos[current].shadowPaging;
+
+		// a torn meta page fails its page checksum, so it is blanked before the
+		// next copy is written to it through the buffer pool
+		PageId tornPageNum = this->metaPageNum(this->metaSequence + 1);
+		if (torn[tornPageNum - this->headerPageNum]) {
+			Page blank;
+			memset(reinterpret_cast<char*>(&blank), 0, Page::SIZE);
+			this->file->writePage(tornPageNum, blank);
+		}
 		return ;
 	}
 
@@ -75,16 +105,28 @@ BTreeIndex::BTreeIndex(const std::string & relationName, std::string & outIndexN
 		// allocates page
 		this->bufMgr->allocPage(this->file, this->headerPageNum, headerPage);
 
+		// the second meta page holds no copy until the first update
+		Page *secondHeaderPage;
+		PageId secondHeaderPageNum;
+		this->bufMgr->allocPage(this->file, secondHeaderPageNum, secondHeaderPage);
+		memset(reinterpret_cast<char*>(secondHeaderPage), 0, sizeof(IndexMetaInfo));
+
 		// set up meta/header page
 		IndexMetaInfo *indexMetaInf = (IndexMetaInfo*)headerPage;
+		memset(reinterpret_cast<char*>(indexMetaInf), 0, sizeof(IndexMetaInfo));
 		strcpy(indexMetaInf->relationName, relationName.c_str());
 		indexMetaInf->attrByteOffset = attrByteOffset;
 		indexMetaInf->attrType = attrType;
+		indexMetaInf->height = 0;
+		indexMetaInf->shadowPaging = this->shadowPaging;
 
 		// initializes root
 		Page *root;
-		this->bufMgr->allocPage(this->file, this->rootPageNum, root);
+		this->allocNode(this->rootPageNum, root);
 		indexMetaInf->rootPageNo = this->rootPageNum;
+		this->metaSequence = 1;
+		indexMetaInf->sequence = this->metaSequence;
+		indexMetaInf->checksum = crc32c(indexMetaInf, offsetof(IndexMetaInfo, checksum));
 		
 		LeafNodeInt *rootNode = (LeafNodeInt*)root;
 		rootNode->sz = 0;
@@ -92,7 +134,9 @@ BTreeIndex::BTreeIndex(const std::string & relationName, std::string & outIndexN
 
 		// unpinning
 		this->bufMgr->unPinPage(this->file, this->headerPageNum, true);
+		this->bufMgr->unPinPage(this->file, secondHeaderPageNum, true);
 		this->bufMgr->unPinPage(this->file, this->rootPageNum, true); 
+		this->commit(false);
 
 		// fill in the tree
 		FileScan *scanner = new FileScan(relationName, bufMgr);
@@ -107,15 +151,27 @@ BTreeIndex::BTreeIndex(const std::string & relationName, std::string & outIndexN
 				// initialize key
 				int key = *((int*)(record.c_str() + attrByteOffset));
 				
-				// insert entry
-				this->insertEntry(&key, rid);
+				// insert entry; each insert is a unit of recovery, but only the
+				// whole build waits for the log, and with shadow paging the build
+				// commits as a whole
+				this->insertKey(key, rid);
+				this->commit(false);
 			}
 		}
 		catch(EndOfFileException e){};
 		delete scanner;
+		this->commit(true);
 	}
 }
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::setShadowPaging -- Choose shadow paging for new indexes
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setShadowPaging(const bool enabled) {
+	newIndexShadowPaging = enabled;
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::~BTreeIndex -- Destructor
 // -----------------------------------------------------------------------------
@@ -134,8 +190,15 @@ BTreeIndex::~BTreeIndex() {
 // -----------------------------------------------------------------------------
 
 void BTreeIndex::insertEntry(const void *key, const RecordId rid) {
-	int _key = *((int*)key);
+	this->insertKey(*((int*)key), rid);
+	this->commit(true);
+}
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertKey -- Insert new key, splitting nodes up to the root
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::insertKey(int _key, const RecordId rid) {
 	std::pair<int, PageId> ret = this->insert(0, this->rootPageNum, _key, rid);
 	int newKey = ret.first;
 	PageId newPageNo = ret.second;
@@ -145,7 +208,7 @@ void BTreeIndex::insertEntry(const void *key, const RecordId rid) {
 	// allocate new root
 	Page *page;
 	PageId pageNo;
-	this->bufMgr->allocPage(this->file, pageNo, page);
+	this->allocNode(pageNo, page);
 
 	NonLeafNodeInt *node = (NonLeafNodeInt*)page;
 	node->sz = 1;
@@ -158,17 +221,89 @@ void BTreeIndex::insertEntry(const void *key, const RecordId rid) {
 	this->height += 1;
 	this->rootPageNum = pageNo;
 
-	// update metas
-	Page *headerPage;
-	this->bufMgr->readPage(this->file, this->headerPageNum, headerPage);
-	IndexMetaInfo *metaInfo = (IndexMetaInfo*)headerPage;
-	metaInfo->rootPageNo = pageNo;
-	this->bufMgr->unPinPage(this->file, this->headerPageNum, true);
+	// update metas; with shadow paging the commit does
+	if (!this->shadowPaging) {
+		this->writeMeta();
+	}
 
 	// unpin new root
 	this->bufMgr->unPinPage(this->file, pageNo, true);
 }
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::commit -- Commit the changes made so far to the write-ahead log
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::commit(bool sync) {
+	LogManager *log = File::logManager();
+	if (log != NULL) log->commit(sync);
+	if (!this->shadowPaging || !sync || this->shadowPages.empty()) return;
+
+	// the new nodes reach the disk before the root that points at them
+	this->bufMgr->writeFile(this->file);
+	this->file->sync();
+
+	// writing the new root to the meta page not written last is the commit;
+	// if the write is torn the other one still points at the old tree
+	this->writeMeta();
+	this->bufMgr->writeFile(this->file);
+	this->file->sync();
+
+	// the nodes the new tree replaced are unused once no scan reads the old one
+	this->shadowPages.clear();
+	this->retiredPages.insert(this->retiredPages.end(), this->replacedPages.begin(), this->replacedPages.end());
+	this->replacedPages.clear();
+	this->releasePages();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readMeta -- Read the copy of the meta information in a meta page
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::readMeta(PageId pageNo, IndexMetaInfo &meta) {
+	Page *page;
+	this->bufMgr->readPage(this->file, pageNo, page);
+	bool whole = ((IndexMetaInfo*)page)->checksum == crc32c(page, offsetof(IndexMetaInfo, checksum));
+	meta = *(IndexMetaInfo*)page;
+	this->bufMgr->unPinPage(this->file, pageNo, false);
+	return whole;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::writeMeta -- Write the root to the meta page not written last
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::writeMeta() {
+	PageId lastPageNum = this->metaPageNum(this->metaSequence);
+	PageId nextPageNum = this->metaPageNum(this->metaSequence + 1);
+	Page *lastPage, *nextPage;
+	this->bufMgr->readPage(this->file, lastPageNum, lastPage);
+	this->bufMgr->readPage(this->file, nextPageNum, nextPage);
+
+	IndexMetaInfo *metaInfo = (IndexMetaInfo*)nextPage;
+	memcpy(reinterpret_cast<char*>(nextPage), reinterpret_cast<char*>(lastPage), sizeof(IndexMetaInfo));
+	metaInfo->rootPageNo = this->rootPageNum;
+	metaInfo->height = this->height;
+	this->metaSequence += 1;
+	metaInfo->sequence = this->metaSequence;
+	metaInfo->checksum = crc32c(metaInfo, offsetof(IndexMetaInfo, checksum));
+
+	this->bufMgr->unPinPage(this->file, lastPageNum, false);
+	this->bufMgr->unPinPage(this->file, nextPageNum, true);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::releasePages -- Free the pages of old trees
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::releasePages() {
+	if (this->scanExecuting) return;
+	for (std::size_t i = 0; i < this->retiredPages.size(); i++) {
+		this->bufMgr->disposePage(this->file, this->retiredPages[i]);
+	}
+	this->retiredPages.clear();
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::startScan -- Begin a filtered scan
 // -----------------------------------------------------------------------------
@@ -197,8 +332,14 @@ void BTreeIndex::startScan(const void* lowValParm, const Operator lowOpParm,
 	if(highOpParm == LT) this->highValInt -= 1;
 	this->highOp = LTE;
 
+	// The scan reads the tree as it is now, whatever is committed meanwhile
+	this->scanRootPageNum = this->rootPageNum;
+	this->scanHeight = this->height;
+	this->advisedPageNum = Page::INVALID_NUMBER;
+	this->advisedLeafPageNum = Page::INVALID_NUMBER;
+
 	// Traverse to the leaf node that holds int key <= to searched value
-	this->traverseTreeToLeafHelper(this->rootPageNum, lowValParm, this->currentPageNum);
+	this->traverseTreeToLeafHelper(this->scanRootPageNum, this->scanHeight, lowValParm, this->highValInt, this->currentPageNum);
 
 	// Assign currentPageData member variable as currently scanned page
 	this->bufMgr->readPage(this->file, this->currentPageNum, this->currentPageData);
@@ -209,7 +350,7 @@ void BTreeIndex::startScan(const void* lowValParm, const Operator lowOpParm,
 
 	// If the node does not contain first entry, no such key is found
 	if (this->nextEntry == currentNode->sz) {
-		this->bufMgr->unPinPage(this->file, this->currentPageNum, true);
+		this->bufMgr->unPinPage(this->file, this->currentPageNum, false);
 		this->currentPageNum = Page::INVALID_NUMBER;
 		throw NoSuchKeyFoundException();
 	}
@@ -239,7 +380,7 @@ void BTreeIndex::scanNext(RecordId& outRid) {
 
 	// Check if range of scan exceeded
 	if (key > this->highValInt) {
-		this->bufMgr->unPinPage(this->file, this->currentPageNum, true);
+		this->bufMgr->unPinPage(this->file, this->currentPageNum, false);
 		this->currentPageNum = Page::INVALID_NUMBER;
 		throw IndexScanCompletedException();
 	}
@@ -250,12 +391,39 @@ void BTreeIndex::scanNext(RecordId& outRid) {
 
 	// If exhausted all records, move to sibling
 	if (this->nextEntry >= currentNode->sz) {
-		this->bufMgr->unPinPage(this->file, this->currentPageNum, true);
-		this->currentPageNum = currentNode->rightSibPageNo;
-		// If sibling is not empty, reset counter and read new page
-		if (this->currentPageNum != Page::INVALID_NUMBER) {
-			this->nextEntry = 0;
+		int lastKey = currentNode->keyArray[currentNode->sz - 1];
+		this->bufMgr->unPinPage(this->file, this->currentPageNum, false);
+		if (!this->shadowPaging) {
+			PageId leafPageNum = this->currentPageNum;
+			this->currentPageNum = currentNode->rightSibPageNo;
+			// past the leaves hinted so far, hint those under the next non-leaf node
+			if (leafPageNum == this->advisedLeafPageNum && lastKey < this->highValInt) {
+				int nextKey = lastKey + 1;
+				PageId nextPageNum;
+				this->traverseTreeToLeafHelper(this->scanRootPageNum, this->scanHeight, &nextKey, this->highValInt, nextPageNum);
+			}
+			// If sibling is not empty, reset counter and read new page
+			if (this->currentPageNum != Page::INVALID_NUMBER) {
+				this->nextEntry = 0;
+				this->bufMgr->readPage(this->file, this->currentPageNum, this->currentPageData);
+			}
+		}
+
+		// Copies leave sibling links stale, so the leaf with the next key is
+		// found from the root instead
+		else if (lastKey < this->highValInt) {
+			int nextKey = lastKey + 1;
+			this->traverseTreeToLeafHelper(this->scanRootPageNum, this->scanHeight, &nextKey, this->highValInt, this->currentPageNum);
 			this->bufMgr->readPage(this->file, this->currentPageNum, this->currentPageData);
+			this->nextEntry = this->lowerBound((LeafNodeInt*)this->currentPageData, nextKey);
+			// the last leaf
+			if (this->nextEntry == ((LeafNodeInt*)this->currentPageData)->sz) {
+				this->bufMgr->unPinPage(this->file, this->currentPageNum, false);
+				this->currentPageNum = Page::INVALID_NUMBER;
+			}
+		}
+		else {
+			this->currentPageNum = Page::INVALID_NUMBER;
 		}
 	}
 }
@@ -272,12 +440,15 @@ void BTreeIndex::endScan() {
 
 	// handles if currentPageNum is not invalid
 	if (this->currentPageNum != Page::INVALID_NUMBER){
-		this->bufMgr->unPinPage(this->file, this->currentPageNum, true);
+		this->bufMgr->unPinPage(this->file, this->currentPageNum, false);
     this->currentPageNum = Page::INVALID_NUMBER;
 	}
 
 	// updates scanExecuting
 	this->scanExecuting = false;
+
+	// the pages of trees replaced during the scan are unused now
+	this->releasePages();
 }
 
 // -----------------------------------------------------------------------------
@@ -295,9 +466,10 @@ int BTreeIndex::lowerBound(T *node, int key) {
 // BTreeIndex::insert -- Insert new key and record id into the tree
 // -----------------------------------------------------------------------------
 
-std::pair<int, PageId> BTreeIndex::insert(int level, PageId pageNo, int key, RecordId rid) {
+std::pair<int, PageId> BTreeIndex::insert(int level, PageId &pageNo, int key, RecordId rid) {
 
 	std::pair<int, PageId> passUp;
+	bool modified = true;
 	
 	// read this page
 	Page *page;
@@ -306,6 +478,8 @@ std::pair<int, PageId> BTreeIndex::insert(int level, PageId pageNo, int key, Rec
 	// leaf node
 	if (level == this->height) {
 
+		// the leaf is changed in any case
+		this->shadowNode(pageNo, page);
 		LeafNodeInt *node = (LeafNodeInt*)page;
 
 		// key already exist, replace record id
@@ -342,17 +516,27 @@ std::pair<int, PageId> BTreeIndex::insert(int level, PageId pageNo, int key, Rec
 
 		// insert in the children
 		int idx = this->lowerBound(node, key);
-		int nextPageNo = node->pageNoArray[idx];
+		PageId nextPageNo = node->pageNoArray[idx];
 
 		// retrieve copied middle key
 		std::pair<int, PageId> ret = this->insert(level + 1, nextPageNo, key, rid);
 		int newKey = ret.first;
 		PageId newPageNo = ret.second;
+		bool split = !(newKey == -1 && newPageNo == Page::INVALID_NUMBER);
+
+		// a child moved to a copy is pointed to from a copy of this node
+		bool moved = (nextPageNo != node->pageNoArray[idx]);
+		if (moved || split) {
+			this->shadowNode(pageNo, page);
+			node = (NonLeafNodeInt*)page;
+			node->pageNoArray[idx] = nextPageNo;
+		}
 
-		// skip new add
-		if (newKey == -1 && newPageNo == Page::INVALID_NUMBER) {
+		// skip new add, this node was only read
+		if (!split) {
 			passUp.first = -1;
 			passUp.second = Page::INVALID_NUMBER;
+			modified = moved;
 		}
 
 		// enough space, insert in leaf
@@ -366,7 +550,7 @@ std::pair<int, PageId> BTreeIndex::insert(int level, PageId pageNo, int key, Rec
 		else {
 			int retKey;
 			PageId retPageNo;
-			this->splitNonLeafNode(node, key, newPageNo, retKey, retPageNo);
+			this->splitNonLeafNode(node, newKey, newPageNo, retKey, retPageNo);
 
 			// pass up middle key and page no
 			passUp = {retKey, retPageNo};
@@ -374,7 +558,7 @@ std::pair<int, PageId> BTreeIndex::insert(int level, PageId pageNo, int key, Rec
 	}
 
 	// unpin this page
-	this->bufMgr->unPinPage(this->file, pageNo, true);
+	this->bufMgr->unPinPage(this->file, pageNo, modified);
 
 	return passUp;
 }
@@ -426,7 +610,7 @@ void BTreeIndex::splitLeafNode(LeafNodeInt *node, int key, RecordId rid, int &re
 	// allocate new page
 	Page *newPage;
 	PageId newPageNo;
-	this->bufMgr->allocPage(this->file, newPageNo, newPage);
+	this->allocNode(newPageNo, newPage);
 
 	// initialize new node
 	LeafNodeInt *newNode = (LeafNodeInt*)newPage;
@@ -449,9 +633,11 @@ void BTreeIndex::splitLeafNode(LeafNodeInt *node, int key, RecordId rid, int &re
 	retKey = node->keyArray[node->sz - 1];
 	retPageNo = newPageNo;
 
-	// set right sibling page no
-	newNode->rightSibPageNo = node->rightSibPageNo;
-	node->rightSibPageNo = newPageNo;
+	// set right sibling page no; scans of copy-on-write trees do without
+	if (!this->shadowPaging) {
+		newNode->rightSibPageNo = node->rightSibPageNo;
+		node->rightSibPageNo = newPageNo;
+	}
 
 	// unpin new page
 	this->bufMgr->unPinPage(this->file, newPageNo, true);
@@ -466,30 +652,48 @@ void BTreeIndex::splitNonLeafNode(NonLeafNodeInt *node, int key, PageId pageNo,
 	// allocate new page
 	Page *newPage;
 	PageId newPageNo;
-	this->bufMgr->allocPage(this->file, newPageNo, newPage);
+	this->allocNode(newPageNo, newPage);
 
 	// initialize new node
 	NonLeafNodeInt *newNode = (NonLeafNodeInt*)newPage;
 	this->initNonLeafNode(newNode);
 
-	// redistribute keys
-	int mid = (node->sz + 1) / 2;
-	if (key < node->keyArray[mid - 1]) mid--;
-	int move = 0;
-	for (int i = mid; i < node->sz; i++) {
-		this->insertEntryNonLeaf(newNode, node->keyArray[i], node->pageNoArray[i]);
-		move += 1;
+	// lay out all keys and children with the new entry in place, the new page
+	// being the right child of its key
+	int keys[INTARRAYNONLEAFSIZE + 1];
+	PageId children[INTARRAYNONLEAFSIZE + 2];
+	int pos = this->lowerBound(node, key);
+	int n = 0;
+	children[0] = node->pageNoArray[0];
+	for (int i = 0; i < node->sz; i++) {
+		if (i == pos) {
+			keys[n] = key;
+			children[++n] = pageNo;
+		}
+		keys[n] = node->keyArray[i];
+		children[++n] = node->pageNoArray[i + 1];
+	}
+	if (pos == node->sz) {
+		keys[n] = key;
+		children[++n] = pageNo;
 	}
-	node->sz -= move;
-
-	if (key <= node->keyArray[node->sz - 1]) this->insertEntryNonLeaf(node, key, pageNo);
-	else this->insertEntryNonLeaf(newNode, key, pageNo);
 
-	newNode->pageNoArray[0] = node->pageNoArray[node->sz];
-	node->sz -= 1;
+	// left half stays, middle key moves up, right half goes to the new node
+	int mid = n / 2;
+	node->sz = mid;
+	for (int i = 0; i < mid; i++) {
+		node->keyArray[i] = keys[i];
+		node->pageNoArray[i + 1] = children[i + 1];
+	}
+	newNode->sz = n - mid - 1;
+	newNode->pageNoArray[0] = children[mid + 1];
+	for (int i = 0; i < newNode->sz; i++) {
+		newNode->keyArray[i] = keys[mid + 1 + i];
+		newNode->pageNoArray[i + 1] = children[mid + 2 + i];
+	}
 
 	// copy return key and page no
-	retKey = node->keyArray[node->sz];
+	retKey = keys[mid];
 	retPageNo = newPageNo;
 
 	// unpin new page
@@ -514,11 +718,39 @@ void BTreeIndex::initNonLeafNode(NonLeafNodeInt *node) {
 	node->level = Page::INVALID_NUMBER;
 }
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::allocNode -- Allocate the page of a new node
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::allocNode(PageId &pageNo, Page *&page) {
+	this->bufMgr->allocPage(this->file, pageNo, page);
+	if (this->shadowPaging) this->shadowPages.insert(pageNo);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::shadowNode -- Copy a committed node before changing it
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::shadowNode(PageId &pageNo, Page *&page) {
+	if (!this->shadowPaging || this->shadowPages.count(pageNo) > 0) return;
+
+	Page *copy;
+	PageId copyPageNo;
+	this->allocNode(copyPageNo, copy);
+	*copy = *page;
+
+	// the committed node stays as it is for the committed tree
+	this->bufMgr->unPinPage(this->file, pageNo, false);
+	this->replacedPages.push_back(pageNo);
+	pageNo = copyPageNo;
+	page = copy;
+}
+
 // -----------------------------------------------------------------------------
 // traverseTreeToLeaf helper function -- Find the lower bound leaf
 // -----------------------------------------------------------------------------
 
-void BTreeIndex::traverseTreeToLeafHelper(PageId rootPageId, const void* key, PageId &leafPageId){
+void BTreeIndex::traverseTreeToLeafHelper(PageId rootPageId, int height, const void* key, int highKey, PageId &leafPageId){
 
 	// cast key
 	int intKey = *((int*) key);
@@ -526,7 +758,7 @@ void BTreeIndex::traverseTreeToLeafHelper(PageId rootPageId, const void* key, Pa
 	PageId currentPageId = rootPageId, lastPageId;
 
 	// Tracks the level of tree
-	for(int level = 0; level < this->height; level++){
+	for(int level = 0; level < height; level++){
 
 		// Retrieve page instance from pageId
 		Page* currentPage;
@@ -544,8 +776,22 @@ void BTreeIndex::traverseTreeToLeafHelper(PageId rootPageId, const void* key, Pa
 		// Access pageId from non-leaf node pageId array
 		currentPageId = currentNode->pageNoArray[index];
 
+		// Above the leaves, have the OS read the leaves of the range ahead,
+		// in runs of consecutive pages
+		if (level == height - 1 && lastPageId != this->advisedPageNum) {
+			this->advisedPageNum = lastPageId;
+			int last = this->lowerBound(currentNode, highKey);
+			this->advisedLeafPageNum = currentNode->pageNoArray[last];
+			int run = index;
+			for (int i = index + 1; i <= last + 1; i++) {
+				if (i <= last && currentNode->pageNoArray[i] == currentNode->pageNoArray[i - 1] + 1) continue;
+				this->file->advisePages(currentNode->pageNoArray[run], i - run, ADVICE_WILLNEED);
+				run = i;
+			}
+		}
+
 		// Unpins read pageId in the previous BTree level
-		this->bufMgr->unPinPage(this->file, lastPageId, true);
+		this->bufMgr->unPinPage(this->file, lastPageId, false);
 	}
 
 	// Return leaf page by reference
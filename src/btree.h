@@ -8,9 +8,11 @@
 #pragma once
 
 #include <iostream>
+#include <set>
 #include <string>
 #include "string.h"
 #include <sstream>
+#include <vector>
 
 #include "types.h"
 #include "page.h"
@@ -45,14 +47,14 @@ enum Operator
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
  */
-//                                                  sibling ptr             key               rid
-const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( RecordId ) );
+//                                                  checksum              sz            sibling ptr             key               rid
+const  int INTARRAYLEAFSIZE = ( Page::SIZE - Page::CHECKSUM_SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( RecordId ) );
 
 /**
  * @brief Number of key slots in B+Tree non-leaf for INTEGER key.
  */
-//                                                     level     extra pageNo                  key       pageNo
-const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
+//                                                     checksum              sz, level       extra pageNo                  key       pageNo
+const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - Page::CHECKSUM_SIZE - 2 * sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
 
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that 
@@ -105,8 +107,12 @@ bool operator<( const RIDKeyPair<T>& r1, const RIDKeyPair<T>& r2 )
  * to the following structure to store or retrieve information from it.
  * Contains the relation name for which the index is created, the byte offset
  * of the key value on which the index is made, the type of the key and the page no
- * of the root page. Root page starts as page 2 but since a split can occur
+ * of the root page. Root page starts as page 3 but since a split can occur
  * at the root the root page may get moved up and get a new page no.
+ *
+ * Pages 1 and 2 both hold a copy, written alternately, so that a meta page
+ * write torn by a crash leaves the other one.  The copy with the highest
+ * sequence number whose checksum matches is the current one.
 */
 struct IndexMetaInfo{
   /**
@@ -128,6 +134,28 @@ struct IndexMetaInfo{
    * Page number of root page of the B+ Tree inside the file index file.
    */
 	PageId rootPageNo;
+
+  /**
+   * Number of non-leaf levels above the leaves, so a reopened index knows
+   * whether the root is a leaf.
+   */
+	int height;
+
+  /**
+   * Whether nodes are changed copy-on-write, an update being committed by
+   * switching rootPageNo.
+   */
+	bool shadowPaging;
+
+  /**
+   * Number of the write that made this copy: odd in page 1, even in page 2.
+   */
+	std::uint64_t sequence;
+
+  /**
+   * crc32c of the bytes of the copy before this member.
+   */
+	std::uint32_t checksum;
 };
 
 /*
@@ -189,6 +217,11 @@ struct LeafNodeInt{
 	PageId rightSibPageNo;
 };
 
+static_assert(sizeof(NonLeafNodeInt) <= Page::SIZE - Page::CHECKSUM_SIZE,
+              "Non-leaf node must fit in a page and leave its checksum free.");
+static_assert(sizeof(LeafNodeInt) <= Page::SIZE - Page::CHECKSUM_SIZE,
+              "Leaf node must fit in a page and leave its checksum free.");
+
 
 /**
  * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
@@ -209,10 +242,15 @@ class BTreeIndex {
 	BufMgr	*bufMgr;
 
   /**
-   * Page number of meta page.
+   * Page number of the first meta page.
    */
 	PageId	headerPageNum;
 
+  /**
+   * Sequence number of the meta page copy written last.
+   */
+	std::uint64_t	metaSequence;
+
   /**
    * page number of root page of B+ tree inside index file.
    */
@@ -306,18 +344,68 @@ class BTreeIndex {
    */
   int     height;
 
+  /**
+   * True if nodes are changed copy-on-write: a committed node is copied to a
+   * new page before it is changed, up to a new root, and the update commits
+   * when the meta page switches to that root.
+   */
+  bool    shadowPaging;
+
+  /**
+   * Pages allocated since the last commit, which no committed tree refers to
+   * and are changed in place.
+   */
+  std::set<PageId> shadowPages;
+
+  /**
+   * Pages copied since the last commit, freed once the new root is committed.
+   */
+  std::vector<PageId> replacedPages;
+
+  /**
+   * Pages of committed trees no longer in use, freed once no scan is reading
+   * the tree they belong to.
+   */
+  std::vector<PageId> retiredPages;
+
+  /**
+   * Root page and height of the tree a scan reads, which stays whole while
+   * the scan runs even as updates commit new roots.
+   */
+  PageId  scanRootPageNum;
+  int     scanHeight;
+
+  /**
+   * Last non-leaf node whose leaves the scan told the OS to read ahead, so
+   * that the scan's descents through the same node do not repeat the hint.
+   */
+  PageId  advisedPageNum;
+
+  /**
+   * Last leaf of the range the scan told the OS to read ahead.  A scan
+   * following sibling links descends again on leaving it, to hint the leaves
+   * under the next non-leaf node.
+   */
+  PageId  advisedLeafPageNum;
+
+  /**
+   * Whether indexes created from now on use shadow paging.
+   */
+  static bool newIndexShadowPaging;
+
   /**
    * Helper method to insert new key and record Id into the B+ tree
    * at the node with specific page number
    *
    * @param level     Depth of the node
-   * @param pageNo    Page number of the node 
+   * @param pageNo    Page number of the node; set to that of its copy if
+   *                  shadow paging copied it
    * @param key       Key to insert, integer
    * @param rid       Record ID associated with key
    * @returns Pair of key and record ID of the new node if we have to split otherwise
    *          returns {-1, Page::INVALID_NUMBER}
    */
-  std::pair<int, PageId> insert(int level, PageId pageNo, int key, RecordId rid);
+  std::pair<int, PageId> insert(int level, PageId &pageNo, int key, RecordId rid);
 
   /**
    * Add new entry into the leaf node in a correct position
@@ -374,16 +462,68 @@ class BTreeIndex {
    * @param node      The node to be inserted
    */
   void initNonLeafNode(NonLeafNodeInt *node);
+
+  /**
+   * Allocate a page for a new node, pinned
+   *
+   * @param pageNo    Returning page number
+   * @param page      Returning page
+   */
+  void allocNode(PageId &pageNo, Page *&page);
+
+  /**
+   * With shadow paging, move a committed node about to be changed to a copy
+   * on a new page, leaving the node as it is; nodes allocated since the last
+   * commit are changed in place.
+   *
+   * @param pageNo    Page number of the pinned node; set to that of the copy
+   * @param page      The pinned node; set to the pinned copy
+   */
+  void shadowNode(PageId &pageNo, Page *&page);
+
+  /**
+   * Free the pages of committed trees no longer in use, unless a scan may
+   * still read them.
+   */
+  void releasePages();
+
+  /**
+   * Page number of the meta page holding the copy with the given sequence
+   * number.
+   */
+  PageId metaPageNum(std::uint64_t sequence) const { return this->headerPageNum + 1 - sequence % 2; }
+
+  /**
+   * Read the copy of the meta information in a meta page.
+   *
+   * @param pageNo    Page number of the meta page
+   * @param meta      Set to the copy
+   * @return True if the copy is whole; false if its checksum does not match,
+   *         as after a torn write or before the page is first written
+   * @throws PageChecksumException If the page does not match its checksum
+   */
+  bool readMeta(PageId pageNo, IndexMetaInfo &meta);
+
+  /**
+   * Write the root and height to the meta page not written last, leaving the
+   * copy in the other one as it is.
+   */
+  void writeMeta();
   
   /**
    * Traverse the B+ tree to find the leaf to start the scan 
-   * according to the key
+   * according to the key. Pages on the path are pinned read-only.
+   *
+   * The OS is told to start reading the leaves up to <highKey> under the
+   * last non-leaf node, unless the scan already did for that node.
    *
    * @param rootPageId  The node to be inserted
+   * @param height      Height of the tree under the root
    * @param key         Key to search
+   * @param highKey     Last key the scan reads
    * @param leafPageId  Returning leaf page id
    */
-  void traverseTreeToLeafHelper(PageId rootPageId, const void* key, PageId &leafPageId);
+  void traverseTreeToLeafHelper(PageId rootPageId, int height, const void* key, int highKey, PageId &leafPageId);
 
   /**
    * Find the index of the lower bound key in this node
@@ -393,6 +533,24 @@ class BTreeIndex {
    */
   template <class T>
   int lowerBound(T *node, int key);
+
+  /**
+   * Insert a key into the tree without committing it.
+   *
+   * @param key     Key to insert
+   * @param rid     Record ID of a record whose entry is getting inserted into the index.
+   */
+  void insertKey(int key, const RecordId rid);
+
+  /**
+   * Commit the changes made so far to the write-ahead log, if there is one,
+   * so that recovery replays them all or none of them.  With shadow paging a
+   * commit that waits for the disk writes the new nodes, then switches the
+   * meta page to the new root.
+   *
+   * @param sync    Whether to wait until the commit is on disk
+   */
+  void commit(bool sync);
 	
  public:
 
@@ -420,12 +578,28 @@ class BTreeIndex {
 	~BTreeIndex();
 
 
+  /**
+   * Makes indexes created from now on use shadow paging instead of changing
+   * nodes in place: each insertEntry() writes the nodes it changes to new
+   * pages and commits by switching the root page number in the meta page, so
+   * that a crash leaves the index as it was before or after the insert, never
+   * with a split half done, and scans read the tree as it was when they
+   * started.  The pages replaced are freed after the commit.  A crash may
+   * leave the pages allocated by an uncommitted insert unused.
+   * Indexes keep the setting they were created with.
+   *
+   * @param enabled   Whether to use shadow paging
+   */
+  static void setShadowPaging(const bool enabled);
+
+
   /**
 	 * Insert a new entry using the pair <value,rid>. 
 	 * Start from root to recursively find out the leaf to insert the entry in. The insertion may cause splitting of leaf node.
 	 * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
 	 * This may continue all the way upto the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
 	 * Make sure to unpin pages as soon as you can.
+	 * With a write-ahead log the insert is committed, and on disk in the log, when this returns.
    * @param key			Key to insert, pointer to integer/double/char string
    * @param rid			Record ID of a record whose entry is getting inserted into the index.
 	**/
@@ -7,6 +7,7 @@
 
 #include <memory>
 #include <iostream>
+#include <string>
 #include "buffer.h"
 #include "bufHashTbl.h"
 #include "exceptions/hash_already_present_exception.h"
@@ -15,100 +16,108 @@
 
 namespace badgerdb {
 
-int BufHashTbl::hash(const File* file, const PageId pageNo)
+int BufHashTbl::hash(const FileId fileId, const PageId pageNo)
 {
-  int tmp, value;
-  tmp = (long)file;  // cast of pointer to the file object to an integer
-  value = (tmp + pageNo) % HTSIZE;
-  return value;
+  std::uint32_t value;
+  value = fileId * 2654435761u + pageNo;  // spread small file ids apart
+  return value % HTSIZE;
 }
 
-BufHashTbl::BufHashTbl(int htSize)
+std::size_t BufHashTbl::storageSize(const int htSize, const int numBuckets)
+{
+  return sizeof(int) * (htSize + 1) + sizeof(hashBucket) * numBuckets;
+}
+
+BufHashTbl::BufHashTbl(const int htSize, const int numBuckets, char* storage, const bool initialize)
 	: HTSIZE(htSize)
 {
-  // allocate an array of pointers to hashBuckets
-  ht = new hashBucket* [htSize];
-  for(int i=0; i < HTSIZE; i++)
-    ht[i] = NULL;
+  buckets = reinterpret_cast<hashBucket*>(storage);
+  ht = reinterpret_cast<int*>(storage + sizeof(hashBucket) * numBuckets);
+  freeHead = ht + htSize;
+
+  if (initialize)
+  {
+    for(int i=0; i < HTSIZE; i++)
+      ht[i] = -1;
+
+    // chain all buckets into the free list
+    for(int i=0; i < numBuckets; i++)
+      buckets[i].next = (i + 1 < numBuckets) ? i + 1 : -1;
+    *freeHead = (numBuckets > 0) ? 0 : -1;
+  }
 }
 
 BufHashTbl::~BufHashTbl()
 {
-  for(int i = 0; i < HTSIZE; i++) {
-    hashBucket* tmpBuf = ht[i];
-    while (ht[i]) {
-      tmpBuf = ht[i];
-      ht[i] = ht[i]->next;
-      delete tmpBuf;
-    }
-  }
-  delete [] ht;
 }
 
-void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+void BufHashTbl::insert(const FileId fileId, const PageId pageNo, const FrameId frameNo)
 {
-  int index = hash(file, pageNo);
+  int index = hash(fileId, pageNo);
 
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-  		throw HashAlreadyPresentException(tmpBuc->file->filename(), tmpBuc->pageNo, tmpBuc->frameNo);
-    tmpBuc = tmpBuc->next;
+  int tmpBuc = ht[index];
+  while (tmpBuc != -1) {
+    if (buckets[tmpBuc].fileId == fileId && buckets[tmpBuc].pageNo == pageNo)
+  		throw HashAlreadyPresentException(std::to_string(fileId), pageNo, buckets[tmpBuc].frameNo);
+    tmpBuc = buckets[tmpBuc].next;
   }
 
-  tmpBuc = new hashBucket;
-  if (!tmpBuc)
+  tmpBuc = *freeHead;
+  if (tmpBuc == -1)
   	throw HashTableException();
+  *freeHead = buckets[tmpBuc].next;
 
-  tmpBuc->file = (File*) file;
-  tmpBuc->pageNo = pageNo;
-  tmpBuc->frameNo = frameNo;
-  tmpBuc->next = ht[index];
+  buckets[tmpBuc].fileId = fileId;
+  buckets[tmpBuc].pageNo = pageNo;
+  buckets[tmpBuc].frameNo = frameNo;
+  buckets[tmpBuc].next = ht[index];
   ht[index] = tmpBuc;
 }
 
-void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
+void BufHashTbl::lookup(const FileId fileId, const PageId pageNo, FrameId &frameNo) 
 {
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+  int index = hash(fileId, pageNo);
+  int tmpBuc = ht[index];
+  while (tmpBuc != -1) {
+    if (buckets[tmpBuc].fileId == fileId && buckets[tmpBuc].pageNo == pageNo)
     {
-      frameNo = tmpBuc->frameNo; // return frameNo by reference
+      frameNo = buckets[tmpBuc].frameNo; // return frameNo by reference
       return;
     }
-    tmpBuc = tmpBuc->next;
+    tmpBuc = buckets[tmpBuc].next;
   }
 
-  throw HashNotFoundException(file->filename(), pageNo);
+  throw HashNotFoundException(std::to_string(fileId), pageNo);
 }
 
-void BufHashTbl::remove(const File* file, const PageId pageNo) {
+void BufHashTbl::remove(const FileId fileId, const PageId pageNo) {
 
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  hashBucket* prevBuc = NULL;
+  int index = hash(fileId, pageNo);
+  int tmpBuc = ht[index];
+  int prevBuc = -1;
 
-  while (tmpBuc)
+  while (tmpBuc != -1)
 	{
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+    if (buckets[tmpBuc].fileId == fileId && buckets[tmpBuc].pageNo == pageNo)
 		{
-      if(prevBuc) 
-				prevBuc->next = tmpBuc->next;
+      if(prevBuc != -1) 
+				buckets[prevBuc].next = buckets[tmpBuc].next;
       else
-				ht[index] = tmpBuc->next;
+				ht[index] = buckets[tmpBuc].next;
 
-      delete tmpBuc;
+      // return the bucket to the free list
+      buckets[tmpBuc].next = *freeHead;
+      *freeHead = tmpBuc;
       return;
     }
 		else
 		{
       prevBuc = tmpBuc;
-      tmpBuc = tmpBuc->next;
+      tmpBuc = buckets[tmpBuc].next;
     }
   }
 
-  throw HashNotFoundException(file->filename(), pageNo);
+  throw HashNotFoundException(std::to_string(fileId), pageNo);
 }
 
 }
@@ -16,9 +16,9 @@ namespace badgerdb {
 */
 struct hashBucket {
 	/**
-	 * pointer a file object (more on this below)
+	 * id of the file in the buffer pool's file table
 	 */
-	File *file;
+	FileId fileId;
 
 	/**
 	 * page number within a file
@@ -31,15 +31,19 @@ struct hashBucket {
 	FrameId frameNo;
 
 	/**
-	 * Next node in the hash table
+	 * Index of the next node in the hash chain (or in the free list), -1 at the end
 	 */
-	hashBucket*   next;
+	int next;
 };
 
 
 /**
 * @brief Hash table class to keep track of pages in the buffer pool
 *
+* The buckets and chain heads live in memory handed in by the owner and link to
+* each other by index rather than by pointer, so the table can be placed in a
+* shared memory segment and used by several processes at once.
+*
 * @warning This class is not threadsafe.
 */
 class BufHashTbl
@@ -49,61 +53,86 @@ class BufHashTbl
 	 *	Size of Hash Table
 	 */
   int HTSIZE;
+
 	/**
-	 * Actual Hash table object
+	 * Chain heads, HTSIZE bucket indexes (-1 if the chain is empty)
 	 */
-  hashBucket**  ht;
+  int* ht;
+
+	/**
+	 * Pool of buckets that chains are built from
+	 */
+  hashBucket* buckets;
+
+	/**
+	 * Index of the first unused bucket in <buckets>, -1 if all are in use
+	 */
+  int* freeHead;
 
 	/**
 	 * returns hash value between 0 and HTSIZE-1 computed using file and pageNo
 	 *
-	 * @param file   	File object
+	 * @param fileId  File id
 	 * @param pageNo  Page number in the file
 	 * @return  			Hash value.
 	 */
-  int	 hash(const File* file, const PageId pageNo);
+  int	 hash(const FileId fileId, const PageId pageNo);
 
  public:
 	/**
+	 * Returns the number of bytes of storage a table of the given size needs.
+	 *
+	 * @param htSize      Number of chains
+	 * @param numBuckets  Maximum number of entries in the table
+	 */
+  static std::size_t storageSize(const int htSize, const int numBuckets);
+
+	/**
    * Constructor of BufHashTbl class
+	 *
+	 * @param htSize      Number of chains
+	 * @param numBuckets  Maximum number of entries in the table
+	 * @param storage     storageSize() bytes of memory holding the table
+	 * @param initialize  True to set up an empty table in <storage>, false to
+	 *                    attach to a table already set up there
 	 */
-	BufHashTbl(const int htSize);  // constructor
+	BufHashTbl(const int htSize, const int numBuckets, char* storage, const bool initialize);  // constructor
 
 	/**
-   * Destructor of BufHashTbl class
+   * Destructor of BufHashTbl class.  The storage belongs to the caller.
 	 */
   ~BufHashTbl(); // destructor
 	
 	/**
    * Insert entry into hash table mapping (file, pageNo) to frameNo.
 	 *
-	 * @param file   	File object
+	 * @param fileId 	File id
 	 * @param pageNo 	Page number in the file
 	 * @param frameNo Frame number assigned to that page of the file
    * @throws  HashAlreadyPresentException	if the corresponding page already exists in the hash table
-   * @throws  HashTableException (optional) if could not create a new bucket as running of memory
+   * @throws  HashTableException if all buckets are in use
 	 */
-  void insert(const File* file, const PageId pageNo, const FrameId frameNo);
+  void insert(const FileId fileId, const PageId pageNo, const FrameId frameNo);
 
 	/**
    * Check if (file, pageNo) is currently in the buffer pool (ie. in
    * the hash table).
 	 *
-	 * @param file  	File object
+	 * @param fileId 	File id
 	 * @param pageNo	Page number in the file
 	 * @param frameNo Frame number reference
    * @throws HashNotFoundException if the page entry is not found in the hash table 
 	 */
-  void lookup(const File* file, const PageId pageNo, FrameId &frameNo);
+  void lookup(const FileId fileId, const PageId pageNo, FrameId &frameNo);
 
 	/**
    * Delete entry (file,pageNo) from hash table.
 	 *
-	 * @param file   	File object
+	 * @param fileId 	File id
 	 * @param pageNo  Page number in the file
    * @throws HashNotFoundException if the page entry is not found in the hash table 
 	 */
-  void remove(const File* file, const PageId pageNo);  
+  void remove(const FileId fileId, const PageId pageNo);  
 };
 
 }
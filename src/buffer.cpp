@@ -5,69 +5,602 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
 #include <iostream>
+#include <cstring>
+#include <new>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "buffer.h"
+#include "async_io.h"
+#include "io_handle.h"
 #include "exceptions/buffer_exceeded_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
 #include "exceptions/page_pinned_exception.h"
 #include "exceptions/bad_buffer_exception.h"
 #include "exceptions/hash_not_found_exception.h"
+#include "exceptions/shared_buffer_exception.h"
+#include "exceptions/file_table_full_exception.h"
+#include "exceptions/invalid_page_exception.h"
+#include "exceptions/io_error_exception.h"
+#include "log_manager.h"
 
-namespace badgerdb { 
+namespace badgerdb {
+
+#ifdef DEBUG_PIN_CHECKSUMS
+//----------------------------------------
+// FNV-1a checksum of a frame, used to verify dirty flags passed to unPinPage
+//----------------------------------------
+
+static std::uint32_t frameChecksum(const Page& page)
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&page);
+  std::uint32_t hash = 2166136261u;
+  for (std::size_t i = 0; i < sizeof(Page); i++)
+  {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+#endif
+
+//----------------------------------------
+// Holds the pool latch for the lifetime of the object
+//----------------------------------------
+
+class PoolLatchGuard
+{
+ public:
+  PoolLatchGuard(pthread_mutex_t* latch, const std::string& shmName)
+    : latch_(latch)
+  {
+    const int rc = pthread_mutex_lock(latch_);
+    if (rc == EOWNERDEAD)
+    {
+      // a process died while holding the latch, maybe halfway through
+      // changing the frame or hash table, and its pins will never be undone;
+      // unlocking without making the latch consistent fails it for every
+      // process from now on, so the pool is abandoned rather than trusted
+      pthread_mutex_unlock(latch_);
+      throw SharedBufferException(shmName, "a process died while changing the pool");
+    }
+    if (rc == ENOTRECOVERABLE)
+      throw SharedBufferException(shmName, "pool was abandoned after a process died while changing it");
+    if (rc != 0)
+      throw SharedBufferException(shmName, strerror(rc));
+  }
+
+  ~PoolLatchGuard()
+  {
+    pthread_mutex_unlock(latch_);
+  }
+
+ private:
+  pthread_mutex_t* latch_;
+};
+
+static std::size_t alignUp(std::size_t bytes, std::size_t alignment = 64)
+{
+  return (bytes + alignment - 1) & ~(alignment - 1);
+}
+
+// Frames start on a boundary fit for direct I/O
+static const std::size_t FRAME_ALIGNMENT = DirectIoHandle::ALIGNMENT;
+
+static int hashTableSize(std::uint32_t bufs)
+{
+  return ((((int) (bufs * 1.2))*2)/2)+1;
+}
 
 //----------------------------------------
 // Constructor of the class BufMgr
 //----------------------------------------
 
-BufMgr::BufMgr(std::uint32_t bufs)
-	: numBufs(bufs) {
-	bufDescTable = new BufDesc[bufs];
+BufMgr::BufMgr(std::uint32_t bufs, const bool trackDirtySectors)
+	: numBufs(bufs), checkpointerRunning(false), checkpointInterval(0),
+	  checkpointMaxDirty(0), asyncIo(NULL), log(File::logManager()), loggedPool(NULL) {
+  int htsize = hashTableSize(bufs);
+  arenaSize = arenaBytes(bufs, htsize, trackDirtySectors, false);
+  void* mem;
+  if (posix_memalign(&mem, FRAME_ALIGNMENT, arenaSize) != 0)
+    throw std::bad_alloc();
+  arena = static_cast<char*>(mem);
+  if (log != NULL)
+    loggedPool = new Page[bufs];
+
+  poolHeader = reinterpret_cast<BufPoolHeader*>(arena);
+  poolHeader->numBufs = bufs;
+  poolHeader->htSize = htsize;
+  poolHeader->trackDirtySectors = trackDirtySectors;
+  // uncontended unless a checkpointer thread shares the pool
+  latch = &poolHeader->latch;
+  pthread_mutex_init(latch, NULL);
+  mapArena(true);
+}
+
+BufMgr::BufMgr(std::uint32_t bufs, const std::string& name, const bool trackDirtySectors)
+	: numBufs(bufs), shmName(name), checkpointerRunning(false), checkpointInterval(0),
+	  checkpointMaxDirty(0), asyncIo(NULL), log(NULL), loggedPool(NULL) {
+  // other processes cannot log the changes they make to frames in this one's log
+  if (File::logManager() != NULL)
+    throw SharedBufferException(shmName, "write-ahead logging needs a private pool");
+
+  int htsize = hashTableSize(bufs);
+  bool create = true;
+  int fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST)
+  {
+    create = false;
+    fd = shm_open(shmName.c_str(), O_RDWR, 0600);
+  }
+  if (fd < 0)
+    throw SharedBufferException(shmName, strerror(errno));
+
+  if (create)
+  {
+    arenaSize = arenaBytes(bufs, htsize, trackDirtySectors, true);
+    if (ftruncate(fd, arenaSize) != 0)
+    {
+      ::close(fd);
+      shm_unlink(shmName.c_str());
+      throw SharedBufferException(shmName, strerror(errno));
+    }
+  }
+  else
+  {
+    // wait for the creating process to size the segment
+    struct stat st;
+    for (int tries = 0; fstat(fd, &st) == 0 && st.st_size == 0 && tries < 5000; tries++)
+      usleep(1000);
+    arenaSize = st.st_size;
+  }
+
+  void* mem = mmap(NULL, arenaSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mem == MAP_FAILED)
+  {
+    if (create)
+      shm_unlink(shmName.c_str());
+    throw SharedBufferException(shmName, strerror(errno));
+  }
+  arena = static_cast<char*>(mem);
+  poolHeader = reinterpret_cast<BufPoolHeader*>(arena);
+  latch = &poolHeader->latch;
 
-  for (FrameId i = 0; i < bufs; i++) 
+  if (create)
   {
-  	bufDescTable[i].frameNo = i;
-  	bufDescTable[i].valid = false;
+    poolHeader->numBufs = bufs;
+    poolHeader->htSize = htsize;
+    poolHeader->trackDirtySectors = trackDirtySectors;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(latch, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    mapArena(true);
+    poolHeader->attachCount = 1;
+    __sync_synchronize();
+    poolHeader->magic = BufPoolHeader::MAGIC;
   }
+  else
+  {
+    // wait for the creating process to finish setting up the pool
+    for (int tries = 0; poolHeader->magic != BufPoolHeader::MAGIC && tries < 5000; tries++)
+      usleep(1000);
+    __sync_synchronize();
+    if (poolHeader->magic != BufPoolHeader::MAGIC)
+    {
+      munmap(arena, arenaSize);
+      throw SharedBufferException(shmName, "pool was never initialized");
+    }
+    if (poolHeader->numBufs != bufs)
+    {
+      munmap(arena, arenaSize);
+      throw SharedBufferException(shmName, "pool exists with a different number of frames");
+    }
 
-  bufPool = new Page[bufs];
+    try
+    {
+      PoolLatchGuard guard(latch, shmName);
+      mapArena(false);
+      poolHeader->attachCount++;
+    }
+    catch (const SharedBufferException &e)
+    {
+      munmap(arena, arenaSize);
+      throw;
+    }
+  }
+}
 
-  int htsize = ((((int) (bufs * 1.2))*2)/2)+1;
-  hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
+std::size_t BufMgr::arenaBytes(std::uint32_t bufs, int htSize, bool trackDirtySectors,
+                               bool withFileTable)
+{
+  std::size_t bytes = alignUp(sizeof(BufPoolHeader));
+  bytes += alignUp(sizeof(BufDesc) * bufs);
+  bytes = alignUp(bytes, FRAME_ALIGNMENT);
+  bytes += alignUp(sizeof(Page) * bufs) * (trackDirtySectors ? 2 : 1);
+  bytes += alignUp(BufHashTbl::storageSize(htSize, bufs));
+  if (withFileTable)
+    bytes += sizeof(BufFileEntry) * MAX_FILES;
+  return bytes;
+}
 
-  clockHand = bufs - 1;
+void BufMgr::mapArena(const bool initialize)
+{
+  char* next = arena + alignUp(sizeof(BufPoolHeader));
+
+  bufDescTable = reinterpret_cast<BufDesc*>(next);
+  next += alignUp(sizeof(BufDesc) * numBufs);
+
+  next = arena + alignUp(next - arena, FRAME_ALIGNMENT);
+  bufPool = reinterpret_cast<Page*>(next);
+  next += alignUp(sizeof(Page) * numBufs);
+
+  cleanPool = NULL;
+  if (poolHeader->trackDirtySectors)
+  {
+    cleanPool = reinterpret_cast<Page*>(next);
+    next += alignUp(sizeof(Page) * numBufs);
+  }
+
+  hashTable = new BufHashTbl(poolHeader->htSize, numBufs, next, initialize);  // allocate the buffer hash table
+  next += alignUp(BufHashTbl::storageSize(poolHeader->htSize, numBufs));
+
+  fileTable = shmName.empty() ? NULL : reinterpret_cast<BufFileEntry*>(next);
+
+  if (initialize)
+  {
+    for (FrameId i = 0; i < numBufs; i++)
+    {
+      new (&bufDescTable[i]) BufDesc();
+      bufDescTable[i].frameNo = i;
+      bufDescTable[i].valid = false;
+      new (&bufPool[i]) Page();
+      if (cleanPool != NULL)
+        new (&cleanPool[i]) Page();
+    }
+    // entry 0 stands for INVALID_FILE_ID
+    poolHeader->numFiles = 1;
+    poolHeader->clockHand = numBufs - 1;
+    poolHeader->numDirty = 0;
+  }
 }
 
 
 BufMgr::~BufMgr() {
-  //Flush out all unwritten pages
-  for (std::uint32_t i = 0; i < numBufs; i++) 
+  stopCheckpointer();
+
+  bool last = true;
+  try
   {
-  	BufDesc* tmpbuf = &(bufDescTable[i]);
-  	if (tmpbuf->valid == true && tmpbuf->dirty == true)
-		{
-			tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-  	}
+    PoolLatchGuard guard(latch, shmName);
+    if (!shmName.empty())
+      last = (--poolHeader->attachCount == 0);
+
+    //Flush out all unwritten pages.  Frames pinned by other processes sharing
+    //the pool are left to them.
+    std::vector<FrameId> dirtyFrames;
+    for (std::uint32_t i = 0; i < numBufs; i++)
+    {
+      BufDesc* tmpbuf = &(bufDescTable[i]);
+      if (tmpbuf->valid == true && tmpbuf->dirty == true && (last || tmpbuf->pinCnt == 0))
+      {
+        dirtyFrames.push_back(i);
+      }
+    }
+    writeBackFrames(dirtyFrames);
+
+    if (!shmName.empty() && last)
+    {
+      poolHeader->magic = 0;
+      shm_unlink(shmName.c_str());
+    }
+  }
+  catch (const SharedBufferException &e)
+  {
+    // the pool was abandoned, and nothing in it can be trusted to write back
   }
 
 	delete hashTable;
-  delete [] bufDescTable;
-  delete [] bufPool;
+  delete asyncIo;
+  delete [] loggedPool;
+  if (shmName.empty())
+  {
+    pthread_mutex_destroy(&poolHeader->latch);
+    free(arena);
+  }
+  else
+    munmap(arena, arenaSize);
+}
+
+FileId BufMgr::fileIdOf(const File* file)
+{
+  const std::uint32_t id = file->id();
+  FileId fileId;
+  if (fileTable == NULL)
+  {
+    // a private pool is only used by this process, where ids are unique
+    fileId = id;
+  }
+  else if (id < fileIds.size() && fileIds[id] != INVALID_FILE_ID)
+  {
+    fileId = fileIds[id];
+  }
+  else
+  {
+    // look for the file in the pool's table, which other processes may have
+    // added it to already; entries are never removed so ids stay valid
+    const std::string& name = file->filename();
+    fileId = INVALID_FILE_ID;
+    for (FileId i = 1; i < poolHeader->numFiles; i++)
+    {
+      if (name == fileTable[i].name)
+      {
+        fileId = i;
+        break;
+      }
+    }
+    if (fileId == INVALID_FILE_ID)
+    {
+      if (poolHeader->numFiles >= MAX_FILES || name.length() > BufFileEntry::MAX_NAME)
+        throw FileTableFullException(name);
+
+      fileId = poolHeader->numFiles;
+      strcpy(fileTable[fileId].name, name.c_str());
+      fileTable[fileId].isPageFile = (dynamic_cast<const PageFile*>(file) != NULL);
+      poolHeader->numFiles++;
+    }
+    if (id >= fileIds.size())
+      fileIds.resize(id + 1, INVALID_FILE_ID);
+    fileIds[id] = fileId;
+  }
+
+  if (fileId >= files.size())
+    files.resize(fileId + 1, NULL);
+  files[fileId] = const_cast<File*>(file);
+  return fileId;
+}
+
+File* BufMgr::fileFor(const FileId fileId)
+{
+  return (fileId < files.size()) ? files[fileId] : NULL;
+}
+
+void BufMgr::writeBack(FrameId frame)
+{
+  BufDesc* tmpbuf = &(bufDescTable[frame]);
+
+  // A frame of a shared pool may have been read in by another process, in
+  // which case a File object is opened just for writing it back.
+  File* file = fileFor(tmpbuf->fileId);
+  std::unique_ptr<File> ownFile;
+  if (file == NULL)
+  {
+    const BufFileEntry& entry = fileTable[tmpbuf->fileId];
+    if (entry.isPageFile)
+      ownFile.reset(new PageFile(entry.name, false));
+    else
+      ownFile.reset(new BlobFile(entry.name, false));
+    file = ownFile.get();
+  }
+
+  // the changes are logged already; the log has to be on disk before them
+  if (log != NULL)
+    log->force(tmpbuf->pageLsn);
+  LoggedWriteScope logged;
+
+  if (cleanPool == NULL)
+  {
+    bufStats.diskwrites++;
+    bufStats.bytesWritten += Page::SIZE;
+    file->writePage(tmpbuf->pageNo, bufPool[frame]);
+  }
+  else
+  {
+    // find the sectors that differ from what is on disk
+    const char* current = reinterpret_cast<const char*>(&bufPool[frame]);
+    const char* clean = reinterpret_cast<const char*>(&cleanPool[frame]);
+    SectorMask sectors;
+    for (std::size_t i = 0; i < sectors.size(); i++)
+    {
+      if (memcmp(current + i * Page::SECTOR_SIZE, clean + i * Page::SECTOR_SIZE, Page::SECTOR_SIZE) != 0)
+        sectors.set(i);
+    }
+
+    // marked dirty without being changed, nothing to write
+    if (sectors.any())
+    {
+      bufStats.diskwrites++;
+      bufStats.bytesWritten += file->writePageSectors(tmpbuf->pageNo, bufPool[frame], sectors);
+      cleanPool[frame] = bufPool[frame];
+    }
+  }
+  markClean(frame);
 }
 
-void BufMgr::allocBuf(FrameId & frame) 
+void BufMgr::markClean(FrameId frame)
 {
-  // perform first part of clock algorithm to search for 
+  BufDesc* tmpbuf = &(bufDescTable[frame]);
+  if (tmpbuf->dirty)
+    poolHeader->numDirty--;
+  tmpbuf->dirty = false;
+  tmpbuf->recLsn = MAX_LSN;
+}
+
+void BufMgr::logChanges(FrameId frame)
+{
+  // Runs of changed bytes closer than this are logged as one record.
+  static const std::size_t MERGE_GAP = 32;
+
+  BufDesc* tmpbuf = &(bufDescTable[frame]);
+  char* current = reinterpret_cast<char*>(&bufPool[frame]);
+  char* logged = reinterpret_cast<char*>(&loggedPool[frame]);
+  // only a private pool has a log, and it has the frame's File object
+  const File* file = fileFor(tmpbuf->fileId);
+  const std::string& filename = file->filename();
+  const std::uint64_t pageStart = File::pagePosition(tmpbuf->pageNo);
+
+  // PageFile::writePage() keeps the used list pointers on disk, which File
+  // logs itself when they change, so they are not taken from the frame either.
+  std::size_t skipStart = Page::SIZE, skipEnd = Page::SIZE;
+  if (dynamic_cast<const PageFile*>(file) != NULL)
+  {
+    skipStart = offsetof(PageHeader, next_page_number);
+    skipEnd = offsetof(PageHeader, prev_page_number) + sizeof(PageId);
+  }
+
+  std::size_t i = 0;
+  while (i < Page::SIZE)
+  {
+    if (i % 64 == 0 && memcmp(current + i, logged + i, 64) == 0)
+    {
+      i += 64;
+      continue;
+    }
+    if (current[i] == logged[i] || (i >= skipStart && i < skipEnd))
+    {
+      i++;
+      continue;
+    }
+
+    // extend the run while the next change is near
+    const std::size_t start = i;
+    std::size_t end = i + 1;
+    for (std::size_t j = end; j < Page::SIZE && j < end + MERGE_GAP && !(j >= skipStart && j < skipEnd); j++)
+    {
+      if (current[j] != logged[j])
+        end = j + 1;
+    }
+    // recovery has to replay the frame from before its first unwritten change
+    if (tmpbuf->recLsn == MAX_LSN)
+      tmpbuf->recLsn = log->endLsn();
+    tmpbuf->pageLsn = log->logPageWrite(filename, pageStart + start, current + start, end - start);
+    memcpy(logged + start, current + start, end - start);
+    i = end;
+  }
+}
+
+static void* frameTag(FrameId frame)
+{
+  return reinterpret_cast<void*>(static_cast<std::uintptr_t>(frame));
+}
+
+static FrameId tagFrame(void* tag)
+{
+  return static_cast<FrameId>(reinterpret_cast<std::uintptr_t>(tag));
+}
+
+void BufMgr::writeBackFrames(const std::vector<FrameId>& frames)
+{
+  if (cleanPool != NULL || frames.size() < 2 || File::durability() == DURABILITY_PER_COMMIT)
+  {
+    // each frame needs its own set of sector writes, or its own sync
+    for (std::size_t i = 0; i < frames.size(); i++)
+      writeBack(frames[i]);
+    return;
+  }
+
+  // submit in file order so the writes land on ascending offsets
+  std::vector<FrameId> order(frames);
+  std::sort(order.begin(), order.end(), [this](FrameId a, FrameId b) {
+    const BufDesc& x = bufDescTable[a];
+    const BufDesc& y = bufDescTable[b];
+    return x.fileId != y.fileId ? x.fileId < y.fileId : x.pageNo < y.pageNo;
+  });
+
+  if (log != NULL)
+  {
+    Lsn maxLsn = 0;
+    for (std::size_t i = 0; i < order.size(); i++)
+      maxLsn = std::max(maxLsn, bufDescTable[order[i]].pageLsn);
+    log->force(maxLsn);
+  }
+  LoggedWriteScope logged;
+
+  AsyncIo& io = getAsyncIo();
+  std::vector<void*> done;
+  auto markWritten = [this, &done]() {
+    for (std::size_t i = 0; i < done.size(); i++)
+    {
+      bufStats.diskwrites++;
+      bufStats.bytesWritten += Page::SIZE;
+      markClean(tagFrame(done[i]));
+    }
+    done.clear();
+  };
+
+  try
+  {
+    for (std::size_t i = 0; i < order.size(); i++)
+    {
+      const FrameId frame = order[i];
+      File* file = fileFor(bufDescTable[frame].fileId);
+      if (file == NULL)
+        writeBack(frame);
+      else
+        file->writePageAsync(io, bufDescTable[frame].pageNo, bufPool[frame], frameTag(frame));
+    }
+    io.waitAll(done);
+  }
+  catch (...)
+  {
+    // let the writes already started finish before handing back the error
+    try
+    {
+      io.waitAll(done);
+    }
+    catch (const IoErrorException &e)
+    {
+    }
+    markWritten();
+    throw;
+  }
+  markWritten();
+}
+
+AsyncIo& BufMgr::getAsyncIo()
+{
+  if (asyncIo == NULL)
+    asyncIo = AsyncIo::create();
+  return *asyncIo;
+}
+
+void BufMgr::setAsyncIo(AsyncIo* io)
+{
+  PoolLatchGuard guard(latch, shmName);
+  delete asyncIo;
+  asyncIo = io;
+}
+
+void BufMgr::allocBuf(FrameId & frame)
+{
+  // perform first part of clock algorithm to search for
   // open buffer frame
-  // Assumes non-concurrent access to buffer manager
+  // Assumes the caller holds the pool latch
   std::uint32_t numScanned = 0;
   bool found = 0;
+  // frames with changes that are not committed yet must not reach the disk
+  const Lsn committed = (log != NULL) ? log->committedLsn() : 0;
 
   while (numScanned < 2*numBufs)	//Need to scn twice
   {
     // advance the clock
     advanceClock();
     numScanned++;
+    FrameId clockHand = poolHeader->clockHand;
 
     // if invalid, use frame
     if (! bufDescTable[clockHand].valid)
@@ -79,11 +612,11 @@ void BufMgr::allocBuf(FrameId & frame)
     if (! bufDescTable[clockHand].refbit)
     {
       // check to see if someone has it pinned
-      if (bufDescTable[clockHand].pinCnt == 0)
+      if (bufDescTable[clockHand].pinCnt == 0 && bufDescTable[clockHand].pageLsn <= committed)
       {
         // hasn't been referenced and is not pinned, use it
         // remove previous entry from hash table
-        hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
+        hashTable->remove(bufDescTable[clockHand].fileId, bufDescTable[clockHand].pageNo);
         found = true;
         break;
       }
@@ -95,19 +628,19 @@ void BufMgr::allocBuf(FrameId & frame)
       bufDescTable[clockHand].refbit = false;
     }
   }
-  
+
   // check for full buffer pool
   if (!found && numScanned >= 2*numBufs)
   {
     throw BufferExceededException();
   }
-  
+
+  FrameId clockHand = poolHeader->clockHand;
+
   // flush any existing changes to disk if necessary
   if (bufDescTable[clockHand].dirty)
   {
-    bufStats.diskwrites++;
-    //status = bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo,
-    bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo, bufPool[clockHand]);
+    writeBack(clockHand);
   }
 
 	//Reset all the BufDesc entry for the frame before returning the frame
@@ -117,20 +650,27 @@ void BufMgr::allocBuf(FrameId & frame)
   frame = clockHand;
 } // end allocBuf
 
-	
+
 void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
 {
+  PoolLatchGuard guard(latch, shmName);
+  const FileId fileId = fileIdOf(file);
+
   // check to see if it is already in the buffer pool
   // std::cout << "readPage called on file.page " << file << "." << pageNo << endl;
   FrameId frameNo = 0;
 	try
 	{
-  	hashTable->lookup(file, pageNo, frameNo);
+  	hashTable->lookup(fileId, pageNo, frameNo);
 
     // set the referenced bit
     bufDescTable[frameNo].refbit = true;
     bufDescTable[frameNo].pinCnt++;
     page = &bufPool[frameNo];
+#ifdef DEBUG_PIN_CHECKSUMS
+    if (bufDescTable[frameNo].pinCnt == 1)
+      bufDescTable[frameNo].pinChecksum = frameChecksum(bufPool[frameNo]);
+#endif
   }
   catch(const HashNotFoundException &e) //not in the buffer pool, must allocate a new page
   {
@@ -139,37 +679,177 @@ void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
 
     // read the page into the new frame
     bufStats.diskreads++;
-    //status = file->readPage(pageNo, &bufPool[frameNo]);
-    bufPool[frameNo] = file->readPage(pageNo);
+    file->readPageInto(pageNo, bufPool[frameNo]);
+    if (cleanPool != NULL)
+      cleanPool[frameNo] = bufPool[frameNo];
+    if (loggedPool != NULL)
+      loggedPool[frameNo] = bufPool[frameNo];
 
     // set up the entry properly
-    bufDescTable[frameNo].Set(file, pageNo);
+    bufDescTable[frameNo].Set(fileId, pageNo);
     page = &bufPool[frameNo];
+#ifdef DEBUG_PIN_CHECKSUMS
+    bufDescTable[frameNo].pinChecksum = frameChecksum(bufPool[frameNo]);
+#endif
 
     // insert in the hash table
-    hashTable->insert(file, pageNo, frameNo);
+    hashTable->insert(fileId, pageNo, frameNo);
+  }
+}
+
+
+void BufMgr::prefetch(File* file, const std::vector<PageId>& pageNos)
+{
+  PoolLatchGuard guard(latch, shmName);
+  const FileId fileId = fileIdOf(file);
+  AsyncIo& io = getAsyncIo();
+
+  std::vector<FrameId> started;
+  for (std::size_t i = 0; i < pageNos.size(); i++)
+  {
+    const PageId pageNo = pageNos[i];
+    FrameId frameNo = 0;
+    try
+    {
+      hashTable->lookup(fileId, pageNo, frameNo);
+      continue;
+    }
+    catch(const HashNotFoundException &e)
+    {
+    }
+
+    try
+    {
+      allocBuf(frameNo);
+    }
+    catch(const BufferExceededException &e)
+    {
+      break;
+    }
+
+    // keep the frame pinned while the read is in flight so that the clock
+    // leaves it alone, and in the hash table so that duplicates are skipped
+    bufDescTable[frameNo].Set(fileId, pageNo);
+    hashTable->insert(fileId, pageNo, frameNo);
+    try
+    {
+      file->readPageAsync(io, pageNo, bufPool[frameNo], frameTag(frameNo));
+      started.push_back(frameNo);
+    }
+    catch(const InvalidPageException &e)
+    {
+      hashTable->remove(fileId, pageNo);
+      bufDescTable[frameNo].Clear();
+    }
+  }
+
+  std::vector<void*> done;
+  try
+  {
+    io.waitAll(done);
+  }
+  catch(const IoErrorException &e)
+  {
+  }
+  std::vector<bool> read(numBufs, false);
+  for (std::size_t i = 0; i < done.size(); i++)
+    read[tagFrame(done[i])] = true;
+
+  for (std::size_t i = 0; i < started.size(); i++)
+  {
+    const FrameId frameNo = started[i];
+    BufDesc* tmpbuf = &(bufDescTable[frameNo]);
+    bool usable = read[frameNo];
+    if (usable)
+    {
+      try
+      {
+        file->verifyPage(tmpbuf->pageNo, bufPool[frameNo]);
+      }
+      catch(const InvalidPageException &e)
+      {
+        usable = false;
+      }
+    }
+
+    if (!usable)
+    {
+      hashTable->remove(fileId, tmpbuf->pageNo);
+      tmpbuf->Clear();
+      continue;
+    }
+    bufStats.diskreads++;
+    if (cleanPool != NULL)
+      cleanPool[frameNo] = bufPool[frameNo];
+    if (loggedPool != NULL)
+      loggedPool[frameNo] = bufPool[frameNo];
+    tmpbuf->pinCnt = 0;
   }
 }
 
 
-void BufMgr::unPinPage(File* file, const PageId pageNo, const bool dirty) 
+void BufMgr::unPinPage(File* file, const PageId pageNo, const bool dirty)
 {
+  PoolLatchGuard guard(latch, shmName);
+  const FileId fileId = fileIdOf(file);
+
   // lookup in hashtable
   FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
-
-  if (dirty == true) bufDescTable[frameNo].dirty = dirty;
+  try
+  {
+    hashTable->lookup(fileId, pageNo, frameNo);
+  }
+  catch(const HashNotFoundException &e)
+  {
+    throw HashNotFoundException(file->filename(), pageNo);
+  }
 
   // make sure the page is actually pinned
   if (bufDescTable[frameNo].pinCnt == 0)
   {
   	throw PageNotPinnedException(file->filename(), pageNo, frameNo);
   }
-  else bufDescTable[frameNo].pinCnt--;
+
+#ifdef DEBUG_PIN_CHECKSUMS
+  const std::uint32_t checksum = frameChecksum(bufPool[frameNo]);
+  if (dirty && checksum == bufDescTable[frameNo].pinChecksum)
+  {
+    std::cerr << "unPinPage: " << file->filename() << "." << pageNo
+              << " marked dirty but not modified\n";
+  }
+  else if (!dirty && checksum != bufDescTable[frameNo].pinChecksum)
+  {
+    std::cerr << "unPinPage: " << file->filename() << "." << pageNo
+              << " modified but unpinned clean\n";
+  }
+  bufDescTable[frameNo].pinChecksum = checksum;
+#endif
+
+  if (dirty == true)
+  {
+    // logged first, so that a page the log refuses stays pinned as it was
+    if (log != NULL)
+    {
+      // Log the checksum along with the changes, so that the page replayed by
+      // recovery verifies.
+      file->stampChecksum(bufPool[frameNo]);
+      logChanges(frameNo);
+    }
+    if (!bufDescTable[frameNo].dirty)
+    {
+      // past the limit, have the checkpointer start early
+      if (++poolHeader->numDirty == checkpointMaxDirty + 1 && checkpointMaxDirty > 0)
+        checkpointerWake.notify_one();
+    }
+    bufDescTable[frameNo].dirty = dirty;
+  }
+  bufDescTable[frameNo].pinCnt--;
 }
 
-void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page) 
+void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page)
 {
+  PoolLatchGuard guard(latch, shmName);
+  const FileId fileId = fileIdOf(file);
   FrameId frameNo;
 
   // alloc a new frame
@@ -178,66 +858,241 @@ void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page)
   // allocate a new page in the file
 	//std::cerr << "buffer data size:" << bufPool[frameNo].data_.length() << "\n";
   bufPool[frameNo] = file->allocatePage(pageNo);
+  if (cleanPool != NULL)
+    cleanPool[frameNo] = bufPool[frameNo];
+  if (loggedPool != NULL)
+    loggedPool[frameNo] = bufPool[frameNo];
   page = &bufPool[frameNo];
 
   // set up the entry properly
-  bufDescTable[frameNo].Set(file, pageNo);
+  bufDescTable[frameNo].Set(fileId, pageNo);
+#ifdef DEBUG_PIN_CHECKSUMS
+  bufDescTable[frameNo].pinChecksum = frameChecksum(bufPool[frameNo]);
+#endif
 
   // insert in the hash table
-  hashTable->insert(file, pageNo, frameNo);
+  hashTable->insert(fileId, pageNo, frameNo);
 }
 
-void BufMgr::flushFile(const File* file) 
+void BufMgr::flushFile(const File* file)
 {
+  PoolLatchGuard guard(latch, shmName);
+  const FileId fileId = fileIdOf(file);
+
+  // check every frame before writing any, so a failed flush leaves the pool as it was
+  std::vector<FrameId> fileFrames;
+  std::vector<FrameId> dirtyFrames;
   for (std::uint32_t i = 0; i < numBufs; i++)
 	{
   	BufDesc* tmpbuf = &(bufDescTable[i]);
-  	if(tmpbuf->file && tmpbuf->valid == true && tmpbuf->file == file)
+  	if(tmpbuf->valid == true && tmpbuf->fileId == fileId)
 		{
 	    if (tmpbuf->pinCnt > 0)
   			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
 
+	    fileFrames.push_back(i);
 	    if (tmpbuf->dirty == true)
-			{
-				//if ((status = tmpbuf->file->writePage(tmpbuf->pageNo, &(bufPool[i]))) != OK)
-				tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-				tmpbuf->dirty = false;
-    	}
-
-    	hashTable->remove(file,tmpbuf->pageNo);
-    	tmpbuf->Clear();
+				dirtyFrames.push_back(i);
   	}
-		else if (tmpbuf->valid == false && tmpbuf->file == file)
+		else if (tmpbuf->valid == false && tmpbuf->fileId == fileId)
   		throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
   }
+
+  writeBackFrames(dirtyFrames);
+
+  for (std::size_t i = 0; i < fileFrames.size(); i++)
+	{
+  	BufDesc* tmpbuf = &(bufDescTable[fileFrames[i]]);
+  	hashTable->remove(fileId,tmpbuf->pageNo);
+  	tmpbuf->Clear();
+  }
+
+  // the caller may delete the File object now
+  files[fileId] = NULL;
+}
+
+void BufMgr::writeFile(const File* file)
+{
+  PoolLatchGuard guard(latch, shmName);
+  const FileId fileId = fileIdOf(file);
+
+  std::vector<FrameId> dirtyFrames;
+  for (std::uint32_t i = 0; i < numBufs; i++)
+  {
+    BufDesc* tmpbuf = &(bufDescTable[i]);
+    if (tmpbuf->valid == true && tmpbuf->fileId == fileId && tmpbuf->dirty == true)
+    {
+      if (tmpbuf->pinCnt > 0)
+        throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
+      dirtyFrames.push_back(i);
+    }
+  }
+  writeBackFrames(dirtyFrames);
+}
+
+Lsn BufMgr::commit(const bool sync)
+{
+  return (log != NULL) ? log->commit(sync) : 0;
+}
+
+Lsn BufMgr::checkpoint()
+{
+  // Frames are written this many at a time while holding the latch.
+  static const std::uint32_t BATCH = 64;
+  // Frames in use are tried again this many times, a millisecond apart.
+  static const int RETRIES = 5;
+
+  // Changes logged from here on are replayed from the log in any case.
+  Lsn redoLsn = (log != NULL) ? log->endLsn() : 0;
+
+  // Writes the dirty frames among <frames> that are not in use, and returns
+  // the others; assumes the caller holds the pool latch.
+  auto writeIdle = [this](const std::vector<FrameId>& frames) {
+    // a frame with uncommitted changes must not reach the file yet
+    const Lsn committed = (log != NULL) ? log->committedLsn() : 0;
+    std::vector<FrameId> dirtyFrames, busy;
+    for (std::size_t i = 0; i < frames.size(); i++)
+    {
+      BufDesc* tmpbuf = &(bufDescTable[frames[i]]);
+      if (tmpbuf->valid == true && tmpbuf->dirty == true)
+      {
+        if (tmpbuf->pinCnt == 0 && tmpbuf->pageLsn <= committed)
+          dirtyFrames.push_back(frames[i]);
+        else
+          busy.push_back(frames[i]);
+      }
+    }
+    writeBackFrames(dirtyFrames);
+    return busy;
+  };
+
+  std::vector<FrameId> busy;
+  for (std::uint32_t start = 0; start < numBufs; start += BATCH)
+  {
+    std::vector<FrameId> batch;
+    for (std::uint32_t i = start; i < numBufs && i < start + BATCH; i++)
+      batch.push_back(i);
+    PoolLatchGuard guard(latch, shmName);
+    std::vector<FrameId> left = writeIdle(batch);
+    busy.insert(busy.end(), left.begin(), left.end());
+  }
+
+  // Another thread lets go of a frame soon, and the frames it keeps using,
+  // like the root of an index, are the ones that hold the checkpoint back.
+  for (int retry = 0; retry < RETRIES && !busy.empty(); retry++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    PoolLatchGuard guard(latch, shmName);
+    busy = writeIdle(busy);
+  }
+
+  // Frames left dirty, or dirtied again meanwhile, still need the log from
+  // their first unwritten change.
+  {
+    PoolLatchGuard guard(latch, shmName);
+    for (std::uint32_t i = 0; i < numBufs; i++)
+    {
+      if (bufDescTable[i].valid == true && bufDescTable[i].dirty == true)
+        redoLsn = std::min(redoLsn, bufDescTable[i].recLsn);
+    }
+  }
+
+  File::syncAll();
+  if (log != NULL)
+    log->checkpoint(redoLsn);
+
+  PoolLatchGuard guard(latch, shmName);
+  bufStats.checkpoints++;
+  return redoLsn;
+}
+
+void BufMgr::startCheckpointer(const unsigned intervalMs, const std::uint32_t maxDirty)
+{
+  stopCheckpointer();
+  checkpointInterval = (intervalMs > 0) ? intervalMs : 1;
+  checkpointMaxDirty = maxDirty;
+  checkpointerRunning = true;
+  checkpointer = std::thread(&BufMgr::runCheckpointer, this);
+}
+
+void BufMgr::stopCheckpointer()
+{
+  {
+    std::lock_guard<std::mutex> lock(checkpointerMutex);
+    if (!checkpointerRunning)
+      return;
+    checkpointerRunning = false;
+  }
+  checkpointerWake.notify_all();
+  checkpointer.join();
+}
+
+void BufMgr::runCheckpointer()
+{
+  std::unique_lock<std::mutex> lock(checkpointerMutex);
+  while (checkpointerRunning)
+  {
+    checkpointerWake.wait_for(lock, std::chrono::milliseconds(checkpointInterval));
+    if (!checkpointerRunning)
+      break;
+    lock.unlock();
+    try
+    {
+      checkpoint();
+    }
+    catch (const IoErrorException &e)
+    {
+      // tried again at the next interval
+      std::cerr << "checkpoint: " << e.message() << std::endl;
+    }
+    lock.lock();
+  }
 }
 
 void BufMgr::disposePage(File* file, const PageId pageNo)
 {
+  PoolLatchGuard guard(latch, shmName);
+  const FileId fileId = fileIdOf(file);
+
 	//Deallocate from file altogether
   //See if it is in the buffer pool
   FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
+  try
+  {
+    hashTable->lookup(fileId, pageNo, frameNo);
 
-	// clear the page
-	bufDescTable[frameNo].Clear();
+	  // clear the page
+	  if (bufDescTable[frameNo].dirty)
+	    poolHeader->numDirty--;
+	  bufDescTable[frameNo].Clear();
 
-	hashTable->remove(file, pageNo);
+	  hashTable->remove(fileId, pageNo);
+  }
+  catch(const HashNotFoundException &e)
+  {
+    // not in the buffer pool; only the file has it
+  }
 
-  // deallocate it in the file	
+  // deallocate it in the file
   file->deletePage(pageNo);
 }
 
-void BufMgr::printSelf(void) 
+void BufMgr::printSelf(void)
 {
+  PoolLatchGuard guard(latch, shmName);
   BufDesc* tmpbuf;
 	int validFrames = 0;
-  
+
   for (std::uint32_t i = 0; i < numBufs; i++)
 	{
   	tmpbuf = &(bufDescTable[i]);
 		std::cout << "FrameNo:" << i << " ";
-		tmpbuf->Print();
+		const char* name = NULL;
+		if (tmpbuf->fileId != INVALID_FILE_ID && fileTable != NULL)
+			name = fileTable[tmpbuf->fileId].name;
+		else if (fileFor(tmpbuf->fileId) != NULL)
+			name = fileFor(tmpbuf->fileId)->filename().c_str();
+		tmpbuf->Print(name);
 
   	if (tmpbuf->valid == true)
     	validFrames++;
@@ -9,7 +9,15 @@
 
 #include "file.h"
 #include "bufHashTbl.h"
+#include "log_manager.h"
+#include <condition_variable>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
 
 namespace badgerdb {
 
@@ -17,6 +25,13 @@ namespace badgerdb {
 * forward declaration of BufMgr class 
 */
 class BufMgr;
+class AsyncIo;
+
+/**
+ * @brief File id of frames that hold no page.  Ids handed out by the buffer
+ * pool's file table start at 1.
+ */
+const FileId INVALID_FILE_ID = 0;
 
 /**
 * @brief Class for maintaining information about buffer pool frames
@@ -27,9 +42,9 @@ class BufDesc {
 
  private:
 	/**
-   * Pointer to file to which corresponding frame is assigned
+   * Id (in the buffer pool's file table) of file to which corresponding frame is assigned
 	 */
-  File* file;
+  FileId fileId;
 
 	/**
    * Page within file to which corresponding frame is assigned
@@ -61,41 +76,72 @@ class BufDesc {
 	 */
   bool refbit;
 
+	/**
+   * LSN of the last log record of a change to the frame, 0 if none; the log is
+   * forced up to it before the frame is written back
+	 */
+  Lsn pageLsn;
+
+	/**
+   * LSN of the end of the log before the first change to the frame that has
+   * not been written back, MAX_LSN if there is none; recovery has to start
+   * there for the frame
+	 */
+  Lsn recLsn;
+
+#ifdef DEBUG_PIN_CHECKSUMS
+	/**
+   * Checksum of the frame contents when it was pinned (or last unpinned dirty).
+   * Compared at unpin time to catch callers whose dirty flag does not match
+   * what they actually did to the page.
+	 */
+  std::uint32_t pinChecksum;
+#endif
+
 	/**
    * Initialize buffer frame for a new user
 	 */
   void Clear()
 	{
     pinCnt = 0;
-		file = NULL;
+		fileId = INVALID_FILE_ID;
 		pageNo = Page::INVALID_NUMBER;
     dirty = false;
     refbit = false;
 		valid = false;
+		pageLsn = 0;
+		recLsn = MAX_LSN;
   };
 
 	/**
 	 * Set values of member variables corresponding to assignment of frame to a page in the file. Called when a frame 
 	 * in buffer pool is allocated to any page in the file through readPage() or allocPage()
 	 *
-	 * @param filePtr	File object
+	 * @param id	    File id
 	 * @param pageNum	Page number in the file
 	 */
-  void Set(File* filePtr, PageId pageNum)
+  void Set(FileId id, PageId pageNum)
 	{ 
-		file = filePtr;
+		fileId = id;
     pageNo = pageNum;
     pinCnt = 1;
     dirty = false;
     valid = true;
     refbit = true;
+    pageLsn = 0;
+    recLsn = MAX_LSN;
   }
 
-  void Print()
+	/**
+	 * Print member variable values.
+	 *
+	 * @param filename	Name of the file the frame is assigned to, NULL if none
+	 */
+  void Print(const char* filename)
 	{
-		if(file != NULL)
+		if(filename != NULL)
 		{
-			std::cout << "file:" << file->filename() << " ";
+			std::cout << "file:" << filename << " ";
 			std::cout << "pageNo:" << pageNo << " ";
 		}
 		else
@@ -133,16 +179,28 @@ struct BufStats
   int diskreads;
 
 	/**
-   * Number of pages written back to disk
+   * Number of pages written back to disk (at eviction, flushFile() or shutdown)
 	 */
   int diskwrites;
 
+	/**
+   * Number of bytes written back to disk. With dirty sector tracking this is
+   * less than diskwrites * Page::SIZE, the ratio being the write amplification.
+	 */
+  std::uint64_t bytesWritten;
+
+	/**
+   * Number of checkpoints completed
+	 */
+  int checkpoints;
+
 	/**
    * Clear all values 
 	 */
   void clear()
   {
-		accesses = diskreads = diskwrites = 0;
+		accesses = diskreads = diskwrites = checkpoints = 0;
+		bytesWritten = 0;
   }
       
 	/**
@@ -155,16 +213,119 @@ struct BufStats
 };
 
 
+/**
+* @brief Entry of the buffer pool's file table.  The index of the entry is the
+* FileId that frames and the hash table use to refer to the file.
+*/
+struct BufFileEntry
+{
+	/**
+   * Longest file name that can be registered
+	 */
+  static const std::size_t MAX_NAME = 255;
+
+	/**
+   * Name of the file, NUL terminated
+	 */
+  char name[MAX_NAME + 1];
+
+	/**
+   * True for a PageFile, false for a BlobFile.  Lets a process that has no
+   * File object for the file open one to write back a dirty frame.
+	 */
+  bool isPageFile;
+};
+
+/**
+* @brief State of a buffer pool that is shared by every process using it.  Sits
+* at the start of the memory holding the pool, followed by the frame
+* descriptors, the frames, the hash table and the file table.
+*/
+struct BufPoolHeader
+{
+	/**
+   * Set to MAGIC once the pool has been initialized
+	 */
+  std::uint32_t magic;
+
+	/**
+   * Number of frames in the buffer pool
+	 */
+  std::uint32_t numBufs;
+
+	/**
+   * Number of chains in the hash table
+	 */
+  int htSize;
+
+	/**
+   * True if a copy of every frame as it is on disk is kept after the frames
+	 */
+  bool trackDirtySectors;
+
+	/**
+   * Current position of clockhand in our buffer pool
+	 */
+  FrameId clockHand;
+
+	/**
+   * Number of entries used in the file table
+	 */
+  std::uint32_t numFiles;
+
+	/**
+   * Number of BufMgr objects (in any process) using the pool
+	 */
+  std::uint32_t attachCount;
+
+	/**
+   * Number of dirty frames
+	 */
+  std::uint32_t numDirty;
+
+	/**
+   * Latch held for the duration of every BufMgr operation, process-shared for
+   * a shared pool
+	 */
+  pthread_mutex_t latch;
+
+	/**
+   * Value of <magic> for an initialized pool
+	 */
+  static const std::uint32_t MAGIC = 0xBADB0001;
+};
+
 /**
 * @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file 
+*
+* The pool is either private to the BufMgr object or lives in a named POSIX
+* shared memory segment that several processes attach to, so that they cache
+* each page of a file only once.  In the shared case every operation holds a
+* process-shared latch, and files are identified by their FileId in the pool's
+* file table instead of by File pointer.  A File object passed to a BufMgr must
+* stay alive until flushFile() has been called for it.
+*
+* With a write-ahead log, a frame changed since the last commit is never
+* written back or evicted, so every unit of work has to fit in the pool.
+* Whoever changes pages through the pool commits them, with commit() or
+* LogManager::commit(), often enough to leave frames to evict; BTreeIndex does
+* so itself.  A commit covers the changes of every thread, so only one thread
+* at a time may change pages through a pool with a log (see LogManager); the
+* log throws LogWriterException at a second one.
 */
 class BufMgr 
 {
  private:
 	/**
-   * Current position of clockhand in our buffer pool
+   * Maximum number of distinct files that can be registered with a shared
+   * pool; a private pool has no file table and no limit
 	 */
-  FrameId clockHand;
+  static const std::uint32_t MAX_FILES = 4096;
+
+	/**
+   * Shared pool state, at the start of <arena>
+	 */
+  BufPoolHeader* poolHeader;
 
 	/**
    * Number of frames in the buffer pool
@@ -186,12 +347,177 @@ class BufMgr
 	 */
   BufStats bufStats;
 
+	/**
+   * Copy of each frame as it is on disk, used to find the sectors that changed
+   * when the frame is written back.  NULL unless dirty sector tracking is on.
+	 */
+  Page* cleanPool;
+
+	/**
+   * File table of a shared pool, MAX_FILES entries indexed by FileId; NULL
+   * for a private pool, which uses File::id() as the FileId
+	 */
+  BufFileEntry* fileTable;
+
+	/**
+   * Memory holding the whole pool
+	 */
+  char* arena;
+
+	/**
+   * Size of <arena> in bytes
+	 */
+  std::size_t arenaSize;
+
+	/**
+   * Name of the shared memory segment, empty for a private pool
+	 */
+  std::string shmName;
+
+	/**
+   * Latch to take around every operation, the one in the pool header
+	 */
+  pthread_mutex_t* latch;
+
+	/**
+   * Background thread taking checkpoints, if started
+	 */
+  std::thread checkpointer;
+
+	/**
+   * Protects the checkpointer settings below
+	 */
+  std::mutex checkpointerMutex;
+
+	/**
+   * Signalled to stop the checkpointer, or to have it take a checkpoint early
+	 */
+  std::condition_variable checkpointerWake;
+
+	/**
+   * Whether the checkpointer should keep running
+	 */
+  bool checkpointerRunning;
+
+	/**
+   * Time between checkpoints, in milliseconds
+	 */
+  unsigned checkpointInterval;
+
+	/**
+   * Number of dirty frames past which a checkpoint is started early, 0 for
+   * no limit; read under the pool latch
+	 */
+  std::uint32_t checkpointMaxDirty;
+
+	/**
+   * This process's cache of file table lookups of a shared pool, indexed by
+   * File::id(); INVALID_FILE_ID where the file has not been looked up yet
+	 */
+  std::vector<FileId> fileIds;
+
+	/**
+   * File objects of this process, indexed by FileId, used to write back dirty
+   * frames; NULL for files this process has none for
+	 */
+  std::vector<File*> files;
+
+	/**
+   * Keeps the reads and writes of prefetch() and flushFile() in flight
+   * together; created on first use
+	 */
+  AsyncIo* asyncIo;
+
+	/**
+   * Write-ahead log the changes to frames are logged in, NULL if none
+	 */
+  LogManager* log;
+
+	/**
+   * Copy of each frame as last logged, used to find the bytes that changed
+   * when it is unpinned dirty.  NULL unless there is a log.
+	 */
+  Page* loggedPool;
+
+	/**
+	 * Returns the number of bytes of memory a pool needs.
+	 */
+  static std::size_t arenaBytes(std::uint32_t bufs, int htSize, bool trackDirtySectors,
+                                bool withFileTable);
+
+	/**
+	 * Point the members at the parts of <arena>, optionally initializing them.
+	 *
+	 * @param initialize	True to set up an empty pool, false to use the one in <arena>
+	 */
+  void mapArena(const bool initialize);
+
+	/**
+	 * Returns the id of a file, registering it in the file table if needed, and
+	 * remembers the File object for writing back its frames.
+	 *
+	 * @param file   	File object
+	 * @throws FileTableFullException If the file cannot be registered in the
+	 *                               table of a shared pool
+	 */
+  FileId fileIdOf(const File* file);
+
+	/**
+	 * Returns a File object of this process for the given file id, or NULL if
+	 * this process has none.
+	 *
+	 * @param fileId   	File id
+	 */
+  File* fileFor(const FileId fileId);
+
+	/**
+	 * Write a dirty frame back to its file.  With dirty sector tracking only the
+	 * sectors that differ from the on-disk copy are written.
+	 *
+	 * @param frame   	Frame number of the frame to write
+	 */
+  void writeBack(FrameId frame);
+
+	/**
+	 * Log the bytes of a frame that changed since it was last logged and stamp
+	 * the frame with the LSN of the last record.
+	 *
+	 * @param frame   	Frame number of the frame
+	 */
+  void logChanges(FrameId frame);
+
+	/**
+	 * Write several dirty frames back, keeping the writes in flight together.
+	 * Frames are written one at a time with writeBack() under dirty sector
+	 * tracking, and when this process has no File object for them.
+	 *
+	 * @param frames   	Frame numbers of the frames to write
+	 */
+  void writeBackFrames(const std::vector<FrameId>& frames);
+
+	/**
+	 * Mark a dirty frame as written back.
+	 *
+	 * @param frame   	Frame number of the frame
+	 */
+  void markClean(FrameId frame);
+
+	/**
+	 * Returns <asyncIo>, creating it if needed.
+	 */
+  AsyncIo& getAsyncIo();
+
+	/**
+	 * Body of the checkpointer thread.
+	 */
+  void runCheckpointer();
+
 	/**
    * Advance clock to next frame in the buffer pool
 	 */
   void advanceClock()
   {
-		clockHand = (clockHand + 1) % numBufs;
+		poolHeader->clockHand = (poolHeader->clockHand + 1) % numBufs;
   }
 
 	/**
@@ -210,8 +536,39 @@ class BufMgr
 
 	/**
    * Constructor of BufMgr class
-	 */
-  BufMgr(std::uint32_t bufs);
+   *
+   * Changes to frames are logged in the write-ahead log set with
+   * File::setLogManager(), if any.
+   *
+   * @param bufs                Number of frames in the buffer pool
+   * @param trackDirtySectors   Keep a copy of every frame as it is on disk, and
+   *                            only write back the Page::SECTOR_SIZE sectors
+   *                            of a dirty page that actually changed
+	 */
+  BufMgr(std::uint32_t bufs, const bool trackDirtySectors = false);
+
+	/**
+   * Constructor of a BufMgr whose pool lives in a POSIX shared memory segment.
+   * The first process to use the name creates the pool, later ones attach to
+   * it, and the last one to go away writes back all dirty frames and removes
+   * the segment.
+   *
+   * @param bufs                Number of frames in the buffer pool
+   * @param shmName             Name of the shared memory segment, e.g. "/badgerdb"
+   * @param trackDirtySectors   As for the private pool; only used by the
+   *                            process that creates the pool
+   * If a process dies while it holds the pool's latch, the pool is abandoned:
+   * every BufMgr operation on it from then on throws SharedBufferException,
+   * and the segment has to be removed with shm_unlink() before the name can
+   * be used for a new pool.
+   *
+   * @throws SharedBufferException If the segment cannot be created or attached,
+   *                               exists with a different number of frames,
+   *                               or was abandoned, or a write-ahead log is
+   *                               set; logging is only supported for private
+   *                               pools
+	 */
+  BufMgr(std::uint32_t bufs, const std::string& shmName, const bool trackDirtySectors = false);
 	
 	/**
    * Destructor of BufMgr class
@@ -229,13 +586,34 @@ class BufMgr
 	 */
   void readPage(File* file, const PageId PageNo, Page*& page);
 
+	/**
+	 * Reads the given pages of the file into the buffer pool with their reads
+	 * in flight together, so that later readPage() calls find them there.
+	 * Pages already in the pool are skipped.  This is only a hint: it stops
+	 * when no more frames can be allocated, and pages that cannot be read are
+	 * left out.  The pages are not pinned.
+	 *
+	 * @param file   	File object
+	 * @param pageNos Page numbers in the file to be read
+	 */
+  void prefetch(File* file, const std::vector<PageId>& pageNos);
+
 	/**
 	 * Unpin a page from memory since it is no longer required for it to remain in memory.
+	 * Callers that only read the page must pass dirty = false, otherwise the page is
+	 * written back at eviction or flushFile() even though nothing changed.
+	 *
+	 * When built with DEBUG_PIN_CHECKSUMS the frame is checksummed at pin and unpin
+	 * time, and a warning is printed for pages that are marked dirty without being
+	 * modified, or modified but unpinned clean.
 	 *
 	 * @param file   	File object
 	 * @param PageNo  Page number
 	 * @param dirty		True if the page to be unpinned needs to be marked dirty	
    * @throws  PageNotPinnedException If the page is not already pinned
+   * @throws  LogWriterException If the page is unpinned dirty while another
+   *          thread has uncommitted changes in the write-ahead log; the page
+   *          stays pinned
 	 */
   void unPinPage(File* file, const PageId PageNo, const bool dirty);
 
@@ -250,7 +628,8 @@ class BufMgr
   void allocPage(File* file, PageId &PageNo, Page*& page); 
 
 	/**
-	 * Writes out all dirty pages of the file to disk.
+	 * Writes out all dirty pages of the file to disk, keeping the writes in
+	 * flight together, and removes the file's pages from the buffer pool.
 	 * All the frames assigned to the file need to be unpinned from buffer pool before this function can be successfully called.
 	 * Otherwise Error returned.
 	 *
@@ -260,6 +639,62 @@ class BufMgr
 	 */
   void flushFile(const File* file);
 
+	/**
+	 * Writes out all dirty pages of the file to disk, keeping the writes in
+	 * flight together, and leaves them in the buffer pool.  Pages pinned clean
+	 * may stay pinned.
+	 *
+	 * @param file   	File object
+   * @throws  PagePinnedException If a dirty page of the file is pinned in the buffer pool
+	 */
+  void writeFile(const File* file);
+
+	/**
+	 * Takes a fuzzy checkpoint: writes back every dirty frame that is not pinned
+	 * (and, with a write-ahead log, holds no uncommitted changes), leaving the
+	 * frames in the pool, then syncs the files.  Frames are written a batch at a
+	 * time with the pool latch let go in between, so other threads keep using
+	 * the pool meanwhile; frames they dirty are left to the next checkpoint.
+	 * With a write-ahead log the checkpoint is recorded in it, so recovery
+	 * starts at the returned LSN and the log before it is dropped.
+	 * @return	LSN from which the log is needed to recover the frames still
+	 *          dirty, 0 without a write-ahead log
+	 */
+  Lsn checkpoint();
+
+	/**
+	 * Commits the changes made to the frames unpinned so far, so that they can
+	 * be written back and their frames evicted.  Changes are logged as frames
+	 * are unpinned dirty, so this commits the write-ahead log.
+	 * @param sync	Whether to wait until the commit is on disk
+	 * @return	LSN of the commit record, 0 without a write-ahead log
+	 * @throws  LogWriterException  If another thread has uncommitted changes
+	 *          in the log
+	 */
+  Lsn commit(const bool sync = true);
+
+	/**
+	 * Starts a thread that takes a checkpoint every <intervalMs> milliseconds,
+	 * and as soon as more than <maxDirty> frames are dirty.
+	 * @param intervalMs	Time between checkpoints, in milliseconds
+	 * @param maxDirty		Number of dirty frames that starts a checkpoint early,
+	 *                    0 for none
+	 */
+  void startCheckpointer(const unsigned intervalMs, const std::uint32_t maxDirty = 0);
+
+	/**
+	 * Stops the checkpointer thread, waiting for a checkpoint in progress.
+	 */
+  void stopCheckpointer();
+
+	/**
+	 * Replaces the AsyncIo used by prefetch() and flushFile(), e.g. to choose
+	 * its depth or the thread pool over io_uring.  The BufMgr takes ownership.
+	 *
+	 * @param io   	AsyncIo to use
+	 */
+  void setAsyncIo(AsyncIo* io);
+
 	/**
 	 * Delete page from file and also from buffer pool if present.
 	 * Since the page is entirely deleted from file, its unnecessary to see if the page is dirty.
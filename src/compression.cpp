@@ -0,0 +1,225 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "compression.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace badgerdb {
+
+//----------------------------------------
+// Compressed layout, a series of sequences:
+//
+//   uint8  token        literal count in the high nibble, match length - 4
+//                       in the low one; 15 means more length bytes follow
+//   uint8* more literal count, bytes of 255 ended by one below 255
+//   literals
+//   uint16 offset       how far back the match starts, little endian
+//   uint8* more match length, as for the literal count
+//
+// The last sequence is only a token and literals, ending the input.
+//----------------------------------------
+
+static const std::size_t MIN_MATCH = 4;
+static const std::size_t MAX_OFFSET = 65535;
+static const int HASH_BITS = 12;
+
+static std::uint32_t read32(const unsigned char* bytes)
+{
+  std::uint32_t value;
+  memcpy(&value, bytes, 4);
+  return value;
+}
+
+static std::uint32_t hash4(const std::uint32_t value)
+{
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes what is left of a length after the 15 in its token nibble
+static bool putLength(unsigned char*& out, const unsigned char* out_end,
+                      std::size_t length)
+{
+  while (length >= 255)
+  {
+    if (out >= out_end)
+      return false;
+    *out++ = 255;
+    length -= 255;
+  }
+  if (out >= out_end)
+    return false;
+  *out++ = static_cast<unsigned char>(length);
+  return true;
+}
+
+// Adds to what is in its token nibble the length bytes that follow
+static bool getLength(const unsigned char*& in, const unsigned char* in_end,
+                      std::size_t& length)
+{
+  unsigned char byte;
+  do
+  {
+    if (in >= in_end)
+      return false;
+    byte = *in++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// Writes a sequence; a match length of 0 makes it the last one
+static bool putSequence(unsigned char*& out, const unsigned char* out_end,
+                        const unsigned char* literals, const std::size_t literal_count,
+                        const std::size_t offset, const std::size_t match_length)
+{
+  if (out >= out_end)
+    return false;
+  unsigned char* token = out++;
+  *token = static_cast<unsigned char>((literal_count < 15 ? literal_count : 15) << 4);
+  if (literal_count >= 15 && !putLength(out, out_end, literal_count - 15))
+    return false;
+  if ((std::size_t)(out_end - out) < literal_count)
+    return false;
+  memcpy(out, literals, literal_count);
+  out += literal_count;
+  if (match_length == 0)
+    return true;
+
+  if (out_end - out < 2)
+    return false;
+  *out++ = static_cast<unsigned char>(offset & 0xff);
+  *out++ = static_cast<unsigned char>(offset >> 8);
+  const std::size_t code = match_length - MIN_MATCH;
+  *token |= static_cast<unsigned char>(code < 15 ? code : 15);
+  return code < 15 || putLength(out, out_end, code - 15);
+}
+
+std::size_t compressBlock(const char* src, const std::size_t length, char* dst,
+                          const std::size_t capacity)
+{
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+  unsigned char* out = reinterpret_cast<unsigned char*>(dst);
+  const unsigned char* out_end = out + capacity;
+
+  // Last position each hashed 4 bytes were seen at; positions fit 16 bits as
+  // the input is at most 64 KB.
+  std::uint16_t seen[1 << HASH_BITS];
+  memset(seen, 0, sizeof(seen));
+
+  std::size_t anchor = 0;
+  std::size_t pos = 0;
+  while (length >= MIN_MATCH && pos <= length - MIN_MATCH)
+  {
+    const std::uint32_t value = read32(in + pos);
+    const std::uint32_t hash = hash4(value);
+    const std::size_t candidate = seen[hash];
+    seen[hash] = static_cast<std::uint16_t>(pos);
+    if (candidate >= pos || pos - candidate > MAX_OFFSET
+        || read32(in + candidate) != value)
+    {
+      // Step faster through input that does not compress.
+      pos += 1 + ((pos - anchor) >> 6);
+      continue;
+    }
+
+    std::size_t match_length = MIN_MATCH;
+    while (pos + match_length < length
+           && in[candidate + match_length] == in[pos + match_length])
+      match_length++;
+    if (!putSequence(out, out_end, in + anchor, pos - anchor, pos - candidate,
+                     match_length))
+      return 0;
+    pos += match_length;
+    anchor = pos;
+  }
+
+  if (!putSequence(out, out_end, in + anchor, length - anchor, 0, 0))
+    return 0;
+  return out - reinterpret_cast<unsigned char*>(dst);
+}
+
+// Decompresses up to <dst_length> bytes; <whole> says whether the input has
+// to end exactly there or may go on.
+static bool decompress(const char* src, const std::size_t length, char* dst,
+                       const std::size_t dst_length, const bool whole)
+{
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+  const unsigned char* in_end = in + length;
+  unsigned char* out = reinterpret_cast<unsigned char*>(dst);
+  unsigned char* out_start = out;
+  const unsigned char* out_end = out + dst_length;
+
+  while (in < in_end && (whole || out < out_end))
+  {
+    const unsigned token = *in++;
+    std::size_t literal_count = token >> 4;
+    if (literal_count == 15 && !getLength(in, in_end, literal_count))
+      return false;
+    if ((std::size_t)(in_end - in) < literal_count)
+      return false;
+    if ((std::size_t)(out_end - out) < literal_count)
+    {
+      if (whole)
+        return false;
+      literal_count = out_end - out;
+    }
+    memcpy(out, in, literal_count);
+    in += literal_count;
+    out += literal_count;
+    if (in == in_end || (!whole && out == out_end))
+      break;
+
+    if (in_end - in < 2)
+      return false;
+    const std::size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (offset == 0 || offset > (std::size_t)(out - out_start))
+      return false;
+    std::size_t match_length = token & 15;
+    if (match_length == 15 && !getLength(in, in_end, match_length))
+      return false;
+    match_length += MIN_MATCH;
+    if ((std::size_t)(out_end - out) < match_length)
+    {
+      if (whole)
+        return false;
+      match_length = out_end - out;
+    }
+
+    // A match closer than its length overlaps what it produces, repeating its
+    // first <offset> bytes; it is copied in pieces that do not overlap, each
+    // twice as far from the start of the match as the one before.
+    const unsigned char* match = out - offset;
+    const unsigned char* match_end = out + match_length;
+    std::size_t distance = offset;
+    while (out < match_end)
+    {
+      const std::size_t piece = distance < (std::size_t)(match_end - out)
+                                ? distance : match_end - out;
+      memcpy(out, match, piece);
+      out += piece;
+      distance += piece;
+    }
+  }
+  return out == out_end;
+}
+
+bool decompressBlock(const char* src, const std::size_t length, char* dst,
+                     const std::size_t dst_length)
+{
+  return decompress(src, length, dst, dst_length, true);
+}
+
+bool decompressPrefix(const char* src, const std::size_t length, char* dst,
+                      const std::size_t prefix_length)
+{
+  return decompress(src, length, dst, prefix_length, false);
+}
+
+}
@@ -0,0 +1,54 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace badgerdb {
+
+/**
+ * Compresses <length> bytes with a byte-oriented LZ77 codec in the style of
+ * LZ4: runs of literals and back references of at least 4 bytes at most 64 KB
+ * back, with no entropy coding, so that both directions run at memory speed.
+ *
+ * @param src       Bytes to compress; at most 64 KB.
+ * @param length    Number of bytes.
+ * @param dst       Where to put the compressed bytes.
+ * @param capacity  Room at <dst>.
+ * @return  Number of compressed bytes, or 0 if they do not fit in <capacity>.
+ */
+std::size_t compressBlock(const char* src, const std::size_t length, char* dst,
+                          const std::size_t capacity);
+
+/**
+ * Decompresses what compressBlock() produced.  Malformed input is detected
+ * rather than read or written out of bounds.
+ *
+ * @param src         Compressed bytes.
+ * @param length      Number of compressed bytes.
+ * @param dst         Where to put the decompressed bytes.
+ * @param dst_length  Number of bytes the input decompresses to.
+ * @return  True if <src> decompressed to exactly <dst_length> bytes.
+ */
+bool decompressBlock(const char* src, const std::size_t length, char* dst,
+                     const std::size_t dst_length);
+
+/**
+ * Decompresses only the first <prefix_length> bytes of what compressBlock()
+ * produced, without looking at the rest of the input.
+ *
+ * @param src           Compressed bytes.
+ * @param length        Number of compressed bytes.
+ * @param dst           Where to put the decompressed bytes.
+ * @param prefix_length Number of bytes wanted.
+ * @return  True if <src> decompressed to at least <prefix_length> bytes.
+ */
+bool decompressPrefix(const char* src, const std::size_t length, char* dst,
+                      const std::size_t prefix_length);
+
+}
@@ -0,0 +1,221 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#endif
+
+namespace badgerdb {
+
+//----------------------------------------
+// Table driven version, eight bytes at a time ("slicing by 8")
+//----------------------------------------
+
+// CRC32C polynomial, bit reversed
+static const std::uint32_t POLYNOMIAL = 0x82f63b78u;
+
+struct Crc32cTables
+{
+  std::uint32_t table[8][256];
+
+  Crc32cTables()
+  {
+    for (std::uint32_t i = 0; i < 256; i++)
+    {
+      std::uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc >> 1) ^ (crc & 1 ? POLYNOMIAL : 0);
+      table[0][i] = crc;
+    }
+    for (std::uint32_t i = 0; i < 256; i++)
+    {
+      for (int k = 1; k < 8; k++)
+        table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+    }
+  }
+};
+
+static const Crc32cTables tables;
+
+static std::uint32_t crc32cTables(std::uint32_t crc, const unsigned char* bytes,
+                                  std::size_t length)
+{
+  const std::uint32_t (*t)[256] = tables.table;
+  while (length >= 8)
+  {
+    // assumes a little endian machine, like the rest of the file formats
+    std::uint32_t low, high;
+    memcpy(&low, bytes, 4);
+    memcpy(&high, bytes + 4, 4);
+    low ^= crc;
+    crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff]
+        ^ t[4][low >> 24] ^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff]
+        ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+    bytes += 8;
+    length -= 8;
+  }
+  while (length > 0)
+  {
+    crc = (crc >> 8) ^ t[0][(crc ^ *bytes) & 0xff];
+    bytes++;
+    length--;
+  }
+  return crc;
+}
+
+//----------------------------------------
+// SSE4.2 version
+//----------------------------------------
+
+#ifdef CRC32C_SSE42
+
+// The crc32 instruction takes three cycles but a new one can start every
+// cycle, so the buffer is checksummed as three interleaved streams of BLOCK
+// bytes, whose checksums are then combined.
+static const std::size_t BLOCK = 256;
+
+// Multiplies a vector by a matrix over GF(2)
+static std::uint32_t gf2Times(const std::uint32_t* matrix, std::uint32_t vector)
+{
+  std::uint32_t sum = 0;
+  while (vector != 0)
+  {
+    if (vector & 1)
+      sum ^= *matrix;
+    vector >>= 1;
+    matrix++;
+  }
+  return sum;
+}
+
+static void gf2Square(std::uint32_t* square, const std::uint32_t* matrix)
+{
+  for (int n = 0; n < 32; n++)
+    square[n] = gf2Times(matrix, matrix[n]);
+}
+
+// Tables that advance a checksum over BLOCK zero bytes, one per byte of it
+struct Crc32cShiftTables
+{
+  std::uint32_t table[4][256];
+
+  Crc32cShiftTables()
+  {
+    // operator for one zero bit, squared up to BLOCK zero bytes
+    std::uint32_t odd[32], even[32];
+    odd[0] = POLYNOMIAL;
+    for (int n = 1; n < 32; n++)
+      odd[n] = 1u << (n - 1);
+    gf2Square(even, odd);		// 2 bits
+    gf2Square(odd, even);		// 4 bits
+    std::uint32_t* op = odd;
+    for (std::size_t bits = 4; bits < 8 * BLOCK; bits *= 2)
+    {
+      if (op == odd)
+      {
+        gf2Square(even, odd);
+        op = even;
+      }
+      else
+      {
+        gf2Square(odd, even);
+        op = odd;
+      }
+    }
+    for (std::uint32_t n = 0; n < 256; n++)
+    {
+      table[0][n] = gf2Times(op, n);
+      table[1][n] = gf2Times(op, n << 8);
+      table[2][n] = gf2Times(op, n << 16);
+      table[3][n] = gf2Times(op, n << 24);
+    }
+  }
+
+  std::uint32_t shift(const std::uint32_t crc) const
+  {
+    return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff]
+        ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+  }
+};
+
+static const Crc32cShiftTables shiftTables;
+
+__attribute__((target("sse4.2")))
+static std::uint32_t crc32cSse42(std::uint32_t crc, const unsigned char* bytes,
+                                 std::size_t length)
+{
+  std::uint64_t crc0 = crc;
+  while (length >= 3 * BLOCK)
+  {
+    std::uint64_t crc1 = 0, crc2 = 0;
+    for (const unsigned char* end = bytes + BLOCK; bytes < end; bytes += 8)
+    {
+      std::uint64_t word0, word1, word2;
+      memcpy(&word0, bytes, 8);
+      memcpy(&word1, bytes + BLOCK, 8);
+      memcpy(&word2, bytes + 2 * BLOCK, 8);
+      crc0 = _mm_crc32_u64(crc0, word0);
+      crc1 = _mm_crc32_u64(crc1, word1);
+      crc2 = _mm_crc32_u64(crc2, word2);
+    }
+    crc0 = shiftTables.shift(crc0) ^ crc1;
+    crc0 = shiftTables.shift(crc0) ^ crc2;
+    bytes += 2 * BLOCK;
+    length -= 3 * BLOCK;
+  }
+  while (length >= 8)
+  {
+    std::uint64_t word;
+    memcpy(&word, bytes, 8);
+    crc0 = _mm_crc32_u64(crc0, word);
+    bytes += 8;
+    length -= 8;
+  }
+  crc = static_cast<std::uint32_t>(crc0);
+  while (length > 0)
+  {
+    crc = _mm_crc32_u8(crc, *bytes);
+    bytes++;
+    length--;
+  }
+  return crc;
+}
+
+static bool detectSse42()
+{
+  // may run before the constructor that normally sets up the CPU model
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+}
+
+static const bool haveSse42 = detectSse42();
+#else
+static const bool haveSse42 = false;
+#endif
+
+std::uint32_t crc32c(const void* data, const std::size_t length,
+                     const std::uint32_t crc)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+#ifdef CRC32C_SSE42
+  if (haveSse42)
+    return ~crc32cSse42(~crc, bytes, length);
+#endif
+  return ~crc32cTables(~crc, bytes, length);
+}
+
+bool crc32cAccelerated()
+{
+  return haveSse42;
+}
+
+}
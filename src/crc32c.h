@@ -0,0 +1,33 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace badgerdb {
+
+/**
+ * Computes the CRC32C (Castagnoli) checksum of <length> bytes, with the SSE4.2
+ * crc32 instruction when the CPU has it and with lookup tables otherwise.
+ *
+ * @param data    Bytes to checksum.
+ * @param length  Number of bytes.
+ * @param crc     Checksum of the bytes before <data>, to checksum a range in
+ *                several pieces; 0 to start a new checksum.
+ * @return  Checksum of all the bytes so far.
+ */
+std::uint32_t crc32c(const void* data, const std::size_t length,
+                     const std::uint32_t crc = 0);
+
+/**
+ * Returns true if crc32c() uses the SSE4.2 crc32 instruction.
+ */
+bool crc32cAccelerated();
+
+}
@@ -0,0 +1,23 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "file_table_full_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+FileTableFullException::FileTableFullException(const std::string& name)
+    : BadgerDbException(""), filename_(name) {
+  std::stringstream ss;
+  ss << "Cannot register file with the buffer pool (file table full or name"
+     << " too long): " << filename_;
+  message_.assign(ss.str());
+}
+
+}
@@ -0,0 +1,23 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "io_error_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+IoErrorException::IoErrorException(const std::string& name,
+                                   const std::string& reason)
+    : BadgerDbException(""), name_(name) {
+  std::stringstream ss;
+  ss << "I/O error on file " << name_ << ": " << reason;
+  message_.assign(ss.str());
+}
+
+}
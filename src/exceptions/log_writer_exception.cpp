@@ -0,0 +1,22 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "log_writer_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+LogWriterException::LogWriterException(const std::string& name)
+    : BadgerDbException(""), name_(name) {
+  std::stringstream ss;
+  ss << "Another thread has uncommitted changes in log '" << name_ << "'";
+  message_.assign(ss.str());
+}
+
+}
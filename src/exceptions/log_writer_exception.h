@@ -0,0 +1,48 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a thread changes pages through a
+ *        write-ahead log, or commits it, while another thread has uncommitted
+ *        page changes in it.
+ */
+class LogWriterException : public BadgerDbException {
+ public:
+  /**
+   * Constructs a log writer exception for the given log.
+   *
+   * @param name  Name of the log file.
+   */
+  explicit LogWriterException(const std::string& name);
+
+  /**
+   * Destroys the exception.  Does nothing special; just included to make the
+   * compiler happy.
+   */
+  virtual ~LogWriterException() throw() {}
+
+  /**
+   * Returns the name of the log file that caused this exception.
+   */
+  virtual const std::string& name() const { return name_; }
+
+ protected:
+  /**
+   * Name of the log file that caused this exception.
+   */
+  const std::string name_;
+};
+
+}
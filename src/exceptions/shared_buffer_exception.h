@@ -0,0 +1,48 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a shared memory buffer pool cannot
+ *        be created or attached to.
+ */
+class SharedBufferException : public BadgerDbException {
+ public:
+  /**
+   * Constructs a shared buffer exception for the given segment.
+   *
+   * @param name    Name of the shared memory segment.
+   * @param reason  What went wrong.
+   */
+  SharedBufferException(const std::string& name, const std::string& reason);
+
+  /**
+   * Destroys the exception.  Does nothing special; just included to make the
+   * compiler happy.
+   */
+  virtual ~SharedBufferException() throw() {}
+
+  /**
+   * Returns the name of the shared memory segment that caused this exception.
+   */
+  virtual const std::string& name() const { return name_; }
+
+ protected:
+  /**
+   * Name of the shared memory segment that caused this exception.
+   */
+  const std::string name_;
+};
+
+}
@@ -7,24 +7,113 @@
 
 #include "file.h"
 
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <cstdio>
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstring>
 
+#include "async_io.h"
+#include "compression.h"
+#include "crc32c.h"
 #include "exceptions/file_exists_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/file_open_exception.h"
+#include "exceptions/insufficient_space_exception.h"
 #include "exceptions/invalid_page_exception.h"
+#include "exceptions/io_error_exception.h"
+#include "exceptions/page_checksum_exception.h"
 #include "file_iterator.h"
+#include "io_scheduler.h"
+#include "log_manager.h"
 #include "page.h"
 
 namespace badgerdb {
 
-File::StreamMap File::open_streams_;
-File::CountMap File::open_counts_;
+static_assert(sizeof(FileHeader) <= File::HEADER_SIZE,
+              "FileHeader must fit before the first page");
+static_assert(File::HEADER_SIZE % DirectIoHandle::ALIGNMENT == 0
+              && Page::SIZE % DirectIoHandle::ALIGNMENT == 0,
+              "Pages must be aligned for direct I/O");
+
+File::RegistryShard File::registry_[File::REGISTRY_SHARDS];
+std::list<File::OpenFile*> File::open_handles_;
+std::list<File::OpenFile*>::iterator File::clock_hand_ = File::open_handles_.end();
+std::mutex File::clock_mutex_;
+std::atomic<std::size_t> File::max_open_handles_(256);
+std::atomic<IoBackend> File::io_backend_(POSIX_BACKEND);
+std::atomic<std::uint64_t> File::handle_hits_(0);
+std::atomic<std::uint64_t> File::handle_misses_(0);
+std::atomic<std::uint64_t> File::handle_evictions_(0);
+std::atomic<std::uint64_t> File::pages_advised_[ADVICE_DONTNEED + 1];
+std::atomic<std::uint32_t> File::next_id_(1);
+std::atomic<DurabilityMode> File::durability_(DURABILITY_NONE);
+std::atomic<LogManager*> File::log_manager_(NULL);
+std::atomic<bool> File::page_checksums_(false);
+std::atomic<bool> File::page_compression_(false);
+std::atomic<bool> File::access_hints_(true);
+
+//----------------------------------------
+// Background thread syncing files under DURABILITY_GROUP
+//----------------------------------------
+
+class GroupSyncer {
+ public:
+  GroupSyncer() : running_(false), interval_ms_(0) {}
+
+  ~GroupSyncer() {
+    stop();
+  }
+
+  void start(const unsigned interval_ms) {
+    stop();
+    running_ = true;
+    interval_ms_ = interval_ms > 0 ? interval_ms : 1;
+    thread_ = std::thread(&GroupSyncer::run, this);
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      running_ = false;
+    }
+    wake_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+      wake_.wait_for(lock, std::chrono::milliseconds(interval_ms_));
+      lock.unlock();
+      try {
+        File::syncAll();
+      } catch (const IoErrorException &e) {
+        std::cerr << "group sync: " << e.message() << std::endl;
+      }
+      lock.lock();
+    }
+  }
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool running_;
+  unsigned interval_ms_;
+};
+
+// Defined after the members of File it uses, so that it is destroyed first.
+static GroupSyncer group_syncer;
 
 void File::remove(const std::string& filename) {
   if (!exists(filename)) {
@@ -33,6 +122,10 @@ void File::remove(const std::string& filename) {
   if (isOpen(filename)) {
     throw FileOpenException(filename);
   }
+  LogManager* log = logManager();
+  if (log != NULL) {
+    log->force(log->logRemove(filename));
+  }
   std::remove(filename.c_str());
 }
 
@@ -40,7 +133,14 @@ bool File::isOpen(const std::string& filename) {
   if (!exists(filename)) {
     return false;
   }
-  return open_counts_.find(filename) != open_counts_.end();
+  RegistryShard& shard = shardFor(filename);
+  std::lock_guard<std::mutex> shard_lock(shard.mutex);
+  auto it = shard.files.find(filename);
+  if (it == shard.files.end()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(it->second->mutex);
+  return it->second->open_count > 0;
 }
 
 bool File::exists(const std::string& filename) {
@@ -54,6 +154,103 @@ bool File::exists(const std::string& filename) {
 	return false;
 }
 
+void File::setMaxOpenHandles(const std::size_t max_handles) {
+  max_open_handles_ = max_handles > 0 ? max_handles : 1;
+  evictHandles();
+}
+
+void File::setIoBackend(const IoBackend backend) {
+  io_backend_ = backend;
+}
+
+void File::setDurability(const DurabilityMode mode,
+                         const unsigned group_interval_ms) {
+  durability_ = mode;
+  if (mode == DURABILITY_GROUP) {
+    group_syncer.start(group_interval_ms);
+  } else {
+    group_syncer.stop();
+  }
+}
+
+DurabilityMode File::durability() {
+  return durability_;
+}
+
+void File::syncAll() {
+  std::vector<std::shared_ptr<IoHandle> > handles;
+  for (std::size_t i = 0; i < REGISTRY_SHARDS; ++i) {
+    std::vector<OpenFile*> files;
+    {
+      std::lock_guard<std::mutex> shard_lock(registry_[i].mutex);
+      for (auto it = registry_[i].files.begin(); it != registry_[i].files.end();
+           ++it) {
+        files.push_back(it->second.get());
+      }
+    }
+    for (std::size_t j = 0; j < files.size(); ++j) {
+      std::lock_guard<std::mutex> lock(files[j]->mutex);
+      writeBackHeader(*files[j]);
+      if (files[j]->io && files[j]->unsynced) {
+        handles.push_back(files[j]->io);
+        // Cleared first, so that writes made while syncing set it again.
+        files[j]->unsynced = false;
+      }
+    }
+  }
+  evictHandles();
+  for (std::size_t i = 0; i < handles.size(); ++i) {
+    handles[i]->sync();
+  }
+}
+
+void File::setLogManager(LogManager* log) {
+  log_manager_ = log;
+}
+
+LogManager* File::logManager() {
+  return log_manager_;
+}
+
+void File::setPageChecksums(const bool enabled) {
+  page_checksums_ = enabled;
+}
+
+bool File::pageChecksums() {
+  return page_checksums_;
+}
+
+void File::setPageCompression(const bool enabled) {
+  page_compression_ = enabled;
+}
+
+bool File::pageCompression() {
+  return page_compression_;
+}
+
+void File::setAccessHints(const bool enabled) {
+  access_hints_ = enabled;
+}
+
+HandleCacheStats File::handleCacheStats() {
+  HandleCacheStats stats = {handle_hits_, handle_misses_, handle_evictions_};
+  return stats;
+}
+
+void File::clearHandleCacheStats() {
+  handle_hits_ = handle_misses_ = handle_evictions_ = 0;
+}
+
+std::uint64_t File::pagesAdvised(const AccessAdvice advice) {
+  return pages_advised_[advice];
+}
+
+void File::clearPagesAdvised() {
+  for (int i = 0; i <= ADVICE_DONTNEED; ++i) {
+    pages_advised_[i] = 0;
+  }
+}
+
 File::~File() {
   close();
 }
@@ -68,64 +265,505 @@ File::File(const std::string& name, const bool create_new) : filename_(name) {
   openIfNeeded(create_new);
 
   if (create_new) {
+    LogManager* log = logManager();
+    if (log != NULL) {
+      // Recovery empties the file again before replaying its writes.
+      log->force(log->logCreate(filename_));
+    }
     // File starts with 1 page (the header).
     FileHeader header = {1 /* num_pages */, 0 /* first_used_page */,
-                         0 /* num_free_pages */, 0 /* first_free_page */};
+                         0 /* num_free_pages */, 0 /* first_free_page */,
+                         0 /* last_used_page */, 0 /* first_fsm_page */,
+                         0 /* first_directory_page */,
+                         hasPageChecksums() /* page_checksums */,
+                         hasPageCompression() /* page_compression */};
     writeHeader(header);
+    finishWrite();
   }
 }
 
+File::RegistryShard& File::shardFor(const std::string& filename) {
+  return registry_[std::hash<std::string>()(filename) % REGISTRY_SHARDS];
+}
+
 void File::openIfNeeded(const bool create_new) {
-  if (open_counts_.find(filename_) != open_counts_.end()) {	//exists an entry already
-    ++open_counts_[filename_];
-    stream_ = open_streams_[filename_];
-  } else {
-    std::ios_base::openmode mode =
-        std::fstream::in | std::fstream::out | std::fstream::binary;
+  RegistryShard& shard = shardFor(filename_);
+  {
+    std::lock_guard<std::mutex> shard_lock(shard.mutex);
+    std::unique_ptr<OpenFile>& entry = shard.files[filename_];
+    if (!entry) {
+      entry.reset(new OpenFile());
+      entry->filename = filename_;
+      entry->id = next_id_++;
+    }
+    file_ = entry.get();
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    if (file_->open_count > 0) {	//exists an entry already
+      ++file_->open_count;
+      return;
+    }
     const bool already_exists = exists(filename_);
     if (create_new) {
       // Error if we try to overwrite an existing file.
       if (already_exists) {
         throw FileExistsException(filename_);
       }
-      // New files have to be truncated on open.
-      mode = mode | std::fstream::trunc;
     } else {
       // Error if we try to open a file that doesn't exist.
       if (!already_exists) {
         throw FileNotFoundException(filename_);
       }
     }
-    stream_.reset(new std::fstream(filename_, mode));
-    open_streams_[filename_] = stream_;
-    open_counts_[filename_] = 1;
+    OpenFile& file = *file_;
+    // An existing file says in its header whether it has page checksums and
+    // compression, which is read when first needed.  Compressed pages are
+    // told from raw ones by their checksum.
+    const bool page_compression = create_new && page_compression_ &&
+                                  log_manager_ == NULL;
+    file.page_compression = page_compression;
+    file.page_checksums = create_new && (page_checksums_ || page_compression);
+    file.page_checksums_known = create_new;
+    file.extent_next = file.extent_end = 0;
+    file.no_free_pages = false;
+    file.header_cached = false;
+    file.header_dirty = false;
+    file.sequential_scans = 0;
+    file.free_space_map.cached = false;
+    file.page_directory.cached = false;
+    // New files have to be truncated on open.
+    openHandle(file, create_new /* truncate */);
+    file.open_count = 1;
   }
+  evictHandles();
 }
 
 void File::close() {
-	if(open_counts_[filename_] > 0)
-  	--open_counts_[filename_];
+  releaseReservation();
+  std::lock_guard<std::mutex> lock(file_->mutex);
+  OpenFile& file = *file_;
+	if(file.open_count > 0)
+  	--file.open_count;
+	assert(file.open_count >= 0);
+
+  if (file.open_count == 0 && file.io) {
+    closeHandle(file);
+  }
+}
+
+void File::releaseReservation() {
+  PageId first_unused, end;
+  {
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    OpenFile& file = *file_;
+    if (file.open_count != 1 || file.extent_next == file.extent_end) {
+      return;
+    }
+    first_unused = file.extent_next;
+    end = file.extent_end;
+    file.extent_next = file.extent_end = 0;
+  }
+  try {
+    FileHeader header = readHeader();
+    if (header.num_pages == end) {
+      header.num_pages = first_unused;
+      writeHeader(header);
+      finishWrite();
+    }
+  } catch (const BadgerDbException &e) {
+    // The pages stay counted in the header and are just never used.
+  }
+}
 
-  stream_.reset();
-	assert(open_counts_[filename_] >= 0);
+void File::openHandle(OpenFile& file, const bool truncate) {
+  file.io.reset(IoHandle::open(io_backend_, file.filename, truncate));
+  if (!file.io) {
+    throw FileNotFoundException(file.filename);
+  }
+  file.referenced = true;
+  ++handle_misses_;
+  // Just behind the hand, so it is the last file the hand comes to.
+  std::lock_guard<std::mutex> lock(clock_mutex_);
+  file.clock_position = open_handles_.insert(clock_hand_, &file);
+  file.in_clock = true;
+}
 
-  if (open_counts_[filename_] == 0) {
-    open_streams_.erase(filename_);
-    open_counts_.erase(filename_);
+void File::closeHandle(OpenFile& file) {
+  try {
+    writeBackHeader(file);
+  } catch (const IoErrorException &e) {
+    std::cerr << "closing " << file.filename << ": " << e.message()
+              << std::endl;
+  }
+  if (file.unsynced && durability_ != DURABILITY_NONE) {
+    try {
+      file.io->sync();
+      file.unsynced = false;
+    } catch (const IoErrorException &e) {
+      // Nothing to report to from here (we may be in a destructor); the data
+      // is still handed to the OS when the handle is closed.
+      std::cerr << "closing " << file.filename << ": " << e.message()
+                << std::endl;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(clock_mutex_);
+    if (file.in_clock) {
+      if (clock_hand_ == file.clock_position) {
+        ++clock_hand_;
+      }
+      open_handles_.erase(file.clock_position);
+      file.in_clock = false;
+    }
   }
+  // Other threads may still be doing I/O on the handle, in which case it is
+  // closed when the last of them lets go of it.
+  file.io.reset();
+}
+
+void File::evictHandles() {
+  for (;;) {
+    OpenFile* victim = NULL;
+    {
+      std::lock_guard<std::mutex> lock(clock_mutex_);
+      if (open_handles_.size() <= max_open_handles_) {
+        return;
+      }
+      // Sweep for a file whose handle has not been used since the hand last
+      // came by, clearing the marks of those that have.
+      while (victim == NULL) {
+        if (clock_hand_ == open_handles_.end()) {
+          clock_hand_ = open_handles_.begin();
+        }
+        OpenFile* file = *clock_hand_;
+        ++clock_hand_;
+        if (!file->referenced.exchange(false)) {
+          victim = file;
+        }
+      }
+    }
+    // The file may have been closed or reopened meanwhile; whichever handle
+    // it has now is the one closed.
+    std::lock_guard<std::mutex> lock(victim->mutex);
+    if (victim->io) {
+      closeHandle(*victim);
+      ++handle_evictions_;
+    }
+  }
+}
+
+void File::writeBackHeader(OpenFile& file) {
+  if (!file.header_dirty) {
+    return;
+  }
+  if (!file.io) {
+    openHandle(file, false /* truncate */);
+  }
+  file.io->write(0 /* pos */, reinterpret_cast<const char*>(&file.header),
+                 sizeof(FileHeader));
+  file.header_dirty = false;
+  file.unsynced = true;
+}
+
+std::shared_ptr<IoHandle> File::acquireIoHandle() const {
+  std::shared_ptr<IoHandle> io;
+  {
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    OpenFile& file = *file_;
+    if (file.io) {
+      if (!file.referenced.load(std::memory_order_relaxed)) {
+        file.referenced.store(true, std::memory_order_relaxed);
+      }
+      handle_hits_.fetch_add(1, std::memory_order_relaxed);
+      return file.io;
+    }
+    openHandle(file, false /* truncate */);
+    io = file.io;
+  }
+  evictHandles();
+  return io;
+}
+
+void File::markUnsynced() {
+  std::lock_guard<std::mutex> lock(file_->mutex);
+  file_->unsynced = true;
+}
+
+void File::finishWrite() {
+  markUnsynced();
+  if (durability() == DURABILITY_PER_COMMIT) {
+    sync();
+  }
+}
+
+void File::sync() {
+  std::shared_ptr<IoHandle> io = acquireIoHandle();
+  {
+    // Cleared first, so that writes made while syncing set it again.
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    writeBackHeader(*file_);
+    file_->unsynced = false;
+  }
+  evictHandles();
+  try {
+    io->sync();
+  } catch (...) {
+    markUnsynced();
+    throw;
+  }
+}
+
+void File::advisePages(const PageId first, const PageId count,
+                       const AccessAdvice advice) {
+  if (!access_hints_) {
+    return;
+  }
+  pages_advised_[advice].fetch_add(count, std::memory_order_relaxed);
+  acquireIoHandle()->advise(pagePosition(first),
+                            static_cast<std::size_t>(count) * Page::SIZE, advice);
+}
+
+void File::beginSequentialScan() {
+  {
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    if (file_->sequential_scans++ > 0) {
+      return;
+    }
+  }
+  advisePages(1, 0, ADVICE_SEQUENTIAL);
+}
+
+void File::endSequentialScan() {
+  {
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    if (--file_->sequential_scans > 0) {
+      return;
+    }
+  }
+  // other users of the file read it in their own order
+  advisePages(1, 0, ADVICE_NORMAL);
 }
 
 FileHeader File::readHeader() const {
+  {
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    const OpenFile& file = *file_;
+    if (file.header_cached) {
+      return file.header;
+    }
+  }
   FileHeader header;
-  stream_->seekg(0 /* pos */, std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
-  return header;
+  readAt(0 /* pos */, reinterpret_cast<char*>(&header), sizeof(FileHeader));
+  std::lock_guard<std::mutex> lock(file_->mutex);
+  OpenFile& file = *file_;
+  if (!file.header_cached) {
+    file.header = header;
+    file.header_cached = true;
+  }
+  return file.header;
 }
 
 void File::writeHeader(const FileHeader& header) {
-  stream_->seekp(0 /* pos */, std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
-  stream_->flush();
+  logWriteAhead(0 /* pos */, reinterpret_cast<const char*>(&header),
+                sizeof(FileHeader));
+  std::lock_guard<std::mutex> lock(file_->mutex);
+  OpenFile& file = *file_;
+  file.header = header;
+  file.header_cached = true;
+  file.header_dirty = true;
+}
+
+void File::readAt(const std::streampos position, char* buffer,
+                  const std::size_t length) const {
+  IoTicket ticket(IoScheduler::currentClass(FOREGROUND_READ), length);
+  acquireIoHandle()->read(position, buffer, length);
+}
+
+void File::writeAt(const std::streampos position, const char* buffer,
+                   const std::size_t length) {
+  logWriteAhead(position, buffer, length);
+  IoTicket ticket(IoScheduler::currentClass(BACKGROUND_WRITE), length);
+  acquireIoHandle()->write(position, buffer, length);
+}
+
+void File::logWriteAhead(const std::streampos position, const char* buffer,
+                         const std::size_t length) {
+  LogManager* log = logManager();
+  if (log != NULL && !LoggedWriteScope::active()) {
+    // The change has to be in the log on disk before it can reach the file.
+    log->force(log->logWrite(filename_, position, buffer, length));
+  }
+}
+
+bool File::hasPageChecksums() const {
+  {
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    const OpenFile& file = *file_;
+    if (file.page_checksums_known) {
+      return file.page_checksums;
+    }
+  }
+  const FileHeader header = readHeader();
+  std::lock_guard<std::mutex> lock(file_->mutex);
+  file_->page_checksums = header.page_checksums != 0;
+  file_->page_compression = header.page_compression != 0;
+  file_->page_checksums_known = true;
+  return header.page_checksums != 0;
+}
+
+bool File::hasPageCompression() const {
+  {
+    std::lock_guard<std::mutex> lock(file_->mutex);
+    const OpenFile& file = *file_;
+    if (file.page_checksums_known) {
+      return file.page_compression;
+    }
+  }
+  hasPageChecksums();
+  std::lock_guard<std::mutex> lock(file_->mutex);
+  return file_->page_compression;
+}
+
+std::uint32_t File::computeChecksum(const Page& page) const {
+  return crc32c(&page, Page::SIZE - Page::CHECKSUM_SIZE);
+}
+
+void File::stampChecksum(Page& page) const {
+  if (hasPageChecksums()) {
+    page.checksum_ = computeChecksum(page);
+  }
+}
+
+void File::verifyPage(const PageId page_number, const Page& page) const {
+  if (hasPageChecksums() && page.checksum_ != computeChecksum(page)) {
+    throw PageChecksumException(page_number, filename_);
+  }
+}
+
+void File::readPageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                         void* tag) const {
+  if (hasPageCompression()) {
+    // Compressed pages are decompressed as they are read, so they are read
+    // right away.
+    readPageImage(page_number, page);
+    io.complete(tag);
+    return;
+  }
+  io.read(acquireIoHandle(), pagePosition(page_number),
+          reinterpret_cast<char*>(&page), Page::SIZE, tag);
+}
+
+void File::writePageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                          void* tag) {
+  stampChecksum(page);
+  if (hasPageCompression()) {
+    writePageImage(page_number, page);
+    finishWrite();
+    io.complete(tag);
+    return;
+  }
+  markUnsynced();
+  io.write(acquireIoHandle(), pagePosition(page_number),
+           reinterpret_cast<const char*>(&page), Page::SIZE, tag);
+}
+
+//----------------------------------------
+// Compressed pages
+//
+// A page that compresses well starts its place in the file with
+//
+//   uint32 magic
+//   uint16 length      of the compressed bytes that follow
+//
+// padded with zeros to whole blocks, and the rest of its place is a hole.  A
+// raw page could start the same way, so a page only counts as compressed if it
+// also decompresses to an image that matches its checksum.  Pages no larger
+// than a block are always stored raw.
+//----------------------------------------
+
+static const std::uint32_t COMPRESSED_PAGE_MAGIC = 0x5a4cffff;
+static const std::size_t COMPRESSED_PAGE_HEADER = 4 + 2;
+static const std::size_t COMPRESSED_BLOCK = 4096;
+static const std::size_t COMPRESSED_CAPACITY =
+    Page::SIZE > COMPRESSED_BLOCK ?
+    Page::SIZE - COMPRESSED_BLOCK - COMPRESSED_PAGE_HEADER : 0;
+
+void File::readPageImage(const PageId page_number, Page& page) const {
+  char* bytes = reinterpret_cast<char*>(&page);
+  readAt(pagePosition(page_number), bytes, Page::SIZE);
+  std::uint32_t magic;
+  memcpy(&magic, bytes, sizeof(magic));
+  if (magic != COMPRESSED_PAGE_MAGIC || !hasPageCompression()) {
+    return;
+  }
+  std::uint16_t length;
+  memcpy(&length, bytes + sizeof(magic), sizeof(length));
+  Page decompressed;
+  if (COMPRESSED_PAGE_HEADER + length <= Page::SIZE &&
+      decompressBlock(bytes + COMPRESSED_PAGE_HEADER, length,
+                      reinterpret_cast<char*>(&decompressed), Page::SIZE) &&
+      decompressed.checksum_ == computeChecksum(decompressed)) {
+    page = decompressed;
+  }
+}
+
+std::size_t File::writePageImage(const PageId page_number, const Page& image) {
+  const char* bytes = reinterpret_cast<const char*>(&image);
+  if (hasPageCompression()) {
+    // Only worth it if at least one block is left out.
+    char stored[Page::SIZE];
+    const std::size_t length =
+        compressBlock(bytes, Page::SIZE, stored + COMPRESSED_PAGE_HEADER,
+                      COMPRESSED_CAPACITY);
+    if (length > 0) {
+      const std::uint16_t stored_length = length;
+      memcpy(stored, &COMPRESSED_PAGE_MAGIC, sizeof(COMPRESSED_PAGE_MAGIC));
+      memcpy(stored + sizeof(COMPRESSED_PAGE_MAGIC), &stored_length,
+             sizeof(stored_length));
+      const std::size_t used = COMPRESSED_PAGE_HEADER + length;
+      const std::size_t blocks_used =
+          (used + COMPRESSED_BLOCK - 1) / COMPRESSED_BLOCK * COMPRESSED_BLOCK;
+      memset(stored + used, 0, blocks_used - used);
+      writeAt(pagePosition(page_number), stored, blocks_used);
+      acquireIoHandle()->punchHole(pagePosition(page_number) +
+                                       std::streamoff(blocks_used),
+                                   Page::SIZE - blocks_used);
+      return blocks_used;
+    }
+  }
+  writeAt(pagePosition(page_number), bytes, Page::SIZE);
+  return Page::SIZE;
+}
+
+std::size_t File::writeSectors(const PageId page_number, const char* page_bytes,
+                               const SectorMask& sectors) {
+  if (hasPageCompression()) {
+    // Compressed pages are rewritten whole.
+    const std::size_t bytes_written =
+        writePageImage(page_number, *reinterpret_cast<const Page*>(page_bytes));
+    finishWrite();
+    return bytes_written;
+  }
+  std::size_t bytes_written = 0;
+  std::size_t sector = 0;
+  while (sector < sectors.size()) {
+    if (!sectors.test(sector)) {
+      ++sector;
+      continue;
+    }
+    // Write the whole run of dirty sectors starting here with one call.
+    std::size_t run_end = sector + 1;
+    while (run_end < sectors.size() && sectors.test(run_end)) {
+      ++run_end;
+    }
+    const std::size_t offset = sector * Page::SECTOR_SIZE;
+    const std::size_t length = (run_end - sector) * Page::SECTOR_SIZE;
+    writeAt(pagePosition(page_number) + std::streamoff(offset),
+            page_bytes + offset, length);
+    bytes_written += length;
+    sector = run_end;
+  }
+  finishWrite();
+  return bytes_written;
 }
 
 
@@ -165,148 +803,233 @@ PageFile& PageFile::operator=(const PageFile& rhs) {
 Page PageFile::allocatePage(PageId &new_page_number) {
   FileHeader header = readHeader();
   Page new_page;
-  Page existing_page;
   if (header.num_free_pages > 0) {
-    new_page = readPage(header.first_free_page, true /* allow_free */);
-    new_page.set_page_number(header.first_free_page);
-		new_page_number = new_page.page_number();
-    header.first_free_page = new_page.next_page_number();
+    // Reuse the page at the head of the free list.  Deleted pages are
+    // initialized on disk, so only the link to the next free page is needed.
+    new_page_number = header.first_free_page;
+    header.first_free_page = readPageHeader(new_page_number).next_page_number;
     --header.num_free_pages;
 
-    if (header.first_used_page == Page::INVALID_NUMBER ||
-        header.first_used_page > new_page.page_number()) {
-      // Either have no pages used or the head of the used list is a page later
-      // than the one we just allocated, so add the new page to the head.
-      if (header.first_used_page > new_page.page_number()) {
-        new_page.set_next_page_number(header.first_used_page);
-      }
-      header.first_used_page = new_page.page_number();
-    } else {
-      // New page is reused from somewhere after the beginning, so we need to
-      // find where in the used list to insert it.
-      PageId next_page_number = Page::INVALID_NUMBER;
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        next_page_number = (*iter).next_page_number();
-        if (next_page_number > new_page.page_number() ||
-            next_page_number == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      existing_page.set_next_page_number(new_page.page_number());
-      new_page.set_next_page_number(next_page_number);
-    }
-
     assert((header.num_free_pages == 0) ==
            (header.first_free_page == Page::INVALID_NUMBER));
   }
 	else
 	{
-    new_page.set_page_number(header.num_pages);
-		new_page_number = new_page.page_number();
-
-    if (header.first_used_page == Page::INVALID_NUMBER)
-		{
-      header.first_used_page = new_page.page_number();
-    }
-		else
-		{
-      // If we have pages allocated, we need to add the new page to the tail
-      // of the linked list.
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        if ((*iter).next_page_number() == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      assert(existing_page.isUsed());
-      existing_page.set_next_page_number(new_page.page_number());
-    }
+		new_page_number = header.num_pages;
     ++header.num_pages;
+
+    if ((new_page_number - 1) % FSM_PAGES_PER_MAP_PAGE == 0) {
+      // The new page is the first one past the end of the free-space map, so
+      // the map gets another page, chained after the last one.
+      std::lock_guard<std::mutex> lock(file_->free_space_map.mutex);
+      appendMapPage(header, header.first_fsm_page, file_->free_space_map);
+    }
+    if ((new_page_number - 1) % DIRECTORY_PAGES_PER_MAP_PAGE == 0) {
+      // Likewise for the page directory.
+      std::lock_guard<std::mutex> lock(file_->page_directory.mutex);
+      appendMapPage(header, header.first_directory_page,
+                    file_->page_directory);
+    }
   }
-  writePage(new_page_number, new_page.header_, new_page);
-  if (existing_page.page_number() != Page::INVALID_NUMBER) {
-    // If we updated an existing page by inserting the new page into the
-    // used list, we need to write it out.
-    writePage(existing_page.page_number(), existing_page.header_, existing_page);
+  new_page.set_page_number(new_page_number);
+
+  // New pages, whether reused or not, go on the tail of the used list.
+  new_page.set_prev_page_number(header.last_used_page);
+  if (header.first_used_page == Page::INVALID_NUMBER)
+	{
+    header.first_used_page = new_page_number;
   }
+	else
+	{
+    PageHeader tail_header = readPageHeader(header.last_used_page);
+    assert(tail_header.next_page_number == Page::INVALID_NUMBER);
+    tail_header.next_page_number = new_page_number;
+    writePageHeader(header.last_used_page, tail_header);
+  }
+  header.last_used_page = new_page_number;
+
+  writePage(new_page_number, new_page.header_, new_page);
   writeHeader(header);
+  setPageUsed(new_page_number, true);
+  finishWrite();
 
   return new_page;
 }
 
 Page PageFile::readPage(const PageId page_number) const {
+  Page page;
+  readPageInto(page_number, page);
+  return page;
+}
+
+void PageFile::readPageInto(const PageId page_number, Page& page) const {
   FileHeader header = readHeader();
 
 	if (page_number >= header.num_pages)
 	{
 		throw InvalidPageException(page_number, filename_);
 	}
-	return readPage(page_number, false /* allow_free */);
+  // The header and data are laid out back to back, as on disk.
+  readPageImage(page_number, page);
+  verifyPage(page_number, page);
 }
 
-Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
-  Page page;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&page.header_), sizeof(PageHeader));
-  stream_->read(&page.data_[0], Page::DATA_SIZE);
-  if (!allow_free && !page.isUsed()) {
+void PageFile::readPageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                             void* tag) const {
+  if (page_number >= readHeader().num_pages) {
     throw InvalidPageException(page_number, filename_);
   }
+  File::readPageAsync(io, page_number, page, tag);
+}
 
-  return page;
+void PageFile::verifyPage(const PageId page_number, const Page& page) const {
+  File::verifyPage(page_number, page);
+  if (!page.isUsed()) {
+    throw InvalidPageException(page_number, filename_);
+  }
 }
 
 void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
-	PageHeader header = readPageHeader(new_page_number);
-	if (header.current_page_number == Page::INVALID_NUMBER)
+	const PageHeader disk_header = readPageHeader(new_page_number);
+	if (disk_header.current_page_number == Page::INVALID_NUMBER)
 	{
 		// Page has been deleted since it was read.
 		throw InvalidPageException(new_page_number, filename_);
 	}
-	// Page on disk may have had its next page pointer updated since it was read;
-	// we don't modify that, but we do keep all the other modifications to the
-	// page header.
-	const PageId next_page_number = header.next_page_number;
-	header = new_page.header_;
-	header.next_page_number = next_page_number;
+	// Page on disk may have had its used list pointers updated since it was
+	// read; we don't modify those, but we do keep all the other modifications to
+	// the page header.
+	PageHeader header = new_page.header_;
+	header.next_page_number = disk_header.next_page_number;
+	header.prev_page_number = disk_header.prev_page_number;
 	writePage(new_page_number, header, new_page);
+	noteFreeSpace(new_page_number, disk_header, new_page);
+	finishWrite();
+}
+
+void PageFile::writePageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                              void* tag) {
+  const PageHeader header = readPageHeader(page_number);
+  if (header.current_page_number == Page::INVALID_NUMBER) {
+    // Page has been deleted since it was read.
+    throw InvalidPageException(page_number, filename_);
+  }
+  // Same as writePage(): keep the used list pointers that are on disk.
+  page.header_.next_page_number = header.next_page_number;
+  page.header_.prev_page_number = header.prev_page_number;
+  noteFreeSpace(page_number, header, page);
+  File::writePageAsync(io, page_number, page, tag);
+}
+
+std::size_t PageFile::writePageSectors(const PageId page_number,
+                                      const Page& new_page,
+                                      const SectorMask& sectors) {
+  const PageHeader header = readPageHeader(page_number);
+  if (header.current_page_number == Page::INVALID_NUMBER) {
+    // Page has been deleted since it was read.
+    throw InvalidPageException(page_number, filename_);
+  }
+  noteFreeSpace(page_number, header, new_page);
+  const bool page_checksums = hasPageChecksums();
+  if (!sectors.test(0) && !page_checksums) {
+    // Page header lives in the first sector, so it is left as it is on disk.
+    return writeSectors(page_number, reinterpret_cast<const char*>(&new_page),
+                        sectors);
+  }
+  // Same as writePage(): keep the used list pointers that are on disk.
+  Page merged_page = new_page;
+  merged_page.header_.next_page_number = header.next_page_number;
+  merged_page.header_.prev_page_number = header.prev_page_number;
+  SectorMask written = sectors;
+  if (page_checksums) {
+    // The checksum covers the whole page and lives in its last sector.
+    stampChecksum(merged_page);
+    written.set(written.size() - 1);
+  }
+  return writeSectors(page_number, reinterpret_cast<const char*>(&merged_page),
+                      written);
 }
 
 void PageFile::deletePage(const PageId page_number) {
   FileHeader header = readHeader();
 
   Page existing_page = readPage(page_number);
-  Page previous_page;
-  // If this page is the head of the used list, update the header to point to
-  // the next page in line.
-  if (page_number == header.first_used_page) {
-    header.first_used_page = existing_page.next_page_number();
+  const PageId previous = existing_page.prev_page_number();
+  const PageId next = existing_page.next_page_number();
+  // Unlink the page from its neighbours on the used list, or from the file
+  // header at either end of it.
+  if (previous == Page::INVALID_NUMBER) {
+    header.first_used_page = next;
   } else {
-    // Walk the used list so we can update the page that points to this one.
-    for (FileIterator iter = begin(); iter != end(); ++iter) {
-      previous_page = *iter;
-      if (previous_page.next_page_number() == existing_page.page_number()) {
-        previous_page.set_next_page_number(existing_page.next_page_number());
-        break;
-      }
-    }
+    PageHeader previous_header = readPageHeader(previous);
+    previous_header.next_page_number = next;
+    writePageHeader(previous, previous_header);
+  }
+  if (next == Page::INVALID_NUMBER) {
+    header.last_used_page = previous;
+  } else {
+    PageHeader next_header = readPageHeader(next);
+    next_header.prev_page_number = previous;
+    writePageHeader(next, next_header);
   }
   // Clear the page and add it to the head of the free list.
   existing_page.initialize();
   existing_page.set_next_page_number(header.first_free_page);
   header.first_free_page = page_number;
   ++header.num_free_pages;
-  if (previous_page.isUsed()) {
-    writePage(previous_page.page_number(), previous_page.header_, previous_page);
-  }
   writePage(page_number, existing_page.header_, existing_page);
   writeHeader(header);
+  setPageUsed(page_number, false);
+  setFreeSpace(page_number, 0);
+  finishWrite();
+}
+
+RecordId PageFile::insertRecord(const std::string& record_data) {
+  // Enough for the record and a new slot, rounded up to whole buckets.
+  const std::size_t needed = record_data.length() + sizeof(PageSlot);
+  const std::size_t bucket = (needed + FSM_BUCKET_SIZE - 1) / FSM_BUCKET_SIZE;
+  PageId page_number;
+  while (bucket <= 255 &&
+         (page_number = findFreeSpace(bucket)) != Page::INVALID_NUMBER) {
+    Page page = readPage(page_number);
+    if (page.hasSpaceForRecord(record_data)) {
+      const RecordId rid = page.insertRecord(record_data);
+      writePage(page_number, page);
+      return rid;
+    }
+    // The map was out of date; correct it and look again.
+    setFreeSpace(page_number,
+                 std::min<std::size_t>(freeSpaceBucket(page.getFreeSpace()),
+                                       bucket - 1));
+  }
+
+  Page new_page;
+  if (!new_page.hasSpaceForRecord(record_data)) {
+    throw InsufficientSpaceException(Page::INVALID_NUMBER,
+                                     record_data.length(),
+                                     new_page.getFreeSpace());
+  }
+  new_page = allocatePage(page_number);
+  const RecordId rid = new_page.insertRecord(record_data);
+  writePage(page_number, new_page);
+  return rid;
+}
+
+std::vector<std::pair<FileIterator, FileIterator> > PageFile::partition(
+    const std::size_t parts) {
+  std::shared_ptr<const std::vector<PageId> > pages(
+      new std::vector<PageId>(usedPages()));
+  std::vector<std::pair<FileIterator, FileIterator> > ranges;
+  for (std::size_t i = 0; i < parts; ++i) {
+    ranges.push_back(std::make_pair(
+        FileIterator(this, pages, pages->size() * i / parts),
+        FileIterator(this, pages, pages->size() * (i + 1) / parts)));
+  }
+  return ranges;
 }
 
 FileIterator PageFile::begin() {
-  const FileHeader& header = readHeader();
-  return FileIterator(this, header.first_used_page);
+  return FileIterator(this);
 }
 
 FileIterator PageFile::end() {
@@ -315,19 +1038,284 @@ FileIterator PageFile::end() {
 
 void PageFile::writePage(const PageId page_number, const PageHeader& header,
                      const Page& new_page) {
-  stream_->seekp(pagePosition(page_number), std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
-  stream_->write(&new_page.data_[0], Page::DATA_SIZE);
-  stream_->flush();
+  Page image = new_page;
+  image.header_ = header;
+  stampChecksum(image);
+  writePageImage(page_number, image);
+}
+
+std::uint32_t PageFile::computeChecksum(const Page& page) const {
+  const char* bytes = reinterpret_cast<const char*>(&page);
+  const std::size_t skip_start = offsetof(PageHeader, next_page_number);
+  const std::size_t skip_end = offsetof(PageHeader, prev_page_number) +
+                               sizeof(PageId);
+  const std::uint32_t crc = crc32c(bytes, skip_start);
+  return crc32c(bytes + skip_end, Page::SIZE - Page::CHECKSUM_SIZE - skip_end,
+                crc);
+}
+
+void PageFile::writePageHeader(const PageId page_number,
+                               const PageHeader& header) {
+  if (hasPageCompression()) {
+    // The header is compressed along with the rest of the page.
+    Page image;
+    readPageImage(page_number, image);
+    writePage(page_number, header, image);
+    return;
+  }
+  writeAt(pagePosition(page_number), reinterpret_cast<const char*>(&header),
+          sizeof(PageHeader));
 }
 
 PageHeader PageFile::readPageHeader(PageId page_number) const {
   PageHeader header;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(PageHeader));
+  if (hasPageCompression()) {
+    // A raw page never starts with the magic, as it starts with free space
+    // bounds below 0xffff, so only as much as the header is decompressed from
+    // the first block.
+    char block[COMPRESSED_BLOCK];
+    readAt(pagePosition(page_number), block, COMPRESSED_BLOCK);
+    std::uint32_t magic;
+    memcpy(&magic, block, sizeof(magic));
+    if (magic != COMPRESSED_PAGE_MAGIC) {
+      memcpy(&header, block, sizeof(header));
+      return header;
+    }
+    std::uint16_t length;
+    memcpy(&length, block + sizeof(magic), sizeof(length));
+    if (decompressPrefix(block + COMPRESSED_PAGE_HEADER,
+                         std::min<std::size_t>(length, COMPRESSED_BLOCK -
+                                                       COMPRESSED_PAGE_HEADER),
+                         reinterpret_cast<char*>(&header), sizeof(header))) {
+      return header;
+    }
+    Page image;
+    readPageImage(page_number, image);
+    return image.header_;
+  }
+  readAt(pagePosition(page_number), reinterpret_cast<char*>(&header),
+         sizeof(PageHeader));
   return header;
 }
 
+//----------------------------------------
+// Free-space map
+//
+// Each map page records the free space of FSM_PAGES_PER_MAP_PAGE pages in a
+// binary tree of one byte nodes, stored as a heap in the page's data: the
+// leaves are the buckets of the pages, and every other node is the largest
+// bucket below it, so a page with room is found by walking down from the root.
+// Map pages are chained through their next page pointers, starting at
+// FileHeader::first_fsm_page, and are not on the used list.  The chain is
+// read once into the file's MapChain, along with the root of each map page,
+// so a page is looked up by index and a search only reads map pages that
+// have a page with room.  The page directory below is chained the same way.
+//----------------------------------------
+
+static const std::size_t FSM_LEAF_START = PageFile::FSM_PAGES_PER_MAP_PAGE - 1;
+
+// Sets a leaf and the nodes above it; returns false if nothing changed.
+static bool fsmSet(unsigned char* tree, const std::size_t slot,
+                   const unsigned char value) {
+  std::size_t node = FSM_LEAF_START + slot;
+  if (tree[node] == value) {
+    return false;
+  }
+  tree[node] = value;
+  while (node > 0) {
+    node = (node - 1) / 2;
+    const unsigned char largest = std::max(tree[2 * node + 1],
+                                           tree[2 * node + 2]);
+    if (tree[node] == largest) {
+      break;
+    }
+    tree[node] = largest;
+  }
+  return true;
+}
+
+// Returns the first slot whose leaf is at least <value>, or -1 if none is.
+static long fsmSearch(const unsigned char* tree, const unsigned char value) {
+  if (tree[0] < value) {
+    return -1;
+  }
+  std::size_t node = 0;
+  while (node < FSM_LEAF_START) {
+    node = tree[2 * node + 1] >= value ? 2 * node + 1 : 2 * node + 2;
+  }
+  return node - FSM_LEAF_START;
+}
+
+std::uint8_t PageFile::freeSpaceBucket(const std::size_t free_space) {
+  return std::min<std::size_t>(free_space / FSM_BUCKET_SIZE, 255);
+}
+
+void PageFile::loadMapChain(MapChain& chain,
+                            const PageId first_map_page) const {
+  if (chain.cached) {
+    return;
+  }
+  chain.pages.clear();
+  for (PageId map_page_number = first_map_page;
+       map_page_number != Page::INVALID_NUMBER;
+       map_page_number = readPageHeader(map_page_number).next_page_number) {
+    chain.pages.push_back(map_page_number);
+  }
+  chain.largest.assign(chain.pages.size(), 255);
+  chain.cached = true;
+}
+
+void PageFile::appendMapPage(FileHeader& header, PageId& first_map_page,
+                             MapChain& chain) {
+  loadMapChain(chain, first_map_page);
+  Page map_page;
+  const PageId map_page_number = header.num_pages++;
+  map_page.set_page_number(map_page_number);
+  writePage(map_page_number, map_page.header_, map_page);
+  if (first_map_page == Page::INVALID_NUMBER) {
+    first_map_page = map_page_number;
+  } else {
+    PageHeader last_header = readPageHeader(chain.pages.back());
+    assert(last_header.next_page_number == Page::INVALID_NUMBER);
+    last_header.next_page_number = map_page_number;
+    writePageHeader(chain.pages.back(), last_header);
+  }
+  chain.pages.push_back(map_page_number);
+  chain.largest.push_back(0);
+}
+
+PageId PageFile::findMapPage(const PageId page_number) const {
+  MapChain& chain = file_->free_space_map;
+  loadMapChain(chain, readHeader().first_fsm_page);
+  const std::size_t index = (page_number - 1) / FSM_PAGES_PER_MAP_PAGE;
+  return index < chain.pages.size() ? chain.pages[index] : Page::INVALID_NUMBER;
+}
+
+void PageFile::readMapPage(const PageId map_page_number, Page& map_page) const {
+  readPageImage(map_page_number, map_page);
+  try {
+    File::verifyPage(map_page_number, map_page);
+  } catch (const PageChecksumException &e) {
+    const PageId next_page_number = map_page.next_page_number();
+    map_page.initialize();
+    map_page.set_page_number(map_page_number);
+    map_page.set_next_page_number(next_page_number);
+  }
+}
+
+void PageFile::setFreeSpace(const PageId page_number, const std::uint8_t bucket) {
+  std::lock_guard<std::mutex> lock(file_->free_space_map.mutex);
+  const PageId map_page_number = findMapPage(page_number);
+  if (map_page_number == Page::INVALID_NUMBER) {
+    return;
+  }
+  Page map_page;
+  readMapPage(map_page_number, map_page);
+  unsigned char* tree = reinterpret_cast<unsigned char*>(map_page.data_);
+  if (fsmSet(tree, (page_number - 1) % FSM_PAGES_PER_MAP_PAGE, bucket)) {
+    writePage(map_page_number, map_page.header_, map_page);
+  }
+  file_->free_space_map.largest[(page_number - 1) / FSM_PAGES_PER_MAP_PAGE] =
+      tree[0];
+}
+
+void PageFile::noteFreeSpace(const PageId page_number,
+                             const PageHeader& old_header,
+                             const Page& new_page) {
+  const std::uint8_t bucket = freeSpaceBucket(new_page.getFreeSpace());
+  if (bucket != freeSpaceBucket(old_header.free_space_upper_bound -
+                                old_header.free_space_lower_bound)) {
+    setFreeSpace(page_number, bucket);
+  }
+}
+
+PageId PageFile::findFreeSpace(const std::uint8_t bucket) const {
+  MapChain& chain = file_->free_space_map;
+  std::lock_guard<std::mutex> lock(chain.mutex);
+  loadMapChain(chain, readHeader().first_fsm_page);
+  for (std::size_t index = 0; index < chain.pages.size(); ++index) {
+    if (chain.largest[index] < bucket) {
+      continue;
+    }
+    Page map_page;
+    readMapPage(chain.pages[index], map_page);
+    const unsigned char* tree =
+        reinterpret_cast<const unsigned char*>(map_page.data_);
+    chain.largest[index] = tree[0];
+    const long slot = fsmSearch(tree, bucket);
+    if (slot >= 0) {
+      return index * FSM_PAGES_PER_MAP_PAGE + slot + 1;
+    }
+  }
+  return Page::INVALID_NUMBER;
+}
+
+//----------------------------------------
+// Page directory
+//
+// One bit per page, set while the page is used, in the data of directory
+// pages chained through their next page pointers from
+// FileHeader::first_directory_page.  Unlike the free-space map it is not a
+// hint: the file iterator finds the used pages with it alone.
+//----------------------------------------
+
+PageId PageFile::findDirectoryPage(const PageId page_number) const {
+  MapChain& chain = file_->page_directory;
+  loadMapChain(chain, readHeader().first_directory_page);
+  const std::size_t index = (page_number - 1) / DIRECTORY_PAGES_PER_MAP_PAGE;
+  return index < chain.pages.size() ? chain.pages[index] : Page::INVALID_NUMBER;
+}
+
+void PageFile::setPageUsed(const PageId page_number, const bool used) {
+  std::lock_guard<std::mutex> lock(file_->page_directory.mutex);
+  const PageId directory_page_number = findDirectoryPage(page_number);
+  assert(directory_page_number != Page::INVALID_NUMBER);
+  const std::size_t slot = (page_number - 1) % DIRECTORY_PAGES_PER_MAP_PAGE;
+  const unsigned char bit = 1 << (slot % 8);
+  if (!hasPageChecksums() && !hasPageCompression()) {
+    // Nothing else on the page covers the bits, so only the byte holding the
+    // page's bit is read and written.
+    const std::streampos position = pagePosition(directory_page_number) +
+        std::streamoff(sizeof(PageHeader) + slot / 8);
+    unsigned char bits;
+    readAt(position, reinterpret_cast<char*>(&bits), 1);
+    bits = used ? bits | bit : bits & ~bit;
+    writeAt(position, reinterpret_cast<const char*>(&bits), 1);
+    return;
+  }
+  Page directory_page;
+  readPageImage(directory_page_number, directory_page);
+  File::verifyPage(directory_page_number, directory_page);
+  unsigned char& bits =
+      reinterpret_cast<unsigned char*>(directory_page.data_)[slot / 8];
+  bits = used ? bits | bit : bits & ~bit;
+  writePage(directory_page_number, directory_page.header_, directory_page);
+}
+
+std::vector<PageId> PageFile::usedPages() const {
+  MapChain& chain = file_->page_directory;
+  std::lock_guard<std::mutex> lock(chain.mutex);
+  loadMapChain(chain, readHeader().first_directory_page);
+  std::vector<PageId> pages;
+  for (std::size_t index = 0; index < chain.pages.size(); ++index) {
+    const PageId directory_page_number = chain.pages[index];
+    Page directory_page;
+    readPageImage(directory_page_number, directory_page);
+    File::verifyPage(directory_page_number, directory_page);
+    const PageId base = index * DIRECTORY_PAGES_PER_MAP_PAGE + 1;
+    const char* bits = directory_page.data_;
+    for (std::size_t word = 0; word < Page::DATA_SIZE / 8; ++word) {
+      std::uint64_t used;
+      memcpy(&used, bits + word * 8, sizeof(used));
+      while (used != 0) {
+        pages.push_back(base + word * 64 + __builtin_ctzll(used));
+        used &= used - 1;
+      }
+    }
+  }
+  return pages;
+}
+
 
 
 
@@ -361,39 +1349,230 @@ BlobFile& BlobFile::operator=(const BlobFile& rhs) {
 }
 
 Page BlobFile::allocatePage(PageId &new_page_number) {
-  FileHeader header = readHeader();
+	{
+		std::lock_guard<std::mutex> lock(file_->mutex);
+		OpenFile& file = *file_;
+		if (file.no_free_pages && file.extent_next != file.extent_end) {
+			new_page_number = file.extent_next++;
+			return Page();
+		}
+	}
+
+	FileHeader header = readHeader();
 	Page new_page;
+	if (header.num_free_pages > 0) {
+		// Reuse the page deleted last; it is overwritten with an empty page, as
+		// a reserved page would read.
+		new_page_number = header.first_free_page;
+		Page free_page;
+		readPageInto(new_page_number, free_page);
+		memcpy(&header.first_free_page, reinterpret_cast<const char*>(&free_page),
+		       sizeof(PageId));
+		--header.num_free_pages;
+
+		writePage(new_page_number, new_page);
+		writeHeader(header);
+		finishWrite();
+		return new_page;
+	}
 
+	{
+		std::lock_guard<std::mutex> lock(file_->mutex);
+		OpenFile& file = *file_;
+		file.no_free_pages = true;
+		if (file.extent_next != file.extent_end) {
+			new_page_number = file.extent_next++;
+			return new_page;
+		}
+	}
+
+	// Reserve the next extent.  It is counted in the header now, and the pages
+	// in it are handed out by the calls that follow.
+	PageId extent = header.num_pages;
+	if (extent < MIN_EXTENT_PAGES) {
+		extent = MIN_EXTENT_PAGES;
+	} else if (extent > MAX_EXTENT_PAGES) {
+		extent = MAX_EXTENT_PAGES;
+	}
 	new_page_number = header.num_pages;
 
 	if (header.first_used_page == Page::INVALID_NUMBER) {
 		header.first_used_page = header.num_pages;
 	}
 
-	++header.num_pages;
+	header.num_pages += extent;
 
-	writePage(new_page_number, new_page);
+	acquireIoHandle()->allocate(pagePosition(new_page_number),
+	                            (std::size_t)extent * Page::SIZE);
 	writeHeader(header);
+	finishWrite();
 
+	{
+		std::lock_guard<std::mutex> lock(file_->mutex);
+		OpenFile& file = *file_;
+		file.extent_next = new_page_number + 1;
+		file.extent_end = header.num_pages;
+	}
 	return new_page;
 }
 
 Page BlobFile::readPage(const PageId page_number) const {
 	Page page;
-	stream_->seekg(pagePosition(page_number), std::ios::beg);
-	stream_->read(reinterpret_cast<char*>(&page), Page::SIZE);
+	readPageInto(page_number, page);
 	return page;
 }
 
+void BlobFile::readPageInto(const PageId page_number, Page& page) const {
+	readPageImage(page_number, page);
+	verifyPage(page_number, page);
+}
+
+void BlobFile::verifyPage(const PageId page_number, const Page& page) const {
+	static const char zero_page[Page::SIZE] = {};
+	if (hasPageChecksums() && page.checksum_ != computeChecksum(page)
+	    && memcmp(&page, zero_page, Page::SIZE) != 0) {
+		throw PageChecksumException(page_number, filename_);
+	}
+}
+
 void BlobFile::writePage(const PageId new_page_number, const Page& new_page) {
-	stream_->seekp(pagePosition(new_page_number), std::ios::beg);
-	stream_->write(reinterpret_cast<const char*>(&new_page), Page::SIZE);
-	stream_->flush();
+	if (hasPageChecksums()) {
+		Page image = new_page;
+		stampChecksum(image);
+		writePageImage(new_page_number, image);
+	} else {
+		writeAt(pagePosition(new_page_number),
+		        reinterpret_cast<const char*>(&new_page), Page::SIZE);
+	}
+	finishWrite();
+}
+
+std::size_t BlobFile::writePageSectors(const PageId page_number,
+                                      const Page& new_page,
+                                      const SectorMask& sectors) {
+	if (!hasPageChecksums()) {
+		return writeSectors(page_number, reinterpret_cast<const char*>(&new_page),
+		                    sectors);
+	}
+	// The checksum covers the whole page and lives in its last sector.
+	Page image = new_page;
+	stampChecksum(image);
+	SectorMask written = sectors;
+	written.set(written.size() - 1);
+	return writeSectors(page_number, reinterpret_cast<const char*>(&image),
+	                    written);
 }
 
-//delePage should not be called for a blob_file, not supported
+// Deleted pages form a free list threaded through the pages themselves: the
+// first bytes of a free page hold the number of the next one, and the file
+// header holds the head and length of the list.  allocatePage() pops the head,
+// so the page deleted last is reused first.  Pages counted in the header but
+// still reserved, from extent_next on, were never handed out and are refused.
+// A page already on the list is not detected; deleting it again would link it
+// in twice and have it handed out twice.
 void BlobFile::deletePage(const PageId page_number) {
-	throw InvalidPageException(page_number, filename_);
+	FileHeader header = readHeader();
+	PageId end = header.num_pages;
+	{
+		std::lock_guard<std::mutex> lock(file_->mutex);
+		if (file_->extent_next != file_->extent_end) {
+			end = file_->extent_next;
+		}
+	}
+	if (page_number == Page::INVALID_NUMBER || page_number >= end) {
+		throw InvalidPageException(page_number, filename_);
+	}
+
+	Page free_page;
+	memcpy(reinterpret_cast<char*>(&free_page), &header.first_free_page,
+	       sizeof(PageId));
+	header.first_free_page = page_number;
+	++header.num_free_pages;
+	{
+		std::lock_guard<std::mutex> lock(file_->mutex);
+		file_->no_free_pages = false;
+	}
+
+	writePage(page_number, free_page);
+	writeHeader(header);
+	finishWrite();
+}
+
+PageId BlobFile::truncateFreeTail() {
+	PageId reserved_next, reserved_end;
+	{
+		std::lock_guard<std::mutex> lock(file_->mutex);
+		OpenFile& file = *file_;
+		reserved_next = file.extent_next;
+		reserved_end = file.extent_end;
+		file.extent_next = file.extent_end = 0;
+	}
+
+	FileHeader header = readHeader();
+	const PageId old_num_pages = header.num_pages;
+	if (reserved_next != reserved_end && header.num_pages == reserved_end) {
+		header.num_pages = reserved_next;
+	}
+
+	// Collect the free list, in order.
+	std::vector<PageId> free_list;
+	std::vector<bool> is_free(header.num_pages, false);
+	for (PageId page_number = header.first_free_page;
+	     page_number != Page::INVALID_NUMBER; ) {
+		if (page_number >= is_free.size()) {
+			throw InvalidPageException(page_number, filename_);
+		}
+		free_list.push_back(page_number);
+		is_free[page_number] = true;
+		Page free_page;
+		readPageInto(page_number, free_page);
+		memcpy(&page_number, reinterpret_cast<const char*>(&free_page),
+		       sizeof(PageId));
+	}
+
+	PageId end = header.num_pages;
+	while (end > 1 && is_free[end - 1]) {
+		--end;
+	}
+	if (end == old_num_pages) {
+		return 0;
+	}
+
+	// Unlink the pages past the new end, rewriting only the links that change.
+	std::vector<std::size_t> kept;
+	for (std::size_t i = 0; i < free_list.size(); ++i) {
+		if (free_list[i] < end) {
+			kept.push_back(i);
+		}
+	}
+	for (std::size_t j = 0; j < kept.size(); ++j) {
+		const PageId next = j + 1 < kept.size() ? free_list[kept[j + 1]]
+		                                        : Page::INVALID_NUMBER;
+		const PageId old_next = kept[j] + 1 < free_list.size()
+		                        ? free_list[kept[j] + 1] : Page::INVALID_NUMBER;
+		if (next != old_next) {
+			Page free_page;
+			memcpy(reinterpret_cast<char*>(&free_page), &next, sizeof(PageId));
+			writePage(free_list[kept[j]], free_page);
+		}
+	}
+
+	header.first_free_page = kept.empty() ? Page::INVALID_NUMBER
+	                                      : free_list[kept[0]];
+	header.num_free_pages = kept.size();
+	header.num_pages = end;
+	if (end == 1) {
+		header.first_used_page = Page::INVALID_NUMBER;
+	}
+	writeHeader(header);
+	finishWrite();
+	acquireIoHandle()->truncate(pagePosition(end));
+
+	{
+		std::lock_guard<std::mutex> lock(file_->mutex);
+		file_->no_free_pages = kept.empty();
+	}
+	return old_num_pages - end;
 }
 
 }
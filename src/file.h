@@ -7,16 +7,63 @@
 
 #pragma once
 
+#include <atomic>
+#include <bitset>
+#include <cstdint>
 #include <fstream>
+#include <list>
+#include <mutex>
 #include <string>
-#include <map>
+#include <unordered_map>
 #include <memory>
+#include <vector>
 
+#include "io_handle.h"
 #include "page.h"
 
 namespace badgerdb {
 
 class FileIterator;
+class AsyncIo;
+class LogManager;
+
+/**
+ * @brief Bitmap with one bit per Page::SECTOR_SIZE-byte sector of a page, used
+ *        to write back only the parts of a page that changed.
+ */
+typedef std::bitset<Page::SIZE / Page::SECTOR_SIZE> SectorMask;
+
+/**
+ * @brief Statistics of the cache of OS file handles shared by all File objects.
+ */
+struct HandleCacheStats {
+  /**
+   * Accesses that found the file's handle open.
+   */
+  std::uint64_t hits;
+
+  /**
+   * Accesses that had to open the file's handle.
+   */
+  std::uint64_t misses;
+
+  /**
+   * Handles closed to make room for another one.
+   */
+  std::uint64_t evictions;
+};
+
+/**
+ * @brief When writes to files are made durable, i.e. synced to disk.  Until
+ * then they may be lost if the machine crashes.
+ */
+enum DurabilityMode {
+  DURABILITY_NONE,        /* only by File::sync() */
+  DURABILITY_ON_CLOSE,    /* also when the file's OS handle is closed */
+  DURABILITY_GROUP,       /* also every group interval, by a background thread */
+  DURABILITY_PER_COMMIT   /* before every page write, allocation or deletion
+                             returns */
+};
 
 /**
  * @brief Header metadata for files on disk which contain pages.
@@ -42,6 +89,36 @@ struct FileHeader {
    */
   PageId first_free_page;
 
+  /**
+   * Page number of the last used page in the file, to which new pages are
+   * linked.
+   */
+  PageId last_used_page;
+
+  /**
+   * Page number of the first page of a PageFile's free-space map, which
+   * records how much room each page has for new records.
+   */
+  PageId first_fsm_page;
+
+  /**
+   * Page number of the first page of a PageFile's page directory, a bitmap of
+   * which pages are used.
+   */
+  PageId first_directory_page;
+
+  /**
+   * Nonzero if every page of the file ends with a CRC32C checksum of the rest
+   * of the page, checked whenever the page is read.
+   */
+  std::uint32_t page_checksums;
+
+  /**
+   * Nonzero if pages that compress well are stored compressed, in the first
+   * blocks of their place in the file.
+   */
+  std::uint32_t page_compression;
+
   /**
    * Returns true if this file header is equal to the other.
    *
@@ -52,7 +129,12 @@ struct FileHeader {
     return num_pages == rhs.num_pages &&
         num_free_pages == rhs.num_free_pages &&
         first_used_page == rhs.first_used_page &&
-        first_free_page == rhs.first_free_page;
+        first_free_page == rhs.first_free_page &&
+        last_used_page == rhs.last_used_page &&
+        first_fsm_page == rhs.first_fsm_page &&
+        first_directory_page == rhs.first_directory_page &&
+        page_checksums == rhs.page_checksums &&
+        page_compression == rhs.page_compression;
   }
 };
 
@@ -60,15 +142,21 @@ struct FileHeader {
  * @brief Class which represents a file in the filesystem containing database
  *        pages.
  *
- * The File class wraps a stream to an underlying file on disk.  Files contain
+ * The File class wraps an OS handle (IoHandle) to an underlying file on disk.  Files contain
  * fixed-sized pages, and they never deallocate space (though they do reuse
  * deleted pages if possible).  If multiple File objects refer to the same
- * underlying file, they will share the stream in memory.
+ * underlying file, they will share the OS handle in memory.
  * If a file that has already been opened (possibly by another query), then the File class
- * detects this (by looking in the open_streams_ map) and just returns a file object with
- * the already created stream for the file without actually opening the UNIX file again. 
+ * detects this (by looking up its entry in the registry) and just returns a file object
+ * sharing the entry for the file without actually opening the UNIX file again.
+ *
+ * At most max_open_handles_ OS handles are kept open at once.  When another one
+ * is needed a handle not used recently is closed, and it is reopened
+ * transparently the next time its file is accessed.
  *
- * @warning This class is not threadsafe.
+ * Files may be opened and closed from several threads at once, and pages read
+ * and written; with the default POSIX_BACKEND transfers at different offsets
+ * then run concurrently.  Allocating and deleting pages is not threadsafe.
  */
 
 
@@ -111,6 +199,118 @@ class File {
    */
   static bool exists(const std::string& filename);
 
+  /**
+   * Sets the maximum number of OS file handles kept open at once by all File
+   * objects.  Handles over the limit are closed immediately.
+   *
+   * @param max_handles Maximum number of open handles; at least 1.
+   */
+  static void setMaxOpenHandles(const std::size_t max_handles);
+
+  /**
+   * Sets the backend used for file I/O.  Files already open keep their current
+   * OS handle until it is closed.
+   *
+   * @param backend Backend to use; POSIX_BACKEND by default.
+   */
+  static void setIoBackend(const IoBackend backend);
+
+  /**
+   * Sets when writes to files are synced to disk.  Every mode but
+   * DURABILITY_NONE also syncs a file when its OS handle is closed.
+   *
+   * @param mode              Durability mode; DURABILITY_NONE by default.
+   * @param group_interval_ms Time between syncs under DURABILITY_GROUP.
+   */
+  static void setDurability(const DurabilityMode mode,
+                            const unsigned group_interval_ms = 10);
+
+  /**
+   * Returns the current durability mode.
+   */
+  static DurabilityMode durability();
+
+  /**
+   * Syncs every open file written since it was last synced.
+   *
+   * @throws  IoErrorException  If a file could not be synced.
+   */
+  static void syncAll();
+
+  /**
+   * Sets the write-ahead log that changes to files are logged in, or NULL for
+   * none (the default).  Buffer managers pick up the log when they are
+   * constructed, so it must be set before them.
+   *
+   * @param log   Log to use; not owned by File.
+   */
+  static void setLogManager(LogManager* log);
+
+  /**
+   * Returns the write-ahead log set with setLogManager(), or NULL.
+   */
+  static LogManager* logManager();
+
+  /**
+   * Sets whether files created from now on store a checksum in every page.
+   * Files keep the setting they were created with.
+   *
+   * @param enabled Whether to add checksums; false by default.
+   */
+  static void setPageChecksums(const bool enabled);
+
+  /**
+   * Returns whether files created from now on store page checksums.
+   */
+  static bool pageChecksums();
+
+  /**
+   * Sets whether files created from now on compress their pages.  A page is
+   * compressed if that saves at least one disk block: it then takes up only
+   * the first blocks of its place in the file, and the rest is given back to
+   * the filesystem.  Compressed files also have page checksums, which tell
+   * compressed pages from raw ones.  Files keep the setting they were created
+   * with; files created while a write-ahead log is set are not compressed, as
+   * the log records the bytes of pages as they are in memory.
+   *
+   * @param enabled Whether to compress pages; false by default.
+   */
+  static void setPageCompression(const bool enabled);
+
+  /**
+   * Returns whether files created from now on compress their pages.
+   */
+  static bool pageCompression();
+
+  /**
+   * Sets whether advisePages() passes its hints on to the OS.
+   *
+   * @param enabled Whether to pass hints on; true by default.
+   */
+  static void setAccessHints(const bool enabled);
+
+  /**
+   * Returns the statistics of the OS file handle cache.
+   */
+  static HandleCacheStats handleCacheStats();
+
+  /**
+   * Clears the statistics of the OS file handle cache.
+   */
+  static void clearHandleCacheStats();
+
+  /**
+   * Returns the number of pages advisePages() has passed on to the OS with
+   * <advice> since the count was last cleared.  A range to the end of the file
+   * counts as no pages.
+   */
+  static std::uint64_t pagesAdvised(const AccessAdvice advice);
+
+  /**
+   * Clears the counts of pages advised.
+   */
+  static void clearPagesAdvised();
+
   /**
    * Destructor that automatically closes the underlying file if no other
    * File objects are using it.
@@ -131,9 +331,22 @@ class File {
    * @return  The page.
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
+   * @throws  PageChecksumException If the page does not match its checksum.
    */
   virtual Page readPage(const PageId page_number) const = 0;
 
+  /**
+   * Reads an existing page from the file straight into the given page, such
+   * as a buffer pool frame, saving the copy readPage() makes when returning.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   * @throws  PageChecksumException If the page does not match its checksum.
+   */
+  virtual void readPageInto(const PageId page_number, Page& page) const = 0;
+
   /**
    * Writes a page into the file at the given page number.
    * No bounds checking is performed.
@@ -143,6 +356,19 @@ class File {
    */
   virtual void writePage(const PageId page_number, const Page& new_page) = 0;
 
+  /**
+   * Writes only the given sectors of a page into the file, leaving the rest of
+   * the page on disk untouched.  No bounds checking is performed.
+   *
+   * @param page_number Number of page whose contents to replace.
+   * @param new_page    Page holding the new contents.
+   * @param sectors     Sectors of the page to write.
+   * @return  Number of bytes written.
+   */
+  virtual std::size_t writePageSectors(const PageId page_number,
+                                       const Page& new_page,
+                                       const SectorMask& sectors) = 0;
+
   /**
    * Deletes a page from the file.
    *
@@ -150,6 +376,97 @@ class File {
    */
   virtual void deletePage(const PageId page_number) = 0;
 
+  /**
+   * Starts reading a page into the given page through <io>.  The page must stay
+   * valid until <io> hands back <tag>, after which verifyPage() checks it.
+   *
+   * @param io            AsyncIo to start the read on.
+   * @param page_number   Number of page to read.
+   * @param page          Page to read into.
+   * @param tag           Tag identifying the read to io.wait().
+   * @throws  InvalidPageException  If the page doesn't exist in the file.
+   */
+  virtual void readPageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                             void* tag) const;
+
+  /**
+   * Starts writing a page into the file through <io>.  The page must stay
+   * valid and unchanged until <io> hands back <tag>.
+   *
+   * @param io            AsyncIo to start the write on.
+   * @param page_number   Number of page whose contents to replace.
+   * @param page          Page to write.
+   * @param tag           Tag identifying the write to io.wait().
+   * @throws  InvalidPageException  If the page has been deleted.
+   */
+  virtual void writePageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                              void* tag);
+
+  /**
+   * Checks a page read by readPageAsync(): its checksum, if the file has
+   * them.
+   *
+   * @param page_number   Number of page read.
+   * @param page          Page read.
+   * @throws  PageChecksumException If the page does not match its checksum.
+   * @throws  InvalidPageException  If the page is not currently used.
+   */
+  virtual void verifyPage(const PageId page_number, const Page& page) const;
+
+  /**
+   * Returns true if the pages of this file store a checksum.
+   */
+  bool hasPageChecksums() const;
+
+  /**
+   * Returns true if the pages of this file are stored compressed.
+   */
+  bool hasPageCompression() const;
+
+  /**
+   * Stores the checksum of a page in it, if this file has page checksums.
+   * Pages are checksummed when they are written anyway; this is for callers
+   * that need the checksum in the page image itself, such as the buffer
+   * manager logging a changed frame.
+   *
+   * @param page  Page to checksum.
+   */
+  void stampChecksum(Page& page) const;
+
+  /**
+   * Waits until all writes to this file so far are on disk.
+   *
+   * @throws  IoErrorException  If the data could not be written.
+   */
+  void sync();
+
+  /**
+   * Tells the OS how a range of pages is going to be read, so that it can
+   * read further ahead, or not at all, start reading pages in, or drop them
+   * from its cache.  The hint goes to the OS handle shared by all File objects
+   * for the file, and only changes performance.  Does nothing if hints are
+   * turned off with setAccessHints().
+   *
+   * @param first   Number of the first page of the range.
+   * @param count   Number of pages in the range; 0 for all pages from <first>
+   *                on.
+   * @param advice  How the pages are going to be read.
+   */
+  void advisePages(const PageId first, const PageId count,
+                   const AccessAdvice advice);
+
+  /**
+   * Advises the OS that the file is about to be read in page order.  Scans of
+   * the file may overlap; the advice is only taken back by the
+   * endSequentialScan() of the last one.
+   */
+  void beginSequentialScan();
+
+  /**
+   * Ends a scan begun with beginSequentialScan().
+   */
+  void endSequentialScan();
+
   /**
    * Returns the name of the file this object represents.
    *
@@ -157,6 +474,14 @@ class File {
    */
   const std::string& filename() const { return filename_; }
 
+  /**
+   * Returns a number identifying the file within this process: the same for
+   * all File objects for the file, never 0 and never given to another file.
+   *
+   * @return Id of file.
+   */
+  std::uint32_t id() const { return file_->id; }
+
  	/**
    * Returns pageid of first page in the file.
    *
@@ -164,7 +489,6 @@ class File {
    */
 	PageId getFirstPageNo();
 
- protected:
   /**
    * Returns the position of the page with the given number in the file (as an
    * offset from the beginning of the file).
@@ -173,13 +497,21 @@ class File {
    * @return  Position of page in file.
    */
   static std::streampos pagePosition(const PageId page_number) {
-    return sizeof(FileHeader) + ((page_number - 1) * Page::SIZE);
+    return HEADER_SIZE + ((page_number - 1) * Page::SIZE);
   }
 
+  /**
+   * Bytes before the first page: the FileHeader, padded so that pages start
+   * at offsets aligned for direct I/O.
+   */
+  static const std::streamoff HEADER_SIZE = 4096;
+
+ protected:
+
   /**
    * Opens the underlying file named in filename_.
    * This method only opens the file if no other File objects exist that access
-   * the same filesystem file; otherwise, it reuses the existing stream.
+   * the same filesystem file; otherwise, it reuses the existing handle.
    *
    * @param create_new  Whether to create a new file.
    * @throws  FileExistsException     If the underlying file exists and
@@ -190,38 +522,391 @@ class File {
   void openIfNeeded(const bool create_new);
 
   /**
-   * Closes the underlying file stream in <stream_>.
+   * Detaches this object from its entry in the registry.
    * This method only closes the file if no other File objects exist that access
    * the same file.
    */
   void close();
 
   /**
-   * Reads the header for this file from disk.
+   * Gives the pages reserved by BlobFile::allocatePage() but not handed out
+   * back to the file, if this object is the last one using it, so that they
+   * are not left unused for good.
+   */
+  void releaseReservation();
+
+  /**
+   * Returns the header for this file, read from disk the first time only.
    *
    * @return  The file header.
    */
   FileHeader readHeader() const;
 
   /**
-   * Writes the given header to the disk as the header for this file.
+   * Replaces the header for this file.  Only the cached header is updated;
+   * it reaches the disk at the next sync point (see writeBackHeader()).  With
+   * a write-ahead log the change is logged and forced right away, like any
+   * other write.
    *
    * @param header  File header to write.
    */
   void writeHeader(const FileHeader& header);
 
-  typedef std::map<std::string, std::shared_ptr<std::fstream> > StreamMap;
-  typedef std::map<std::string, int> CountMap;
+  /**
+   * Writes each run of consecutive sectors set in <sectors> from the given page
+   * image to the page's position in the file.
+   *
+   * @param page_number Number of page to write.
+   * @param page_bytes  Page::SIZE bytes holding the page image.
+   * @param sectors     Sectors of the page to write.
+   * @return  Number of bytes written.
+   */
+  std::size_t writeSectors(const PageId page_number, const char* page_bytes,
+                           const SectorMask& sectors);
+
+  /**
+   * Reads the whole image of a page from the file, decompressing it if it is
+   * stored compressed.  No bounds checking or verification is performed.
+   *
+   * @param page_number Number of page to read.
+   * @param page        Page to read into.
+   */
+  void readPageImage(const PageId page_number, Page& page) const;
+
+  /**
+   * Writes the whole image of a page to the file, compressed if this file
+   * compresses its pages and the page compresses well enough.  The image must
+   * already hold its checksum.
+   *
+   * @param page_number Number of page to write.
+   * @param image       Page image to write.
+   * @return  Number of bytes written.
+   */
+  std::size_t writePageImage(const PageId page_number, const Page& image);
+
+  /**
+   * Reads bytes from the given position in the file.  Every read of the file
+   * goes through here so that it is admitted by the IoScheduler, as a
+   * FOREGROUND_READ unless the calling thread has set another class.
+   *
+   * @param position  Byte offset in the file to read from.
+   * @param buffer    Buffer to read into.
+   * @param length    Number of bytes to read.
+   */
+  void readAt(const std::streampos position, char* buffer,
+              const std::size_t length) const;
+
+  /**
+   * Writes bytes to the given position in the file.  Every write of the file
+   * but the write-back of the cached header goes through here so that it is admitted by the IoScheduler, as a
+   * BACKGROUND_WRITE unless the calling thread has set another class, and
+   * logged first if there is a write-ahead log and the calling thread is not
+   * in a LoggedWriteScope.  The
+   * caller calls finishWrite() once the operation is complete.
+   *
+   * @param position  Byte offset in the file to write to.
+   * @param buffer    Bytes to write.
+   * @param length    Number of bytes to write.
+   */
+  void writeAt(const std::streampos position, const char* buffer,
+               const std::size_t length);
+
+  /**
+   * Logs <length> bytes about to be written at <position>, and forces the
+   * log, if there is a write-ahead log and the calling thread is not in a
+   * LoggedWriteScope.
+   */
+  void logWriteAhead(const std::streampos position, const char* buffer,
+                     const std::size_t length);
+
+  /**
+   * Returns the checksum of a page: a CRC32C of all of it but the checksum.
+   *
+   * @param page  Page to checksum.
+   */
+  virtual std::uint32_t computeChecksum(const Page& page) const;
+
+  /**
+   * Returns the OS handle of this file, reopening it if it was closed to make
+   * room for other handles, and marks it used.  The caller keeps
+   * the returned pointer for the duration of its I/O, so an eviction by
+   * another thread meanwhile only closes the handle once the I/O is done.
+   *
+   * @throws  FileNotFoundException   If the file can no longer be opened.
+   */
+  std::shared_ptr<IoHandle> acquireIoHandle() const;
+
+  /**
+   * Records that this file has unsynced writes.
+   */
+  void markUnsynced();
+
+  /**
+   * Ends an operation that wrote this file: records the unsynced writes, and
+   * syncs them under DURABILITY_PER_COMMIT.
+   */
+  void finishWrite();
+
+  struct OpenFile;
+
+  /**
+   * Opens the OS handle of a file with the current backend and puts it on the
+   * clock of open handles.  Must be called with the file's mutex held; the
+   * caller then calls evictHandles() once it has let go of it.
+   *
+   * @param file      File to open.
+   * @param truncate  Whether to create or empty the file.
+   */
+  static void openHandle(OpenFile& file, const bool truncate);
+
+  /**
+   * Closes the OS handle of a file and takes it off the clock.  Must be called
+   * with the file's mutex held.
+   *
+   * @param file  File to close.
+   */
+  static void closeHandle(OpenFile& file);
+
+  /**
+   * Closes handles not used recently until at most max_open_handles_ are
+   * open.  Must be called without any file's mutex held.
+   */
+  static void evictHandles();
+
+  /**
+   * Writes the cached header of a file to the file if it has changed.  Must be
+   * called with the file's mutex held.
+   *
+   * @param file  File whose header to write.
+   * @throws  IoErrorException  If the header cannot be written.
+   */
+  static void writeBackHeader(OpenFile& file);
+
+  /**
+   * @brief The pages of a PageFile's free-space map or page directory, in
+   *        chain order, so that the map page recording a page is found by
+   *        index rather than by walking the chain on disk.
+   */
+  struct MapChain {
+    /**
+     * Serializes changes to the map's pages, and protects the members below.
+     */
+    std::mutex mutex;
+
+    /**
+     * Whether pages and largest have been read from the file.
+     */
+    bool cached;
+
+    /**
+     * Numbers of the map pages, in chain order.
+     */
+    std::vector<PageId> pages;
+
+    /**
+     * For the free-space map, the largest bucket each map page records, or
+     * 255 until the page is read, so that a search skips pages without room.
+     */
+    std::vector<std::uint8_t> largest;
+  };
+
+  /**
+   * @brief Entry for a file in the registry, shared by all File objects for
+   *        the file.  Entries are made the first time a file is opened and
+   *        kept for good, so that File objects can point to theirs.
+   *
+   * Locks are taken in the order registry shard, file, clock_mutex_, and at
+   * most one file's mutex is held at a time.
+   */
+  struct OpenFile {
+    /**
+     * Protects the members below, but for in_clock and clock_position, which
+     * clock_mutex_ protects, and referenced.
+     */
+    std::mutex mutex;
+
+    /**
+     * Name of the file.
+     */
+    std::string filename;
+
+    /**
+     * Id of the file, see File::id().
+     */
+    std::uint32_t id;
+
+    /**
+     * Number of File objects referring to the file.
+     */
+    int open_count;
+
+    /**
+     * Number of scans between beginSequentialScan() and endSequentialScan().
+     */
+    int sequential_scans;
+
+    /**
+     * OS handle of the file, or null while it is closed.
+     */
+    std::shared_ptr<IoHandle> io;
+
+    /**
+     * Whether the file has been written since it was last synced.
+     */
+    bool unsynced;
+
+    /**
+     * Whether the file's pages store a checksum, once page_checksums_known.
+     */
+    bool page_checksums;
+
+    /**
+     * Whether the file's pages are stored compressed, once
+     * page_checksums_known.
+     */
+    bool page_compression;
+
+    /**
+     * Whether page_checksums and page_compression have been set, from the
+     * file header or when the file was created.
+     */
+    bool page_checksums_known;
+
+    /**
+     * Pages counted in the file header but not handed out yet by
+     * BlobFile::allocatePage(): extent_next up to but not including
+     * extent_end.
+     */
+    PageId extent_next;
+    PageId extent_end;
+
+    /**
+     * Whether the header of this BlobFile is known to list no free pages, so
+     * that allocatePage() can hand out a reserved page without reading it.
+     */
+    bool no_free_pages;
+
+    /**
+     * The file's header, once header_cached.  Shared by all File objects for
+     * the file, so that pages can be bounds-checked without reading it.
+     */
+    FileHeader header;
+    bool header_cached;
+
+    /**
+     * Whether header has changed since it was last written to the file.  It
+     * is written back by sync() and syncAll(), and before the OS handle is
+     * closed.
+     */
+    bool header_dirty;
+
+    /**
+     * Free-space map and page directory, if the file is a PageFile.
+     */
+    MapChain free_space_map;
+    MapChain page_directory;
+
+    /**
+     * Set whenever the handle is used, and cleared as the clock hand passes
+     * the file, which closes the handle if it has not been used since.
+     */
+    std::atomic<bool> referenced;
+
+    /**
+     * Whether the file is on the clock, and where, while its handle is open.
+     */
+    bool in_clock;
+    std::list<OpenFile*>::iterator clock_position;
+  };
+
+  /**
+   * @brief Part of the registry of files: the entries of the filenames that
+   *        hash to it.  Sharded so that opening files only contends with
+   *        opening files of the same shard.
+   */
+  struct RegistryShard {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<OpenFile> > files;
+  };
+
+  /**
+   * Number of shards of the registry.
+   */
+  static const std::size_t REGISTRY_SHARDS = 16;
+
+  /**
+   * Returns the shard of the registry a file belongs in.
+   */
+  static RegistryShard& shardFor(const std::string& filename);
+
+  /**
+   * Entries for all files ever opened.
+   */
+  static RegistryShard registry_[REGISTRY_SHARDS];
+
+  /**
+   * Files whose OS handle is open, and the clock hand sweeping them for one
+   * to close.
+   */
+  static std::list<OpenFile*> open_handles_;
+  static std::list<OpenFile*>::iterator clock_hand_;
+
+  /**
+   * Protects open_handles_ and clock_hand_.
+   */
+  static std::mutex clock_mutex_;
+
+  /**
+   * Maximum number of OS handles open at once.
+   */
+  static std::atomic<std::size_t> max_open_handles_;
+
+  /**
+   * Backend used to open OS handles.
+   */
+  static std::atomic<IoBackend> io_backend_;
+
+  /**
+   * Statistics of the handle cache.
+   */
+  static std::atomic<std::uint64_t> handle_hits_;
+  static std::atomic<std::uint64_t> handle_misses_;
+  static std::atomic<std::uint64_t> handle_evictions_;
+
+  /**
+   * Pages passed on to the OS with each advice, see pagesAdvised().
+   */
+  static std::atomic<std::uint64_t> pages_advised_[ADVICE_DONTNEED + 1];
+
+  /**
+   * Id of the next entry made in the registry.
+   */
+  static std::atomic<std::uint32_t> next_id_;
+
+  /**
+   * When writes are synced.
+   */
+  static std::atomic<DurabilityMode> durability_;
+
+  /**
+   * Write-ahead log, or NULL.
+   */
+  static std::atomic<LogManager*> log_manager_;
+
+  /**
+   * Whether files created from now on store page checksums.
+   */
+  static std::atomic<bool> page_checksums_;
 
   /**
-   * Streams for opened files.
+   * Whether files created from now on compress their pages.
    */
-  static StreamMap open_streams_;
+  static std::atomic<bool> page_compression_;
 
   /**
-   * Counts for opened files.
+   * Whether advisePages() passes its hints on to the OS.
    */
-  static CountMap open_counts_;
+  static std::atomic<bool> access_hints_;
 
   /**
    * Name of the file this object represents.
@@ -229,9 +914,9 @@ class File {
   std::string filename_;
 
   /**
-   * Stream for underlying filesystem object.
+   * Entry of the file this object represents.
    */
-  std::shared_ptr<std::fstream> stream_;
+  OpenFile* file_;
 
   friend class FileIterator;
 };
@@ -249,10 +934,9 @@ class PageFile : public File {
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
-	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
-	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * It first checks if the file is already open. If so, then the new File object created uses the same OS handle to read to or write fom
+	 * that already open file. Reference count (open_count in the file's entry in the registry) is incremented whenever an already open file is
+	 * opened again. Otherwise the UNIX file is actually opened and its handle is added to the cache of open handles.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -307,9 +991,21 @@ class PageFile : public File {
    * @return  The page.
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
+   * @throws  PageChecksumException If the page does not match its checksum.
    */
   Page readPage(const PageId page_number) const override;
 
+  /**
+   * Reads an existing page from the file straight into the given page.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   * @throws  PageChecksumException If the page does not match its checksum.
+   */
+  void readPageInto(const PageId page_number, Page& page) const override;
+
   /**
    * Writes a page into the file at the given page number.
    * No bounds checking is performed.
@@ -320,14 +1016,102 @@ class PageFile : public File {
   void writePage(const PageId page_number, const Page& new_page) override;
 
   /**
-   * Deletes a page from the file.
+   * Starts reading a page through <io> after checking that it exists.
+   *
+   * @throws  InvalidPageException  If the page doesn't exist in the file.
+   */
+  void readPageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                     void* tag) const override;
+
+  /**
+   * Starts writing a page through <io>.  As with writePage(), the next page
+   * pointer on disk is kept; it is copied into <page> before the write starts.
+   *
+   * @throws  InvalidPageException  If the page has been deleted.
+   */
+  void writePageAsync(AsyncIo& io, const PageId page_number, Page& page,
+                      void* tag) override;
+
+  /**
+   * Checks the checksum of a page read by readPageAsync(), and that the page
+   * is currently used.
+   *
+   * @throws  PageChecksumException If the page does not match its checksum.
+   * @throws  InvalidPageException  If the page is not currently used.
+   */
+  void verifyPage(const PageId page_number, const Page& page) const override;
+
+  /**
+   * Writes only the given sectors of a page into the file.
+   *
+   * @param page_number Number of page whose contents to replace.
+   * @param new_page    Page holding the new contents.
+   * @param sectors     Sectors of the page to write.
+   * @return  Number of bytes written.
+   */
+  std::size_t writePageSectors(const PageId page_number, const Page& new_page,
+                               const SectorMask& sectors) override;
+
+  /**
+   * Deletes a page from the file.  The used list is linked both ways, so this
+   * takes the same few page writes wherever the page is in the file.
    *
    * @param page_number   Number of page to delete.
    */
   void deletePage(const PageId page_number) override;
 
   /**
-   * Returns an iterator at the first page in the file.
+   * Size in bytes of the free space buckets recorded in the free-space map.  A
+   * page is recorded as having its free space / FSM_BUCKET_SIZE buckets free,
+   * rounded down and at most 255, so the buckets cover a whole page.
+   */
+  static const std::size_t FSM_BUCKET_SIZE = Page::SIZE / 256;
+
+  /**
+   * Number of pages whose free space one page of the free-space map records.
+   */
+  static const std::size_t FSM_PAGES_PER_MAP_PAGE = (Page::DATA_SIZE + 1) / 2;
+
+  /**
+   * Number of pages whose use one page of the page directory records, a bit
+   * each in whole 64-bit words.
+   */
+  static const std::size_t DIRECTORY_PAGES_PER_MAP_PAGE =
+      Page::DATA_SIZE / 8 * 64;
+
+  /**
+   * Inserts a record into a page of the file that has room for it, found with
+   * the free-space map, or into a new page if none has.  Pages with room left
+   * by deleted records are filled before the file grows.
+   *
+   * @param record_data  Bytes that compose the record.
+   * @return  ID of the newly inserted record.
+   * @throws  InsufficientSpaceException  If the record does not fit in a page.
+   */
+  RecordId insertRecord(const std::string& record_data);
+
+  /**
+   * Returns the numbers of the used pages in the file in increasing order,
+   * read from the page directory without reading the pages themselves.
+   *
+   * @return  Numbers of used pages.
+   */
+  std::vector<PageId> usedPages() const;
+
+  /**
+   * Splits the used pages of the file into <parts> ranges of consecutive
+   * pages, as even in size as they can be, for example to scan the file from
+   * several threads.  Ranges are empty if there are fewer pages than parts.
+   *
+   * @param parts   Number of ranges.
+   * @return  Iterators at the first page of each range and after its last.
+   */
+  std::vector<std::pair<FileIterator, FileIterator> > partition(
+      const std::size_t parts);
+
+  /**
+   * Returns an iterator at the first page in the file.  Pages are visited in
+   * increasing order of page number.
    *
    * @return  Iterator at first page of file.
    */
@@ -341,22 +1125,18 @@ class PageFile : public File {
    */
   FileIterator end();
 
- private:
+ protected:
 
   /**
-   * Reads a page from the file.  If <allow_free> is not set, an exception
-   * will be thrown if the page read from disk is not currently in use.
-   *
-   * No bounds checking is performed; the underlying file stream will throw
-   * an exception if the page is past the end of the file.
+   * Returns the checksum of a page, leaving out the used list pointers: those
+   * are updated on disk without rewriting the rest of the page (see
+   * writePage()).
    *
-   * @param page_number   Number of page to read.
-   * @param allow_free    Whether to allow reading a free (unused) page.
-   * @return  The page.
-   * @throws  InvalidPageException  If the page is free (unused) and
-   *                                allow_free is false.
+   * @param page  Page to checksum.
    */
-  Page readPage(const PageId page_number, const bool allow_free) const;
+  std::uint32_t computeChecksum(const Page& page) const override;
+
+ private:
 
   /**
    * Writes a page into the file at the given page number with the given header.
@@ -379,11 +1159,111 @@ class PageFile : public File {
    */
   PageHeader readPageHeader(const PageId page_number) const;
 
+  /**
+   * Writes only the header of the given page to disk, leaving the record data
+   * and slot table untouched.  No bounds checking is performed.
+   *
+   * @param page_number   Number of page whose header is to be written.
+   * @param header        Header to write.
+   */
+  void writePageHeader(const PageId page_number, const PageHeader& header);
+
+  /**
+   * Reads the pages of the map starting at <first_map_page> into <chain>, if
+   * they have not been read yet.  Must be called with the chain's mutex held.
+   *
+   * @param chain           Free-space map or page directory of the file.
+   * @param first_map_page  First page of the map.
+   */
+  void loadMapChain(MapChain& chain, const PageId first_map_page) const;
+
+  /**
+   * Adds a page to the end of the file for the free-space map or the page
+   * directory, chained after the last page of <chain>.  Must be called with
+   * the chain's mutex held.  The caller writes <header> back.
+   *
+   * @param header          Header of the file.
+   * @param first_map_page  First page of the map, set if there is none yet.
+   * @param chain           Free-space map or page directory of the file.
+   */
+  void appendMapPage(FileHeader& header, PageId& first_map_page,
+                     MapChain& chain);
+
+  /**
+   * Returns the number of the page of the page directory that records the
+   * given page, or Page::INVALID_NUMBER if the directory does not reach it.
+   *
+   * @param page_number   Number of page recorded.
+   */
+  PageId findDirectoryPage(const PageId page_number) const;
+
+  /**
+   * Records in the page directory whether a page is used.
+   *
+   * @param page_number   Number of page.
+   * @param used          Whether it is used.
+   */
+  void setPageUsed(const PageId page_number, const bool used);
+
+  /**
+   * Returns the free-space map bucket of a page with <free_space> bytes free.
+   */
+  static std::uint8_t freeSpaceBucket(const std::size_t free_space);
+
+  /**
+   * Returns the number of the page of the free-space map that records the
+   * given page, or Page::INVALID_NUMBER if the map does not reach it.
+   *
+   * @param page_number   Number of page recorded.
+   */
+  PageId findMapPage(const PageId page_number) const;
+
+  /**
+   * Reads a page of the free-space map.  A map page that fails its checksum
+   * is read as empty; the map is only a hint and fills in again as pages are
+   * written.
+   *
+   * @param map_page_number   Number of the map page.
+   * @param map_page          Page to read into.
+   */
+  void readMapPage(const PageId map_page_number, Page& map_page) const;
+
+  /**
+   * Records the free space bucket of a page in the free-space map.
+   *
+   * @param page_number   Number of page.
+   * @param bucket        Its free space bucket.
+   */
+  void setFreeSpace(const PageId page_number, const std::uint8_t bucket);
+
+  /**
+   * Records the free space of a page being written in the free-space map, if
+   * its bucket differs from that of the page on disk.
+   *
+   * @param page_number   Number of page.
+   * @param old_header    Header of the page on disk.
+   * @param new_page      Page being written.
+   */
+  void noteFreeSpace(const PageId page_number, const PageHeader& old_header,
+                     const Page& new_page);
+
+  /**
+   * Returns the number of a page recorded in the free-space map as having at
+   * least <bucket> buckets free, or Page::INVALID_NUMBER if there is none.
+   */
+  PageId findFreeSpace(const std::uint8_t bucket) const;
+
   friend class FileIterator;
 };
 
 class BlobFile : public File {
  public:
+  /**
+   * Smallest and largest number of pages reserved at once by allocatePage().
+   * Each reservation is as large as the file already is, within these bounds.
+   */
+  static const PageId MIN_EXTENT_PAGES = 64;
+  static const PageId MAX_EXTENT_PAGES = 1024;
 
   /**
    * Creates a new BlobFile.
@@ -395,10 +1275,9 @@ class BlobFile : public File {
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
-	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
-	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * It first checks if the file is already open. If so, then the new File object created uses the same OS handle to read to or write fom
+	 * that already open file. Reference count (open_count in the file's entry in the registry) is incremented whenever an already open file is
+	 * opened again. Otherwise the UNIX file is actually opened and its handle is added to the cache of open handles.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -444,6 +1323,12 @@ class BlobFile : public File {
   /**
    * Allocates a new page in the file.
    *
+   * Pages deleted with deletePage() are reused first, most recently deleted
+   * first.  Otherwise pages are reserved in extents: when the pages reserved
+   * so far have all been handed out, the next extent is allocated on disk in
+   * one go and counted in the file header with a single write.  Handing out a
+   * reserved page does no I/O; it reads as zeros until it is written.
+   *
    * @return The new page.
    */
   Page allocatePage(PageId &new_page_number) override;
@@ -455,9 +1340,29 @@ class BlobFile : public File {
    * @return  The page.
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
+   * @throws  PageChecksumException If the page does not match its checksum.
    */
   Page readPage(const PageId page_number) const override;
 
+  /**
+   * Checks the checksum of a page, if the file has them.  A page allocated
+   * but never written is all zeros and passes.
+   *
+   * @throws  PageChecksumException If the page does not match its checksum.
+   */
+  void verifyPage(const PageId page_number, const Page& page) const override;
+
+  /**
+   * Reads an existing page from the file straight into the given page.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   * @throws  PageChecksumException If the page does not match its checksum.
+   */
+  void readPageInto(const PageId page_number, Page& page) const override;
+
   /**
    * Writes a page into the file at the given page number.
    * No bounds checking is performed.
@@ -468,11 +1373,38 @@ class BlobFile : public File {
   void writePage(const PageId page_number, const Page& new_page) override;
 
   /**
-   * Deletes a page from the file.
+   * Writes only the given sectors of a page into the file.
+   *
+   * @param page_number Number of page whose contents to replace.
+   * @param new_page    Page holding the new contents.
+   * @param sectors     Sectors of the page to write.
+   * @return  Number of bytes written.
+   */
+  std::size_t writePageSectors(const PageId page_number, const Page& new_page,
+                               const SectorMask& sectors) override;
+
+  /**
+   * Deletes a page from the file, putting it on the file's list of free
+   * pages.  The page's first bytes link it to the next free page.  Deleting
+   * a page that is already free is undefined.
    *
    * @param page_number   Number of page to delete.
+   * @throws  InvalidPageException  If the page is not in the file, or is
+   *                                reserved by allocatePage() but has not
+   *                                been handed out yet.
    */
   void deletePage(const PageId page_number) override;
+
+  /**
+   * Gives the free pages at the end of the file back to the filesystem,
+   * along with the pages reserved but not handed out yet, and shortens the
+   * file.  The list of free pages has to be walked, so this is meant to be
+   * run now and then rather than after every delete.  No page past the new
+   * end may be in a buffer pool.
+   *
+   * @return  Number of pages given back.
+   */
+  PageId truncateFreeTail();
 };
 
 }
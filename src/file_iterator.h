@@ -7,7 +7,10 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <memory>
+#include <vector>
 #include "file.h"
 #include "page.h"
 #include "types.h"
@@ -18,7 +21,9 @@ namespace badgerdb {
  * @brief Iterator for iterating over the pages in a file.
  *
  * This class provides a forward-only iterator for iterating over all of the
- * pages in a file.
+ * pages in a file, in increasing order of page number.  The used pages are
+ * taken from the file's page directory when the iterator is created, so
+ * advancing it reads nothing from the file.
  */
 class FileIterator {
  public:
@@ -27,6 +32,7 @@ class FileIterator {
    */
   FileIterator()
       : file_(NULL),
+        position_(0),
         current_page_number_(Page::INVALID_NUMBER) {
   }
 
@@ -37,22 +43,47 @@ class FileIterator {
    * @param file  File to iterate over.
    */
   FileIterator(PageFile* file)
-      : file_(file) {
+      : file_(file),
+        pages_(new std::vector<PageId>(file->usedPages())),
+        position_(0) {
     assert(file_ != NULL);
-    const FileHeader& header = file_->readHeader();
-    current_page_number_ = header.first_used_page;
+    setCurrentPage();
   }
 
   /**
    * Constructs an iterator over the pages in a file, starting at the given
-   * page number.
+   * page number, or at the first used page after it if it is not used.
    *
    * @param file        File to iterate over.
    * @param page_number Number of page to start iterator at.
    */
   FileIterator(PageFile* file, PageId page_number)
       : file_(file),
+        position_(0),
         current_page_number_(page_number) {
+    if (page_number != Page::INVALID_NUMBER) {
+      pages_.reset(new std::vector<PageId>(file->usedPages()));
+      position_ = std::lower_bound(pages_->begin(), pages_->end(), page_number)
+          - pages_->begin();
+      setCurrentPage();
+    }
+  }
+
+  /**
+   * Constructs an iterator at a position in a list of the used pages of a
+   * file, shared with other iterators.
+   *
+   * @param file      File to iterate over.
+   * @param pages     Numbers of the used pages of the file, in order.
+   * @param position  Index in <pages> of the page to start iterator at.
+   */
+  FileIterator(PageFile* file,
+               const std::shared_ptr<const std::vector<PageId> >& pages,
+               std::size_t position)
+      : file_(file),
+        pages_(pages),
+        position_(position) {
+    setCurrentPage();
   }
 
   /**
@@ -60,8 +91,8 @@ class FileIterator {
    */
 	inline FileIterator& operator++() {
     assert(file_ != NULL);
-    const PageHeader& header = file_->readPageHeader(current_page_number_);
-    current_page_number_ = header.next_page_number;
+    ++position_;
+    setCurrentPage();
 
 		return *this;
 	}
@@ -72,8 +103,8 @@ class FileIterator {
 		FileIterator tmp = *this;   // copy ourselves
 
     assert(file_ != NULL);
-    const PageHeader& header = file_->readPageHeader(current_page_number_);
-    current_page_number_ = header.next_page_number;
+    ++position_;
+    setCurrentPage();
 
 		return tmp;
 	}
@@ -103,12 +134,38 @@ class FileIterator {
 	inline Page operator*() const
   { return file_->readPage(current_page_number_); }
 
+  /**
+   * Returns the number of the current page without reading it.
+   *
+   * @return  Number of page iterator is pointing to.
+   */
+	inline PageId getCurrentPage() const
+  { return current_page_number_; }
+
  private:
+  /**
+   * Sets the current page number from the position in the used pages.
+   */
+  void setCurrentPage() {
+    current_page_number_ = pages_ && position_ < pages_->size() ?
+        (*pages_)[position_] : Page::INVALID_NUMBER;
+  }
+
   /**
    * File we're iterating over.
    */
   PageFile* file_;
 
+  /**
+   * Numbers of the used pages of the file, in order, when iteration started.
+   */
+  std::shared_ptr<const std::vector<PageId> > pages_;
+
+  /**
+   * Index in pages_ of the page iterator is currently pointing to.
+   */
+  std::size_t position_;
+
   /**
    * Number of page in file iterator is currently pointing to.
    */
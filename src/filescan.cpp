@@ -10,6 +10,9 @@
 
 namespace badgerdb { 
 
+// Pages scanned are dropped from the OS cache this many at a time.
+static const PageId DROP_BEHIND = 64;
+
 FileScan::FileScan(const std::string &name, BufMgr *bufferMgr)
 {
   file = new PageFile(name, false);	//dont create new file
@@ -17,6 +20,11 @@ FileScan::FileScan(const std::string &name, BufMgr *bufferMgr)
 	curDirtyFlag = false;
   curPage = NULL;
 	filePageIter = file->begin();
+
+  // the OS reads further ahead for a scan in file order, and pages scanned
+  // are not read again soon
+  file->beginSequentialScan();
+  dropFrom = 1;
 }
 
 FileScan::~FileScan()
@@ -24,12 +32,13 @@ FileScan::~FileScan()
   // generally must unpin last page of the scan
   if (curPage != NULL)
   {
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
+    bufMgr->unPinPage(file, filePageIter.getCurrentPage(), curDirtyFlag);
     curPage = NULL;
 		curDirtyFlag = false;
     filePageIter = file->begin();
   }
   bufMgr->flushFile(file);
+  file->endSequentialScan();
   delete file;
 }
 
@@ -53,7 +62,7 @@ void FileScan::scanNext(RecordId& outRid)
 		}
 	 
 		// read the first page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage); 
+    bufMgr->readPage(file, filePageIter.getCurrentPage(), curPage); 
 		curDirtyFlag = false;
 
 		// get the first record off the page
@@ -76,7 +85,7 @@ void FileScan::scanNext(RecordId& outRid)
   while (pageRecordIter == curPage->end())
   {
     // unpin the current page
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
+    bufMgr->unPinPage(file, filePageIter.getCurrentPage(), curDirtyFlag);
     curPage = NULL;
     curDirtyFlag = false;
 
@@ -87,8 +96,16 @@ void FileScan::scanNext(RecordId& outRid)
 			throw EndOfFileException();
     }
 
+    // keep the pages scanned from crowding the OS cache
+    const PageId pageNo = filePageIter.getCurrentPage();
+    if (pageNo >= dropFrom + DROP_BEHIND)
+    {
+      file->advisePages(dropFrom, pageNo - dropFrom, ADVICE_DONTNEED);
+      dropFrom = pageNo;
+    }
+
     // read the next page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage);
+    bufMgr->readPage(file, filePageIter.getCurrentPage(), curPage);
 
     // get the first record off the page
     pageRecordIter = curPage->begin(); 
@@ -60,6 +60,9 @@ class FileScan
    * True if page has been updated
    */
   bool  	      curDirtyFlag;
+
+  // first page scanned that the OS has not been told to drop from its cache
+  PageId        dropFrom;
 };
 
 }
@@ -0,0 +1,482 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "io_handle.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exceptions/io_error_exception.h"
+
+namespace badgerdb {
+
+IoHandle* IoHandle::open(const IoBackend backend, const std::string& filename,
+                         const bool truncate)
+{
+  if (backend == MMAP_BACKEND)
+  {
+    MmapIoHandle* handle = new MmapIoHandle(filename, truncate);
+    if (handle->isOpen())
+      return handle;
+    delete handle;
+  }
+  else if (backend == DIRECT_BACKEND)
+  {
+    DirectIoHandle* handle = new DirectIoHandle(filename, truncate);
+    if (handle->isOpen())
+      return handle;
+    delete handle;
+  }
+  else if (backend == POSIX_BACKEND)
+  {
+    PosixIoHandle* handle = new PosixIoHandle(filename, truncate);
+    if (handle->isOpen())
+      return handle;
+    delete handle;
+  }
+  else
+  {
+    StreamIoHandle* handle = new StreamIoHandle(filename, truncate);
+    if (handle->isOpen())
+      return handle;
+    delete handle;
+  }
+  return NULL;
+}
+
+//----------------------------------------
+// StreamIoHandle
+//----------------------------------------
+
+StreamIoHandle::StreamIoHandle(const std::string& filename, const bool truncate)
+  : IoHandle(filename)
+{
+  std::ios_base::openmode mode =
+      std::fstream::in | std::fstream::out | std::fstream::binary;
+  if (truncate)
+    mode = mode | std::fstream::trunc;
+  stream_.open(filename, mode);
+}
+
+void StreamIoHandle::read(const off_t offset, char* buffer, const std::size_t length)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream_.seekg(offset, std::ios::beg);
+  stream_.read(buffer, length);
+  if (stream_.bad())
+    throw IoErrorException(filename_, "read failed");
+  if (stream_.gcount() < (std::streamsize)length)
+  {
+    // Ran into the end of the file.
+    memset(buffer + stream_.gcount(), 0, length - stream_.gcount());
+    stream_.clear();
+  }
+}
+
+void StreamIoHandle::write(const off_t offset, const char* buffer, const std::size_t length)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream_.seekp(offset, std::ios::beg);
+  stream_.write(buffer, length);
+  if (!stream_)
+    throw IoErrorException(filename_, "write failed");
+}
+
+void StreamIoHandle::truncate(const off_t length)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The stream does not expose its descriptor, so the file is truncated by
+  // name once the stream has handed over what it buffered.
+  stream_.flush();
+  if (!stream_ || ::truncate(filename_.c_str(), length) != 0)
+    throw IoErrorException(filename_, stream_ ? strerror(errno) : "write failed");
+}
+
+void StreamIoHandle::flush()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream_.flush();
+}
+
+void StreamIoHandle::sync()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream_.flush();
+  if (!stream_)
+    throw IoErrorException(filename_, "write failed");
+
+  // The stream does not expose its descriptor; any descriptor of the file
+  // syncs all of its data.
+  int fd = ::open(filename_.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw IoErrorException(filename_, strerror(errno));
+  int rc;
+  while ((rc = fdatasync(fd)) != 0 && errno == EINTR)
+    ;
+  const int error = errno;
+  ::close(fd);
+  if (rc != 0)
+    throw IoErrorException(filename_, strerror(error));
+}
+
+//----------------------------------------
+// PosixIoHandle
+//----------------------------------------
+
+PosixIoHandle::PosixIoHandle(const std::string& filename, const bool truncate,
+                             const int flags)
+  : IoHandle(filename)
+{
+  int open_flags = O_RDWR | flags;
+  if (truncate)
+    open_flags |= O_CREAT | O_TRUNC;
+  fd_ = ::open(filename.c_str(), open_flags, 0644);
+}
+
+PosixIoHandle::~PosixIoHandle()
+{
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+void PosixIoHandle::read(const off_t offset, char* buffer, const std::size_t length)
+{
+  std::size_t done = 0;
+  while (done < length)
+  {
+    ssize_t n = ::pread(fd_, buffer + done, length - done, offset + done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      throw IoErrorException(filename_, strerror(errno));
+    }
+    if (n == 0)
+    {
+      // Ran into the end of the file.
+      memset(buffer + done, 0, length - done);
+      break;
+    }
+    done += n;
+  }
+}
+
+void PosixIoHandle::write(const off_t offset, const char* buffer, const std::size_t length)
+{
+  std::size_t done = 0;
+  while (done < length)
+  {
+    ssize_t n = ::pwrite(fd_, buffer + done, length - done, offset + done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      throw IoErrorException(filename_, strerror(errno));
+    }
+    done += n;
+  }
+}
+
+void PosixIoHandle::allocate(const off_t offset, const std::size_t length)
+{
+  int rc;
+  while ((rc = fallocate(fd_, 0, offset, length)) != 0 && errno == EINTR)
+    ;
+  if (rc != 0 && errno == EOPNOTSUPP)
+  {
+    // The filesystem cannot reserve blocks; growing the file is all that
+    // matters, and the blocks are allocated as they are written.
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+      throw IoErrorException(filename_, strerror(errno));
+    rc = 0;
+    if (st.st_size < offset + (off_t)length)
+      rc = ftruncate(fd_, offset + length);
+  }
+  if (rc != 0)
+    throw IoErrorException(filename_, strerror(errno));
+}
+
+void PosixIoHandle::punchHole(const off_t offset, const std::size_t length)
+{
+  int rc;
+  while ((rc = fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                         offset, length)) != 0 && errno == EINTR)
+    ;
+  if (rc != 0 && errno != EOPNOTSUPP)
+    throw IoErrorException(filename_, strerror(errno));
+}
+
+void PosixIoHandle::advise(const off_t offset, const std::size_t length,
+                           const AccessAdvice advice)
+{
+  static const int FADVICE[] = {POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL,
+                                POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED,
+                                POSIX_FADV_DONTNEED};
+  posix_fadvise(fd_, offset, length, FADVICE[advice]);
+}
+
+void PosixIoHandle::truncate(const off_t length)
+{
+  int rc;
+  while ((rc = ftruncate(fd_, length)) != 0 && errno == EINTR)
+    ;
+  if (rc != 0)
+    throw IoErrorException(filename_, strerror(errno));
+}
+
+void PosixIoHandle::sync()
+{
+  int rc;
+  while ((rc = fdatasync(fd_)) != 0 && errno == EINTR)
+    ;
+  if (rc != 0)
+    throw IoErrorException(filename_, strerror(errno));
+}
+
+//----------------------------------------
+// DirectIoHandle
+//----------------------------------------
+
+static bool isAligned(const std::uint64_t value)
+{
+  return value % DirectIoHandle::ALIGNMENT == 0;
+}
+
+// Aligned scratch space for a transfer that is not aligned itself
+struct BounceBuffer
+{
+  explicit BounceBuffer(const std::size_t length)
+  {
+    void* memory;
+    if (posix_memalign(&memory, DirectIoHandle::ALIGNMENT, length) != 0)
+      throw std::bad_alloc();
+    bytes = static_cast<char*>(memory);
+  }
+
+  ~BounceBuffer() { free(bytes); }
+
+  char* bytes;
+};
+
+DirectIoHandle::DirectIoHandle(const std::string& filename, const bool truncate)
+  : PosixIoHandle(filename, truncate, O_DIRECT)
+{
+}
+
+void DirectIoHandle::readAligned(const off_t offset, char* buffer, const std::size_t length)
+{
+  std::size_t done = 0;
+  while (done < length)
+  {
+    ssize_t n = ::pread(fd_, buffer + done, length - done, offset + done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      throw IoErrorException(filename_, strerror(errno));
+    }
+    done += n;
+    if (n == 0 || !isAligned(done))
+    {
+      // Ran into the end of the file, which need not be at a block boundary.
+      memset(buffer + done, 0, length - done);
+      break;
+    }
+  }
+}
+
+void DirectIoHandle::read(const off_t offset, char* buffer, const std::size_t length)
+{
+  if (isAligned(offset) && isAligned(length)
+      && isAligned(reinterpret_cast<std::uintptr_t>(buffer)))
+  {
+    readAligned(offset, buffer, length);
+    return;
+  }
+  const off_t start = offset - offset % ALIGNMENT;
+  const off_t end = offset + length;
+  const std::size_t span = (end - start + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  BounceBuffer bounce(span);
+  readAligned(start, bounce.bytes, span);
+  memcpy(buffer, bounce.bytes + (offset - start), length);
+}
+
+void DirectIoHandle::write(const off_t offset, const char* buffer, const std::size_t length)
+{
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  if (isAligned(offset) && isAligned(length)
+      && isAligned(reinterpret_cast<std::uintptr_t>(buffer)))
+  {
+    PosixIoHandle::write(offset, buffer, length);
+    return;
+  }
+  const off_t start = offset - offset % ALIGNMENT;
+  const off_t end = offset + length;
+  const std::size_t span = (end - start + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  BounceBuffer bounce(span);
+  // Only the blocks the write covers in part keep bytes from the file.
+  if (start != offset)
+    readAligned(start, bounce.bytes, ALIGNMENT);
+  if (!isAligned(end) && (span > ALIGNMENT || start == offset))
+    readAligned(start + span - ALIGNMENT, bounce.bytes + span - ALIGNMENT, ALIGNMENT);
+  memcpy(bounce.bytes + (offset - start), buffer, length);
+  PosixIoHandle::write(start, bounce.bytes, span);
+}
+
+//----------------------------------------
+// MmapIoHandle
+//----------------------------------------
+
+// Smallest mapping made, so that small files are not remapped on every append
+static const std::size_t MIN_MAPPING = 1 << 20;
+
+MmapIoHandle::MmapIoHandle(const std::string& filename, const bool truncate)
+  : PosixIoHandle(filename, truncate), map_(NULL), capacity_(0), size_(0)
+{
+  pthread_rwlock_init(&lock_, NULL);
+  if (fd_ >= 0)
+    refreshMapping();
+}
+
+MmapIoHandle::~MmapIoHandle()
+{
+  if (map_ != NULL)
+    munmap(map_, capacity_);
+  pthread_rwlock_destroy(&lock_);
+}
+
+void MmapIoHandle::refreshMapping()
+{
+  struct stat st;
+  if (fstat(fd_, &st) != 0)
+    throw IoErrorException(filename_, strerror(errno));
+  size_ = st.st_size;
+  if ((std::size_t)size_ <= capacity_ && map_ != NULL)
+    return;
+
+  std::size_t capacity = capacity_ > MIN_MAPPING ? capacity_ : MIN_MAPPING;
+  while (capacity < (std::size_t)size_)
+    capacity *= 2;
+  if (map_ != NULL)
+    munmap(map_, capacity_);
+  // Mapping past the end of the file is allowed as long as that part is not
+  // touched; reads stay below size_.
+  void* map = mmap(NULL, capacity, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED)
+  {
+    map_ = NULL;
+    capacity_ = 0;
+    throw IoErrorException(filename_, strerror(errno));
+  }
+  map_ = static_cast<char*>(map);
+  capacity_ = capacity;
+}
+
+void MmapIoHandle::read(const off_t offset, char* buffer, const std::size_t length)
+{
+  pthread_rwlock_rdlock(&lock_);
+  if (offset + (off_t)length <= size_)
+  {
+    memcpy(buffer, map_ + offset, length);
+    pthread_rwlock_unlock(&lock_);
+    return;
+  }
+  pthread_rwlock_unlock(&lock_);
+
+  // The file may have been extended through another handle since we last
+  // looked.
+  pthread_rwlock_wrlock(&lock_);
+  try
+  {
+    refreshMapping();
+  }
+  catch (...)
+  {
+    pthread_rwlock_unlock(&lock_);
+    throw;
+  }
+  std::size_t available = 0;
+  if (offset < size_)
+    available = std::min<off_t>(length, size_ - offset);
+  memcpy(buffer, map_ + offset, available);
+  // Ran into the end of the file.
+  memset(buffer + available, 0, length - available);
+  pthread_rwlock_unlock(&lock_);
+}
+
+void MmapIoHandle::advise(const off_t offset, const std::size_t length,
+                          const AccessAdvice advice)
+{
+  // Reads fault pages into the mapping, which has its own readahead; the
+  // page cache behind it takes the hint as well.
+  static const int MADVICE[] = {MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM,
+                                MADV_WILLNEED, MADV_DONTNEED};
+  pthread_rwlock_rdlock(&lock_);
+  if (map_ != NULL && offset < size_)
+  {
+    const off_t page_size = sysconf(_SC_PAGESIZE);
+    const off_t start = offset / page_size * page_size;
+    off_t end = size_;
+    if (length > 0 && offset + (off_t)length < end)
+      end = offset + length;
+    madvise(map_ + start, end - start, MADVICE[advice]);
+  }
+  pthread_rwlock_unlock(&lock_);
+  PosixIoHandle::advise(offset, length, advice);
+}
+
+void MmapIoHandle::truncate(const off_t length)
+{
+  // Reads must stop at the new end at once: touching the mapping past the
+  // end of the file raises SIGBUS.
+  pthread_rwlock_wrlock(&lock_);
+  try
+  {
+    PosixIoHandle::truncate(length);
+    refreshMapping();
+  }
+  catch (...)
+  {
+    pthread_rwlock_unlock(&lock_);
+    throw;
+  }
+  pthread_rwlock_unlock(&lock_);
+}
+
+void MmapIoHandle::write(const off_t offset, const char* buffer, const std::size_t length)
+{
+  PosixIoHandle::write(offset, buffer, length);
+
+  pthread_rwlock_rdlock(&lock_);
+  const bool grown = offset + (off_t)length > size_;
+  pthread_rwlock_unlock(&lock_);
+  if (grown)
+  {
+    pthread_rwlock_wrlock(&lock_);
+    try
+    {
+      refreshMapping();
+    }
+    catch (...)
+    {
+      pthread_rwlock_unlock(&lock_);
+      throw;
+    }
+    pthread_rwlock_unlock(&lock_);
+  }
+}
+
+}
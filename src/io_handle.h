@@ -0,0 +1,311 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace badgerdb {
+
+/**
+ * @brief Ways of doing file I/O that a File can use.
+ */
+enum IoBackend
+{
+	STREAM_BACKEND,	/* std::fstream; one seek and transfer at a time */
+	POSIX_BACKEND,	/* pread/pwrite on a file descriptor; transfers at different
+									   offsets may run concurrently */
+	MMAP_BACKEND,		/* reads copy straight out of a shared mapping of the file;
+									   writes use pwrite.  Best for read-mostly files */
+	DIRECT_BACKEND	/* pread/pwrite with O_DIRECT, bypassing the OS page cache so
+									   that pages are only cached in the buffer pool */
+};
+
+/**
+ * @brief How a range of a file is going to be read, for the OS to adjust its
+ *        readahead and caching to.
+ */
+enum AccessAdvice
+{
+	ADVICE_NORMAL,			/* no particular order, as by default */
+	ADVICE_SEQUENTIAL,	/* in ascending order; read further ahead */
+	ADVICE_RANDOM,			/* in no particular order; do not read ahead */
+	ADVICE_WILLNEED,		/* soon; start reading it into the cache now */
+	ADVICE_DONTNEED			/* not again soon; drop it from the cache */
+};
+
+/**
+ * @brief An open OS file that can be read and written at given offsets.
+ *
+ * A handle is shared by all File objects for the same file and may be used
+ * from several threads at once.
+ */
+class IoHandle
+{
+ public:
+	/**
+	 * Opens a handle of the given backend.
+	 *
+	 * @param backend		Backend to use.
+	 * @param filename	Name of the file.
+	 * @param truncate	Whether to create the file, or empty it if it exists.
+	 * @return	The handle, or null if the file could not be opened.
+	 */
+  static IoHandle* open(const IoBackend backend, const std::string& filename,
+                        const bool truncate);
+
+	/**
+	 * Closes the file.
+	 */
+  virtual ~IoHandle() {}
+
+	/**
+	 * Reads <length> bytes at <offset>.  Bytes past the end of the file are
+	 * read as zeros.
+	 *
+	 * @throws  IoErrorException  If the read fails.
+	 */
+  virtual void read(const off_t offset, char* buffer, const std::size_t length) = 0;
+
+	/**
+	 * Writes <length> bytes at <offset>, growing the file if needed.
+	 *
+	 * @throws  IoErrorException  If the write fails.
+	 */
+  virtual void write(const off_t offset, const char* buffer, const std::size_t length) = 0;
+
+	/**
+	 * Reserves disk space for <length> bytes at <offset>, growing the file if
+	 * needed, so that writing them later does not have to allocate blocks one
+	 * at a time.  The reserved bytes read as zeros until written.  Does nothing
+	 * by default.
+	 *
+	 * @throws  IoErrorException  If the space cannot be reserved.
+	 */
+  virtual void allocate(const off_t offset, const std::size_t length) {}
+
+	/**
+	 * Gives the disk space of <length> bytes at <offset> back to the
+	 * filesystem without changing the size of the file; the bytes read as
+	 * zeros afterwards.  Does nothing by default, or where the filesystem
+	 * cannot do it, as the space is only an optimization.
+	 *
+	 * @throws  IoErrorException  If the space cannot be given back.
+	 */
+  virtual void punchHole(const off_t offset, const std::size_t length) {}
+
+	/**
+	 * Tells the OS how the <length> bytes at <offset> are going to be read, 0
+	 * bytes standing for the rest of the file.  SEQUENTIAL and RANDOM hold for
+	 * all later reads through the handle.  Does nothing by default, and errors
+	 * are ignored, as hints only change performance.
+	 */
+  virtual void advise(const off_t offset, const std::size_t length,
+                      const AccessAdvice advice) {}
+
+	/**
+	 * Cuts the file down to <length> bytes, giving the space past it back to
+	 * the filesystem.
+	 *
+	 * @throws  IoErrorException  If the file cannot be truncated.
+	 */
+  virtual void truncate(const off_t length) = 0;
+
+	/**
+	 * Hands writes buffered by the handle to the OS.
+	 */
+  virtual void flush() = 0;
+
+	/**
+	 * Flushes the handle and waits until the OS has written its data to disk.
+	 *
+	 * @throws  IoErrorException  If the data could not be written.
+	 */
+  virtual void sync() = 0;
+
+	/**
+	 * Returns the file descriptor for use with asynchronous I/O, or -1 if the
+	 * handle does not have one.
+	 */
+  virtual int fd() const { return -1; }
+
+	/**
+	 * Returns the alignment the kernel needs of the buffer, offset and length of
+	 * a transfer made on fd(), 1 if none.  read() and write() take any.
+	 */
+  virtual std::size_t alignment() const { return 1; }
+
+	/**
+	 * Returns the name of the file.
+	 */
+  const std::string& filename() const { return filename_; }
+
+ protected:
+  explicit IoHandle(const std::string& filename) : filename_(filename) {}
+
+	/**
+   * Name of the file, for error messages
+	 */
+  const std::string filename_;
+};
+
+/**
+ * @brief IoHandle doing I/O through a std::fstream.  The stream has a single
+ *        position, so transfers are serialized.
+ */
+class StreamIoHandle : public IoHandle
+{
+ public:
+  StreamIoHandle(const std::string& filename, const bool truncate);
+
+  bool isOpen() const { return stream_.is_open(); }
+
+  void read(const off_t offset, char* buffer, const std::size_t length) override;
+  void write(const off_t offset, const char* buffer, const std::size_t length) override;
+  void truncate(const off_t length) override;
+  void flush() override;
+  void sync() override;
+
+ private:
+	/**
+   * Stream of the file
+	 */
+  std::fstream stream_;
+
+	/**
+   * Serializes seeks and transfers on stream_
+	 */
+  std::mutex mutex_;
+};
+
+/**
+ * @brief IoHandle doing positional I/O with pread and pwrite on a file
+ *        descriptor.  Nothing is buffered, so flush() does nothing.
+ */
+class PosixIoHandle : public IoHandle
+{
+ public:
+  PosixIoHandle(const std::string& filename, const bool truncate,
+                const int flags = 0);
+  ~PosixIoHandle();
+
+  bool isOpen() const { return fd_ >= 0; }
+
+  void read(const off_t offset, char* buffer, const std::size_t length) override;
+  void write(const off_t offset, const char* buffer, const std::size_t length) override;
+  void allocate(const off_t offset, const std::size_t length) override;
+  void punchHole(const off_t offset, const std::size_t length) override;
+  void advise(const off_t offset, const std::size_t length,
+              const AccessAdvice advice) override;
+  void truncate(const off_t length) override;
+  void flush() override {}
+  void sync() override;
+  int fd() const override { return fd_; }
+
+ protected:
+	/**
+   * File descriptor, -1 if the file could not be opened
+	 */
+  int fd_;
+};
+
+/**
+ * @brief PosixIoHandle opening the file with O_DIRECT, so that transfers go
+ *        between the disk and the caller's buffer without a copy in the OS
+ *        page cache.
+ *
+ * O_DIRECT transfers must be aligned to ALIGNMENT in the buffer, the offset
+ * and the length.  Page frames and page positions are, so page transfers go
+ * straight through; anything else (the file header, page headers, a page
+ * image on the stack) goes through an aligned bounce buffer, and a write
+ * that covers part of a block reads the rest of the block first.
+ */
+class DirectIoHandle : public PosixIoHandle
+{
+ public:
+	/**
+	 * Alignment of direct transfers, enough for devices with 4K sectors
+	 */
+  static const std::size_t ALIGNMENT = 4096;
+
+  DirectIoHandle(const std::string& filename, const bool truncate);
+
+  void read(const off_t offset, char* buffer, const std::size_t length) override;
+  void write(const off_t offset, const char* buffer, const std::size_t length) override;
+  // nothing of the file is in the OS cache to read ahead or drop
+  void advise(const off_t offset, const std::size_t length,
+              const AccessAdvice advice) override {}
+  std::size_t alignment() const override { return ALIGNMENT; }
+
+ private:
+	/**
+	 * Reads an aligned range, as zeros past the end of the file.
+	 */
+  void readAligned(const off_t offset, char* buffer, const std::size_t length);
+
+	/**
+   * Serializes writes, so that two writes into one block cannot undo each
+   * other by reading and writing back the whole block
+	 */
+  std::mutex write_mutex_;
+};
+
+/**
+ * @brief IoHandle serving reads from a read-only MAP_SHARED mapping of the
+ *        file, so a page read is a single memcpy with no system call.
+ *
+ * Writes go through pwrite, and the shared page cache makes them visible in
+ * the mapping.  The mapping covers more than the file, doubling each time the
+ * file outgrows it, so appending pages remaps it only O(log n) times.
+ */
+class MmapIoHandle : public PosixIoHandle
+{
+ public:
+  MmapIoHandle(const std::string& filename, const bool truncate);
+  ~MmapIoHandle();
+
+  void read(const off_t offset, char* buffer, const std::size_t length) override;
+  void write(const off_t offset, const char* buffer, const std::size_t length) override;
+  void advise(const off_t offset, const std::size_t length,
+              const AccessAdvice advice) override;
+  void truncate(const off_t length) override;
+
+ private:
+	/**
+	 * Re-reads the size of the file and remaps it if it has outgrown the
+	 * mapping.  Must be called with lock_ held for writing.
+	 */
+  void refreshMapping();
+
+	/**
+   * Start of the mapping, NULL if nothing is mapped
+	 */
+  char* map_;
+
+	/**
+   * Length of the mapping
+	 */
+  std::size_t capacity_;
+
+	/**
+   * Size of the file as last seen; only this much of the mapping may be read
+	 */
+  off_t size_;
+
+	/**
+   * Held for reading while copying out of the mapping and for writing while
+   * remapping
+	 */
+  pthread_rwlock_t lock_;
+};
+
+}
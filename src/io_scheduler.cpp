@@ -0,0 +1,159 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "io_scheduler.h"
+
+namespace badgerdb {
+
+// Class set by IoClassScope for the current thread, -1 if none
+static thread_local int threadIoClass = -1;
+
+IoScheduler& IoScheduler::instance()
+{
+  static IoScheduler scheduler;
+  return scheduler;
+}
+
+IoScheduler::IoScheduler()
+  : queueDepth(0), inFlight(0), numWaiting(0)
+{
+  const Clock::time_point now = Clock::now();
+  for (int i = 0; i < NUM_IO_CLASSES; i++)
+  {
+    waiting[i] = 0;
+    rateLimit[i] = 0;
+    tokens[i] = 0;
+    lastRefill[i] = now;
+    requests[i] = bytesDone[i] = waitMicros[i] = 0;
+  }
+}
+
+void IoScheduler::setQueueDepth(const unsigned depth)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  queueDepth = depth;
+  changed.notify_all();
+}
+
+void IoScheduler::setRateLimit(const IoClass ioClass, const std::uint64_t bytesPerSec)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rateLimit[ioClass] = bytesPerSec;
+  tokens[ioClass] = bytesPerSec;
+  lastRefill[ioClass] = Clock::now();
+  changed.notify_all();
+}
+
+void IoScheduler::refill(const int ioClass, const Clock::time_point now)
+{
+  const double seconds = std::chrono::duration<double>(now - lastRefill[ioClass]).count();
+  tokens[ioClass] += seconds * rateLimit[ioClass];
+  if (tokens[ioClass] > rateLimit[ioClass])
+    tokens[ioClass] = rateLimit[ioClass];
+  lastRefill[ioClass] = now;
+}
+
+bool IoScheduler::higherPriorityWaiting(const int ioClass) const
+{
+  for (int i = 0; i < ioClass; i++)
+  {
+    if (waiting[i] > 0)
+      return true;
+  }
+  return false;
+}
+
+void IoScheduler::begin(const IoClass ioClass, const std::size_t bytes)
+{
+  // nothing to wait for: only count the request
+  if (rateLimit[ioClass] == 0 && queueDepth == 0 && numWaiting == 0)
+  {
+    inFlight++;
+    requests[ioClass].fetch_add(1, std::memory_order_relaxed);
+    bytesDone[ioClass].fetch_add(bytes, std::memory_order_relaxed);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  const Clock::time_point start = Clock::now();
+
+  // wait off any debt of this class's token bucket
+  while (rateLimit[ioClass] != 0)
+  {
+    refill(ioClass, Clock::now());
+    if (tokens[ioClass] >= 0)
+      break;
+    const double seconds = -tokens[ioClass] / rateLimit[ioClass];
+    changed.wait_for(lock, std::chrono::duration<double>(seconds));
+  }
+
+  // wait for a queue slot, letting higher priority classes go first
+  // counted as waiting before inFlight is checked, so that end() either
+  // frees the slot before the check or sees the waiter and wakes it
+  waiting[ioClass]++;
+  numWaiting++;
+  while ((queueDepth != 0 && inFlight >= queueDepth) || higherPriorityWaiting(ioClass))
+    changed.wait(lock);
+  waiting[ioClass]--;
+  numWaiting--;
+
+  inFlight++;
+  if (rateLimit[ioClass] != 0)
+    tokens[ioClass] -= bytes;
+  requests[ioClass].fetch_add(1, std::memory_order_relaxed);
+  bytesDone[ioClass].fetch_add(bytes, std::memory_order_relaxed);
+  waitMicros[ioClass].fetch_add(
+      std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count(),
+      std::memory_order_relaxed);
+
+  // lower priority waiters re-check whether anyone is still ahead of them
+  if (waiting[ioClass] == 0 && numWaiting != 0)
+    changed.notify_all();
+}
+
+void IoScheduler::end()
+{
+  inFlight--;
+  if (numWaiting != 0)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    changed.notify_all();
+  }
+}
+
+IoClassStats IoScheduler::getStats(const IoClass ioClass)
+{
+  IoClassStats stats;
+  stats.requests = requests[ioClass];
+  stats.bytes = bytesDone[ioClass];
+  stats.waitMicros = waitMicros[ioClass];
+  return stats;
+}
+
+void IoScheduler::clearStats()
+{
+  for (int i = 0; i < NUM_IO_CLASSES; i++)
+    requests[i] = bytesDone[i] = waitMicros[i] = 0;
+}
+
+IoClass IoScheduler::currentClass(const IoClass defaultClass)
+{
+  return threadIoClass < 0 ? defaultClass : static_cast<IoClass>(threadIoClass);
+}
+
+IoClassScope::IoClassScope(const IoClass ioClass)
+  : previous(threadIoClass)
+{
+  threadIoClass = ioClass;
+}
+
+IoClassScope::~IoClassScope()
+{
+  threadIoClass = previous;
+}
+
+}
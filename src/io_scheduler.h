@@ -0,0 +1,235 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace badgerdb {
+
+/**
+ * @brief Priority classes of file I/O, highest priority first.
+ */
+enum IoClass
+{
+	FOREGROUND_READ = 0,	/* Page reads a query is waiting for */
+	PREFETCH = 1,					/* Reads issued ahead of need */
+	BACKGROUND_WRITE = 2	/* Write-back, flushing, index builds */
+};
+
+/**
+ * @brief Number of I/O priority classes.
+ */
+const int NUM_IO_CLASSES = 3;
+
+/**
+ * @brief Statistics kept per I/O class.
+ */
+struct IoClassStats
+{
+	/**
+   * Number of requests admitted
+	 */
+  std::uint64_t requests;
+
+	/**
+   * Number of bytes transferred
+	 */
+  std::uint64_t bytes;
+
+	/**
+   * Total time requests spent waiting to be admitted, in microseconds
+	 */
+  std::uint64_t waitMicros;
+};
+
+/**
+ * @brief Admission control for all file I/O in the process.
+ *
+ * Every read and write done by File passes through the scheduler, which lets
+ * it through once
+ * - the class has not exceeded its rate limit (a token bucket in bytes per
+ *   second; a request may overdraw it and later ones then wait it off),
+ * - fewer than the queue depth requests are in flight, and
+ * - no thread with a higher priority class is waiting for a queue slot.
+ *
+ * With no limits configured (the default) requests are only counted, with
+ * atomic counters and no lock, so that concurrent I/O is not serialized.  The
+ * class of an I/O is FOREGROUND_READ for reads and BACKGROUND_WRITE for writes
+ * unless the calling thread has set another one with IoClassScope.
+ */
+class IoScheduler
+{
+ public:
+	/**
+   * Returns the scheduler used by all files.
+	 */
+  static IoScheduler& instance();
+
+	/**
+	 * Sets the maximum number of requests in flight at once.
+	 *
+	 * @param depth		Queue depth, 0 for unlimited
+	 */
+  void setQueueDepth(const unsigned depth);
+
+	/**
+	 * Sets the rate limit of a class.
+	 *
+	 * @param ioClass				Class to limit
+	 * @param bytesPerSec		Limit in bytes per second, 0 for unlimited
+	 */
+  void setRateLimit(const IoClass ioClass, const std::uint64_t bytesPerSec);
+
+	/**
+	 * Waits until a request may be issued and counts it as in flight.
+	 *
+	 * @param ioClass		Class of the request
+	 * @param bytes			Size of the request
+	 */
+  void begin(const IoClass ioClass, const std::size_t bytes);
+
+	/**
+	 * Marks a request started with begin() as completed.
+	 */
+  void end();
+
+	/**
+	 * Returns the statistics of a class.
+	 *
+	 * @param ioClass		Class to report on
+	 */
+  IoClassStats getStats(const IoClass ioClass);
+
+	/**
+	 * Clears the statistics of all classes.
+	 */
+  void clearStats();
+
+	/**
+	 * Returns the class of I/O issued by the calling thread.
+	 *
+	 * @param defaultClass	Class used if the thread has not set one
+	 */
+  static IoClass currentClass(const IoClass defaultClass);
+
+ private:
+  IoScheduler();
+
+  typedef std::chrono::steady_clock Clock;
+
+	/**
+   * Protects the members below but for the atomic ones, which requests
+   * without limits update without it
+	 */
+  std::mutex mutex;
+
+	/**
+   * Signalled when tokens may have become available, and when a request
+   * completes while threads are waiting for a queue slot
+	 */
+  std::condition_variable changed;
+
+	/**
+   * Maximum requests in flight, 0 for unlimited
+	 */
+  std::atomic<unsigned> queueDepth;
+
+	/**
+   * Requests currently in flight
+	 */
+  std::atomic<unsigned> inFlight;
+
+	/**
+   * Threads of each class waiting for a queue slot
+	 */
+  unsigned waiting[NUM_IO_CLASSES];
+
+	/**
+   * Threads of all classes waiting for a queue slot
+	 */
+  std::atomic<unsigned> numWaiting;
+
+	/**
+   * Rate limit of each class in bytes per second, 0 for unlimited
+	 */
+  std::atomic<std::uint64_t> rateLimit[NUM_IO_CLASSES];
+
+	/**
+   * Bytes each class may still issue; negative when a request overdrew it
+	 */
+  double tokens[NUM_IO_CLASSES];
+
+	/**
+   * Last time tokens were added to each class's bucket
+	 */
+  Clock::time_point lastRefill[NUM_IO_CLASSES];
+
+	/**
+   * Statistics of each class, as in IoClassStats
+	 */
+  std::atomic<std::uint64_t> requests[NUM_IO_CLASSES];
+  std::atomic<std::uint64_t> bytesDone[NUM_IO_CLASSES];
+  std::atomic<std::uint64_t> waitMicros[NUM_IO_CLASSES];
+
+	/**
+	 * Adds the tokens earned since the last refill to a class's bucket, which
+	 * holds at most one second's worth.
+	 */
+  void refill(const int ioClass, const Clock::time_point now);
+
+	/**
+	 * Returns true if a class with higher priority than <ioClass> is waiting for
+	 * a queue slot.
+	 */
+  bool higherPriorityWaiting(const int ioClass) const;
+
+  friend class IoClassScope;
+};
+
+/**
+ * @brief Sets the I/O class of the calling thread while it is in scope.
+ *
+ * For example a prefetcher wraps its reads in IoClassScope scope(PREFETCH) so
+ * that they do not compete with foreground reads.
+ */
+class IoClassScope
+{
+ public:
+  explicit IoClassScope(const IoClass ioClass);
+  ~IoClassScope();
+
+ private:
+	/**
+   * Class that was in effect before this scope, restored at the end of it
+	 */
+  int previous;
+};
+
+/**
+ * @brief Begins a request with the I/O scheduler and ends it when destroyed.
+ */
+class IoTicket
+{
+ public:
+  IoTicket(const IoClass ioClass, const std::size_t bytes)
+  {
+    IoScheduler::instance().begin(ioClass, bytes);
+  }
+
+  ~IoTicket()
+  {
+    IoScheduler::instance().end();
+  }
+};
+
+}
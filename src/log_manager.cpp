@@ -0,0 +1,487 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "log_manager.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "io_handle.h"
+#include "exceptions/io_error_exception.h"
+#include "exceptions/log_writer_exception.h"
+
+namespace badgerdb {
+
+//----------------------------------------
+// Log record layout
+//
+//   uint32 length       of the whole record
+//   uint32 checksum     of the rest of the record
+//   uint8  type
+//   uint16 name length  0 for commit records
+//   uint64 offset       in the file, for write records
+//   name, then the bytes written for write records
+//----------------------------------------
+
+enum LogRecordType
+{
+  LOG_WRITE = 1,
+  LOG_CREATE = 2,
+  LOG_REMOVE = 3,
+  LOG_COMMIT = 4
+};
+
+static const std::size_t HEADER_SIZE = 4 + 4 + 1 + 2 + 8;
+
+// Set by LoggedWriteScope for the current thread
+static thread_local bool threadLoggedWrites = false;
+
+// Checksum of a record, used to find the torn end of the log
+static std::uint32_t recordChecksum(const char* bytes, const std::size_t length)
+{
+  return crc32c(bytes, length);
+}
+
+// Whether a whole record with a good checksum starts at <pos> of <log>
+static bool validRecord(const std::string& log, const std::size_t pos)
+{
+  if (pos + HEADER_SIZE > log.size())
+    return false;
+  std::uint32_t length, checksum;
+  memcpy(&length, &log[pos], 4);
+  memcpy(&checksum, &log[pos + 4], 4);
+  return length >= HEADER_SIZE && length <= log.size() - pos
+      && recordChecksum(&log[pos + 8], length - 8) == checksum;
+}
+
+static void writeFully(const int fd, const std::string& filename, const char* bytes,
+                       std::size_t length, off_t offset)
+{
+  while (length > 0)
+  {
+    ssize_t n = ::pwrite(fd, bytes, length, offset);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      throw IoErrorException(filename, strerror(errno));
+    }
+    bytes += n;
+    length -= n;
+    offset += n;
+  }
+}
+
+static void syncFd(const int fd, const std::string& filename)
+{
+  int rc;
+  while ((rc = fdatasync(fd)) != 0 && errno == EINTR)
+    ;
+  if (rc != 0)
+    throw IoErrorException(filename, strerror(errno));
+}
+
+// Syncs the directory holding <filename>, so that a rename into it survives a
+// crash.
+static void syncDirectory(const std::string& filename)
+{
+  const std::size_t slash = filename.rfind('/');
+  const std::string dirName = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+  int dfd = ::open(dirName.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dfd < 0)
+    throw IoErrorException(dirName, strerror(errno));
+  int rc;
+  while ((rc = ::fsync(dfd)) != 0 && errno == EINTR)
+    ;
+  const int error = errno;
+  ::close(dfd);
+  if (rc != 0)
+    throw IoErrorException(dirName, strerror(error));
+}
+
+LogManager::LogManager(const std::string& name)
+  : filename(name), checkpointName(name + ".checkpoint"), bufferStart(0), flushed(0), committed(0), syncing(false),
+    groupCommitDelay(0), redone(0)
+{
+  memset(&stats, 0, sizeof(stats));
+  fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    throw IoErrorException(filename, strerror(errno));
+  try
+  {
+    recover();
+  }
+  catch (...)
+  {
+    ::close(fd);
+    throw;
+  }
+}
+
+LogManager::~LogManager()
+{
+  try
+  {
+    force(bufferStart + buffer.size());
+  }
+  catch (const IoErrorException &e)
+  {
+  }
+  ::close(fd);
+}
+
+Lsn LogManager::readCheckpoint()
+{
+  char record[8 + 4];
+  int cfd = ::open(checkpointName.c_str(), O_RDONLY);
+  if (cfd < 0)
+    return 0;
+  const ssize_t n = ::pread(cfd, record, sizeof(record), 0);
+  ::close(cfd);
+  Lsn lsn;
+  std::uint32_t checksum;
+  memcpy(&lsn, record, 8);
+  memcpy(&checksum, record + 8, 4);
+  if (n != (ssize_t)sizeof(record) || recordChecksum(record, 8) != checksum)
+    return 0;
+  return lsn;
+}
+
+void LogManager::recover()
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    throw IoErrorException(filename, strerror(errno));
+  // A checkpoint left by an earlier log that has since been removed does not
+  // apply to this one.
+  Lsn start = readCheckpoint();
+  if (start > (Lsn)st.st_size || st.st_size == 0)
+  {
+    ::unlink(checkpointName.c_str());
+    start = 0;
+  }
+
+  // With the checkpoint file lost, or older than the last cut, <start> falls
+  // in the punched-out part of the log. Everything logged there is in the
+  // files already, so recovery goes on from the first whole record after it.
+  bool resync = false;
+  const off_t data = ::lseek(fd, start, SEEK_DATA);
+  if (data > (off_t)start)
+  {
+    start = data;
+    resync = true;
+  }
+  else if (data < 0 && errno == ENXIO)
+    start = st.st_size;
+
+  // Positions in <log> are relative to <start>.
+  std::string log(st.st_size - start, '\0');
+  std::size_t done = 0;
+  while (done < log.size())
+  {
+    ssize_t n = ::pread(fd, &log[done], log.size() - done, start + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw IoErrorException(filename, n < 0 ? strerror(errno) : "log shrank while reading");
+    done += n;
+  }
+
+  // Find the records up to the last commit; a crash may have torn the last
+  // record, which the checksum catches.
+  std::vector<std::size_t> records;
+  std::size_t end = 0;
+  std::size_t pos = 0;
+  if (!log.empty() && (resync || log[0] == 0))
+  {
+    while (pos + HEADER_SIZE <= log.size() && !validRecord(log, pos))
+      pos++;
+  }
+  while (validRecord(log, pos))
+  {
+    std::uint32_t length;
+    memcpy(&length, &log[pos], 4);
+    records.push_back(pos);
+    pos += length;
+    if (log[records.back() + 8] == LOG_COMMIT)
+      end = pos;
+  }
+
+  std::map<std::string, std::unique_ptr<IoHandle> > files;
+  for (std::size_t i = 0; i < records.size() && records[i] < end; i++)
+  {
+    const char* record = &log[records[i]];
+    std::uint32_t length;
+    std::uint16_t nameLength;
+    std::uint64_t offset;
+    memcpy(&length, record, 4);
+    const char type = record[8];
+    memcpy(&nameLength, record + 9, 2);
+    memcpy(&offset, record + 11, 8);
+    const std::string name(record + HEADER_SIZE, nameLength);
+    const char* bytes = record + HEADER_SIZE + nameLength;
+    const std::size_t byteCount = length - HEADER_SIZE - nameLength;
+
+    if (type == LOG_COMMIT)
+      continue;
+    redone++;
+    if (type == LOG_REMOVE)
+    {
+      files.erase(name);
+      ::unlink(name.c_str());
+      continue;
+    }
+
+    std::unique_ptr<IoHandle>& file = files[name];
+    if (type == LOG_CREATE || !file)
+    {
+      const bool create = (type == LOG_CREATE || ::access(name.c_str(), F_OK) != 0);
+      file.reset(IoHandle::open(POSIX_BACKEND, name, create));
+      if (!file)
+        throw IoErrorException(name, strerror(errno));
+    }
+    if (type == LOG_WRITE)
+      file->write(offset, bytes, byteCount);
+  }
+  for (std::map<std::string, std::unique_ptr<IoHandle> >::iterator it = files.begin();
+       it != files.end(); ++it)
+  {
+    if (it->second)
+      it->second->sync();
+  }
+
+  // Drop what was not committed, so new records follow the last commit.
+  if (end < log.size())
+  {
+    if (ftruncate(fd, start + end) != 0)
+      throw IoErrorException(filename, strerror(errno));
+    syncFd(fd, filename);
+  }
+  bufferStart = flushed = committed = start + end;
+}
+
+Lsn LogManager::append(const char type, const std::string& name,
+                       const std::uint64_t offset, const char* bytes, const std::size_t length)
+{
+  const std::uint32_t recordLength = HEADER_SIZE + name.size() + length;
+  const std::uint16_t nameLength = name.size();
+  const std::size_t start = buffer.size();
+  buffer.resize(start + recordLength);
+  char* record = &buffer[start];
+  memcpy(record, &recordLength, 4);
+  record[8] = type;
+  memcpy(record + 9, &nameLength, 2);
+  memcpy(record + 11, &offset, 8);
+  memcpy(record + HEADER_SIZE, name.data(), name.size());
+  if (length > 0)
+    memcpy(record + HEADER_SIZE + name.size(), bytes, length);
+  const std::uint32_t checksum = recordChecksum(record + 8, recordLength - 8);
+  memcpy(record + 4, &checksum, 4);
+
+  stats.records++;
+  stats.bytes += recordLength;
+  return bufferStart + buffer.size();
+}
+
+Lsn LogManager::logWrite(const std::string& name, const std::uint64_t offset,
+                         const char* bytes, const std::size_t length)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return append(LOG_WRITE, name, offset, bytes, length);
+}
+
+Lsn LogManager::logPageWrite(const std::string& name, const std::uint64_t offset,
+                             const char* bytes, const std::size_t length)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (writer != std::thread::id() && writer != std::this_thread::get_id())
+    throw LogWriterException(filename);
+  writer = std::this_thread::get_id();
+  return append(LOG_WRITE, name, offset, bytes, length);
+}
+
+Lsn LogManager::logCreate(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return append(LOG_CREATE, name, 0, NULL, 0);
+}
+
+Lsn LogManager::logRemove(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return append(LOG_REMOVE, name, 0, NULL, 0);
+}
+
+Lsn LogManager::commit(const bool sync)
+{
+  Lsn lsn;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (writer != std::thread::id() && writer != std::this_thread::get_id())
+      throw LogWriterException(filename);
+    writer = std::thread::id();
+    lsn = append(LOG_COMMIT, std::string(), 0, NULL, 0);
+    committed = lsn;
+    stats.commits++;
+  }
+  if (sync)
+    force(lsn);
+  return lsn;
+}
+
+void LogManager::force(const Lsn lsn)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (flushed < lsn)
+  {
+    if (syncing)
+    {
+      // another thread is syncing; its sync may cover this LSN too
+      synced.wait(lock);
+      continue;
+    }
+
+    // Become the thread that syncs, for everything appended so far.
+    syncing = true;
+    if (groupCommitDelay > 0)
+    {
+      lock.unlock();
+      std::this_thread::sleep_for(std::chrono::microseconds(groupCommitDelay));
+      lock.lock();
+    }
+    std::string pending;
+    pending.swap(buffer);
+    const Lsn start = bufferStart;
+    bufferStart += pending.size();
+    lock.unlock();
+
+    try
+    {
+      writeFully(fd, filename, pending.data(), pending.size(), start);
+      syncFd(fd, filename);
+    }
+    catch (...)
+    {
+      lock.lock();
+      // keep the records for the next attempt
+      buffer.insert(0, pending);
+      bufferStart = start;
+      syncing = false;
+      synced.notify_all();
+      throw;
+    }
+
+    lock.lock();
+    flushed = start + pending.size();
+    syncing = false;
+    stats.syncs++;
+    synced.notify_all();
+  }
+}
+
+Lsn LogManager::committedLsn()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return committed;
+}
+
+Lsn LogManager::flushedLsn()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return flushed;
+}
+
+Lsn LogManager::endLsn()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return bufferStart + buffer.size();
+}
+
+void LogManager::checkpoint(const Lsn redoLsn)
+{
+  // The checkpoint must not point past the end of the log on disk.
+  force(redoLsn);
+
+  // Written aside and renamed over the last one, so that a crash leaves one
+  // or the other.
+  char record[8 + 4];
+  memcpy(record, &redoLsn, 8);
+  const std::uint32_t checksum = recordChecksum(record, 8);
+  memcpy(record + 8, &checksum, 4);
+  const std::string tempName = checkpointName + ".tmp";
+  int cfd = ::open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (cfd < 0)
+    throw IoErrorException(tempName, strerror(errno));
+  try
+  {
+    writeFully(cfd, tempName, record, sizeof(record), 0);
+    syncFd(cfd, tempName);
+  }
+  catch (...)
+  {
+    ::close(cfd);
+    throw;
+  }
+  ::close(cfd);
+  if (::rename(tempName.c_str(), checkpointName.c_str()) != 0)
+    throw IoErrorException(checkpointName, strerror(errno));
+  // The log may only be cut once the new checkpoint is sure to be found.
+  syncDirectory(checkpointName);
+
+  // Offsets in the log stay LSNs, so the records before the checkpoint are
+  // punched out rather than cut off.
+  const off_t dropped = redoLsn / 4096 * 4096;
+  if (dropped > 0 && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, dropped) != 0
+      && errno != EOPNOTSUPP)
+    throw IoErrorException(filename, strerror(errno));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.checkpoints++;
+}
+
+void LogManager::setGroupCommitDelay(const unsigned micros)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  groupCommitDelay = micros;
+}
+
+LogStats LogManager::getStats()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+//----------------------------------------
+// LoggedWriteScope
+//----------------------------------------
+
+LoggedWriteScope::LoggedWriteScope()
+  : previous(threadLoggedWrites)
+{
+  threadLoggedWrites = true;
+}
+
+LoggedWriteScope::~LoggedWriteScope()
+{
+  threadLoggedWrites = previous;
+}
+
+bool LoggedWriteScope::active()
+{
+  return threadLoggedWrites;
+}
+
+}
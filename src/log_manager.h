@@ -0,0 +1,319 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace badgerdb {
+
+/**
+ * @brief Log sequence number: the offset in the log just past a record.  0
+ * stands for no record.
+ */
+typedef std::uint64_t Lsn;
+
+/**
+ * @brief Lsn past any in a log.
+ */
+const Lsn MAX_LSN = ~Lsn(0);
+
+/**
+ * @brief Statistics of a LogManager.
+ */
+struct LogStats
+{
+	/**
+   * Number of records appended
+	 */
+  std::uint64_t records;
+
+	/**
+   * Number of bytes appended
+	 */
+  std::uint64_t bytes;
+
+	/**
+   * Number of commit records appended
+	 */
+  std::uint64_t commits;
+
+	/**
+   * Number of times the log was synced to disk.  With several threads
+   * committing at once one sync covers all of them (group commit).
+	 */
+  std::uint64_t syncs;
+
+	/**
+   * Number of checkpoints recorded
+	 */
+  std::uint64_t checkpoints;
+};
+
+/**
+ * @brief Write-ahead log of the changes made to files, replayed (redo only)
+ *        when the log is opened after a crash.
+ *
+ * Records are physical: bytes written at an offset of a file, and file
+ * creation and removal.  Changes between two commit records form a unit;
+ * recovery replays every unit that was committed, in order, and drops the
+ * rest.  Replaying is idempotent, so it does not matter which of the changes
+ * had already reached the data files.
+ *
+ * Once attached with File::setLogManager(), a buffer manager logs the bytes
+ * that changed in a frame when it is unpinned dirty, stamps the frame with the
+ * record's LSN, and forces the log up to that LSN before writing the frame
+ * back (WAL before data).  Frames changed since the last commit are not
+ * written back at all.  Writes File makes on its own (file headers, page
+ * allocation and deletion) are logged and forced before they are made.
+ *
+ * Commits only append to the log and sync it; data pages are written back
+ * lazily.  Threads committing at the same time share one sync.
+ *
+ * A commit covers every record logged before it, whichever thread logged it,
+ * so only one thread at a time may change pages through the log: from its
+ * first logPageWrite() up to its commit() no other thread may log page changes
+ * or commit.  Threads that break this rule get a LogWriterException instead of
+ * silently committing another thread's half-done work.
+ *
+ * A checkpoint records, in a small file next to the log, an LSN from which
+ * recovery can start because every change logged before it is in the data
+ * files.  The log before it is given back to the file system.
+ */
+class LogManager
+{
+ public:
+	/**
+	 * Opens the log, creating it if it does not exist, and replays the changes
+	 * it holds into the data files.  Must be done before the files are opened.
+	 *
+	 * @param filename	Name of the log file.
+	 * @throws  IoErrorException  If the log or a data file cannot be accessed.
+	 */
+  explicit LogManager(const std::string& filename);
+
+	/**
+	 * Syncs the log and closes it.
+	 */
+  ~LogManager();
+
+	/**
+	 * Appends a record of <length> bytes written at <offset> of a file.
+	 *
+	 * @return	LSN of the record.
+	 */
+  Lsn logWrite(const std::string& filename, const std::uint64_t offset,
+               const char* bytes, const std::size_t length);
+
+	/**
+	 * Appends a record of <length> bytes changed at <offset> of a file's page
+	 * in a buffer pool, which must not be written to the file before the next
+	 * commit.  Makes the calling thread the log's writer until it commits.
+	 *
+	 * @return	LSN of the record.
+	 * @throws  LogWriterException  If another thread is the log's writer.
+	 */
+  Lsn logPageWrite(const std::string& filename, const std::uint64_t offset,
+                   const char* bytes, const std::size_t length);
+
+	/**
+	 * Appends a record of a file being created (or emptied).
+	 *
+	 * @return	LSN of the record.
+	 */
+  Lsn logCreate(const std::string& filename);
+
+	/**
+	 * Appends a record of a file being removed.
+	 *
+	 * @return	LSN of the record.
+	 */
+  Lsn logRemove(const std::string& filename);
+
+	/**
+	 * Appends a commit record, making the changes logged since the previous one
+	 * a unit that recovery replays.
+	 *
+	 * @param sync	Whether to wait until the commit is on disk.
+	 * @return	LSN of the commit record.
+	 * @throws  LogWriterException  If another thread is the log's writer.
+	 */
+  Lsn commit(const bool sync = true);
+
+	/**
+	 * Waits until the log is on disk up to <lsn>.
+	 *
+	 * @throws  IoErrorException  If the log cannot be written.
+	 */
+  void force(const Lsn lsn);
+
+	/**
+	 * Returns the LSN of the last commit record.  Changes with a higher LSN
+	 * must not be written to the data files.
+	 */
+  Lsn committedLsn();
+
+	/**
+	 * Returns the LSN of the end of the log so far, the start of the next
+	 * record appended.
+	 */
+  Lsn endLsn();
+
+	/**
+	 * Records a checkpoint: recovery starts at <redoLsn> from now on, and the
+	 * whole blocks of the log before it are punched out of the file.  The
+	 * caller must have synced every change logged before <redoLsn> to the data
+	 * files.
+	 *
+	 * @param redoLsn	LSN of the start of a record, or of the end of the log.
+	 * @throws  IoErrorException  If the checkpoint cannot be written.
+	 */
+  void checkpoint(const Lsn redoLsn);
+
+	/**
+	 * Returns the LSN up to which the log is on disk.
+	 */
+  Lsn flushedLsn();
+
+	/**
+	 * Sets how long a thread forcing the log waits first for other threads to
+	 * append their commits, so that one sync covers them all.
+	 *
+	 * @param micros	Delay in microseconds, 0 (the default) for none
+	 */
+  void setGroupCommitDelay(const unsigned micros);
+
+	/**
+	 * Returns the number of records replayed when the log was opened.
+	 */
+  std::uint64_t redoneRecords() const { return redone; }
+
+	/**
+	 * Returns the statistics of the log.
+	 */
+  LogStats getStats();
+
+ private:
+	/**
+	 * Appends a record and returns its LSN.  Must be called with <mutex> held.
+	 */
+  Lsn append(const char type, const std::string& filename,
+             const std::uint64_t offset, const char* bytes, const std::size_t length);
+
+	/**
+	 * Reads the log from the last checkpoint, replays the committed changes and
+	 * truncates the rest.
+	 */
+  void recover();
+
+	/**
+	 * Returns the LSN recorded by the last checkpoint, 0 if there is none.
+	 */
+  Lsn readCheckpoint();
+
+	/**
+   * Name of the log file
+	 */
+  const std::string filename;
+
+	/**
+   * Name of the file holding the LSN of the last checkpoint
+	 */
+  const std::string checkpointName;
+
+	/**
+   * Descriptor of the log file
+	 */
+  int fd;
+
+	/**
+   * Protects the members below
+	 */
+  std::mutex mutex;
+
+	/**
+   * Signalled when a sync of the log completes
+	 */
+  std::condition_variable synced;
+
+	/**
+   * Records appended but not yet written to the log file
+	 */
+  std::string buffer;
+
+	/**
+   * LSN of the start of <buffer>
+	 */
+  Lsn bufferStart;
+
+	/**
+   * LSN up to which the log is on disk
+	 */
+  Lsn flushed;
+
+	/**
+   * LSN of the last commit record
+	 */
+  Lsn committed;
+
+	/**
+   * Thread that logged page changes since the last commit, or no thread
+	 */
+  std::thread::id writer;
+
+	/**
+   * Whether a thread is writing and syncing the log
+	 */
+  bool syncing;
+
+	/**
+   * Group commit delay in microseconds
+	 */
+  unsigned groupCommitDelay;
+
+	/**
+   * Number of records replayed by recover()
+	 */
+  std::uint64_t redone;
+
+	/**
+   * Statistics of the log
+	 */
+  LogStats stats;
+};
+
+/**
+ * @brief Marks the file writes of the calling thread as already logged while
+ *        it is in scope, so that File does not log them again.
+ *
+ * The buffer manager writes back frames whose changes it has logged itself
+ * in such a scope.
+ */
+class LoggedWriteScope
+{
+ public:
+  LoggedWriteScope();
+  ~LoggedWriteScope();
+
+	/**
+	 * Returns true if the calling thread is in a LoggedWriteScope.
+	 */
+  static bool active();
+
+ private:
+	/**
+   * Whether the thread was in a scope already, restored at the end of this one
+	 */
+  bool previous;
+};
+
+}
@@ -5,12 +5,23 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "btree.h"
+#include "crc32c.h"
 #include "page.h"
 #include "filescan.h"
 #include "page_iterator.h"
 #include "file_iterator.h"
+#include "log_manager.h"
 #include "exceptions/insufficient_space_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
@@ -19,6 +30,11 @@
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/page_checksum_exception.h"
+#include "exceptions/shared_buffer_exception.h"
+#include "exceptions/buffer_exceeded_exception.h"
+#include "exceptions/invalid_page_exception.h"
+#include "exceptions/log_writer_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -83,8 +99,34 @@ void test8_BoundTest_Backward();
 void test9_BoundTest_Random();
 void test10_3000_Sparse();
 void test11_ReopenIndex();
+void test12_ReadOnlyScanWrites();
+void test13_DirtySectorWriteBack();
+void test14_SharedBufferPool();
+void test15_HandleCache();
+void test16_DeepIndex();
+void test17_AsyncPrefetchAndFlush();
+void test18_DurabilityModes();
+void test19_WalRecovery();
+void test20_PageChecksums();
+void test21_FreeSpaceMap();
+void test22_ExtentAllocation();
+void test23_BlobFreeList();
+void test24_CachedFileHeader();
+void test25_DirectIo();
+void test26_PageCompression();
+void test27_ConcurrentOpenClose();
+void test28_DeletePages();
+void test29_PageDirectory();
+void test30_FuzzyCheckpoint();
+void test31_ShadowPaging();
+void test32_AccessHints();
+void test33_LostCheckpoint();
+void test34_UncommittedWork();
+void test35_ManyFiles();
 void errorTests();
 void deleteRelation();
+void corruptByte(const std::string& filename, const off_t position);
+PageId numPagesOnDisk(const std::string& filename);
 
 int main(int argc, char **argv)
 {
@@ -160,6 +202,30 @@ int main(int argc, char **argv)
 
 	test10_3000_Sparse();
 	test11_ReopenIndex();
+	test12_ReadOnlyScanWrites();
+	test13_DirtySectorWriteBack();
+	test14_SharedBufferPool();
+	test15_HandleCache();
+	test16_DeepIndex();
+	test17_AsyncPrefetchAndFlush();
+	test18_DurabilityModes();
+	test19_WalRecovery();
+	test20_PageChecksums();
+	test21_FreeSpaceMap();
+	test22_ExtentAllocation();
+	test23_BlobFreeList();
+	test24_CachedFileHeader();
+	test25_DirectIo();
+	test26_PageCompression();
+	test27_ConcurrentOpenClose();
+	test28_DeletePages();
+	test29_PageDirectory();
+	test30_FuzzyCheckpoint();
+	test31_ShadowPaging();
+	test32_AccessHints();
+	test33_LostCheckpoint();
+	test34_UncommittedWork();
+	test35_ManyFiles();
 
 	delete bufMgr;
 
@@ -270,6 +336,1066 @@ void test11_ReopenIndex() {
 
 }
 
+void test12_ReadOnlyScanWrites() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 12: Read-only scans on a reopened index write nothing back" << std::endl;
+
+	createRelationForward(5000);
+	{
+		// Build the index; the destructor flushes it to disk.
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+	}
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		bufMgr->clearBufStats();
+		checkPassFail(intScan(&index,0,GTE,5000,LT), 5000)
+		checkPassFail(intScan(&index,300,GT,400,LT), 99)
+	}
+	// The index destructor flushes the file, so any page dirtied by the scans
+	// would have been counted here.
+	std::cout << "diskwrites after read-only scans: " << bufMgr->getBufStats().diskwrites << std::endl;
+	checkPassFail(bufMgr->getBufStats().diskwrites, 0)
+	indexTests(5000);
+	deleteRelation();
+}
+
+void test13_DirtySectorWriteBack() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 13: Dirty sector write-back of a single index insert" << std::endl;
+
+	createRelationForward(5000);
+	BufMgr *sectorBufMgr = new BufMgr(100, true /* trackDirtySectors */);
+	{
+		BTreeIndex index(relationName, intIndexName, sectorBufMgr, offsetof(tuple,i), INTEGER);
+	}
+	{
+		// Appending the largest key to the last leaf only touches its size,
+		// one key slot and one rid slot.
+		BTreeIndex index(relationName, intIndexName, sectorBufMgr, offsetof(tuple,i), INTEGER);
+		sectorBufMgr->clearBufStats();
+		int key = 5000;
+		RecordId keyRid = {1, 1, 0};
+		index.insertEntry(&key, keyRid);
+	}
+	BufStats &stats = sectorBufMgr->getBufStats();
+	std::cout << "diskwrites: " << stats.diskwrites << " bytesWritten: " << stats.bytesWritten << std::endl;
+	checkPassFail(stats.diskwrites, 1)
+	checkPassFail((stats.bytesWritten <= 3 * Page::SECTOR_SIZE), true)
+	delete sectorBufMgr;
+
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	deleteRelation();
+}
+
+void test14_SharedBufferPool() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 14: Buffer pool shared between processes" << std::endl;
+
+	createRelationForward(5000);
+	const std::string shmName = "/badgerdb_test14";
+	shm_unlink(shmName.c_str());	// left over from a crashed run
+	BufMgr *sharedBufMgr = new BufMgr(100, shmName);
+
+	// The parent brings the first page of the relation into the shared pool.
+	Page *page;
+	PageId firstPage = file1->getFirstPageNo();
+	sharedBufMgr->readPage(file1, firstPage, page);
+	sharedBufMgr->unPinPage(file1, firstPage, false);
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		// The child attaches to the same pool and should not have to read the
+		// page from disk.
+		int reads;
+		{
+			BufMgr *childBufMgr = new BufMgr(100, shmName);
+			PageFile childFile = PageFile::open(relationName);
+			childBufMgr->readPage(&childFile, firstPage, page);
+			childBufMgr->unPinPage(&childFile, firstPage, false);
+			reads = childBufMgr->getBufStats().diskreads;
+			childBufMgr->flushFile(&childFile);
+			delete childBufMgr;
+		}
+		_exit(reads);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	checkPassFail(WEXITSTATUS(status), 0)
+
+	// A process that dies holding the pool's latch leaves the pool abandoned,
+	// for good.
+	pid = fork();
+	if (pid == 0)
+	{
+		int fd = shm_open(shmName.c_str(), O_RDWR, 0600);
+		void *mem = mmap(NULL, sizeof(BufPoolHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		pthread_mutex_lock(&static_cast<BufPoolHeader*>(mem)->latch);
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		bool caught = false;
+		try
+		{
+			sharedBufMgr->readPage(file1, firstPage, page);
+		}
+		catch (const SharedBufferException &e)
+		{
+			caught = true;
+		}
+		checkPassFail(caught, true)
+	}
+	delete sharedBufMgr;
+
+	// Once removed, the name can be used for a new pool.
+	shm_unlink(shmName.c_str());
+	sharedBufMgr = new BufMgr(100, shmName);
+	sharedBufMgr->readPage(file1, firstPage, page);
+	sharedBufMgr->unPinPage(file1, firstPage, false);
+	checkPassFail(sharedBufMgr->getBufStats().diskreads, 1)
+	delete sharedBufMgr;
+	deleteRelation();
+}
+
+void test15_HandleCache() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 15: Index tests with one OS file handle" << std::endl;
+
+	// The relation and its indexes keep closing each other's handles, which
+	// must be reopened without losing any writes.
+	File::setMaxOpenHandles(1);
+	File::clearHandleCacheStats();
+	createRelationForward(5000);
+	indexTests(5000);
+	deleteRelation();
+	checkPassFail((File::handleCacheStats().evictions > 0), true)
+	File::setMaxOpenHandles(256);
+}
+
+void test16_DeepIndex() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 16: Index deep enough to split non-leaf nodes" << std::endl;
+
+	// Inserting in order leaves every leaf half full, so 700000 keys need more
+	// leaves than one non-leaf node can point to.
+	createRelationForward(700000);
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		File::clearPagesAdvised();
+		checkPassFail(intScan(&index,0,GTE,700000,LT), 700000)
+		// The scan hints the leaves under every non-leaf node it passes, more than
+		// one node can point to.
+		checkPassFail((File::pagesAdvised(ADVICE_WILLNEED) > (std::uint64_t)INTARRAYNONLEAFSIZE + 1), true)
+		checkPassFail(intScan(&index,340000,GTE,360000,LT), 20000)
+		checkPassFail(intScan(&index,699990,GT,700010,LT), 9)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	deleteRelation();
+}
+
+void test17_AsyncPrefetchAndFlush() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 17: Prefetch and flush with many reads and writes in flight" << std::endl;
+
+	createRelationForward(5000);
+	std::vector<PageId> pageNos;
+	for (FileIterator iter = file1->begin(); iter != file1->end(); ++iter)
+	{
+		pageNos.push_back(iter.getCurrentPage());
+	}
+	const int numPages = pageNos.size();
+	// a page past the end of the file is left out
+	pageNos.push_back(pageNos.back() + 10);
+
+	// room for all of the relation, whatever the page size
+	BufMgr *asyncBufMgr = new BufMgr(std::max(100, numPages));
+	asyncBufMgr->prefetch(file1, pageNos);
+	checkPassFail(asyncBufMgr->getBufStats().diskreads, numPages)
+
+	// Every page is in the pool now; rewrite the first record of each.
+	asyncBufMgr->clearBufStats();
+	for (int i = 0; i < numPages; i++)
+	{
+		Page *page;
+		RecordId firstRid = {pageNos[i], 1, 0};
+		asyncBufMgr->readPage(file1, pageNos[i], page);
+		std::string data = page->getRecord(firstRid);
+		RECORD record = *reinterpret_cast<const RECORD*>(data.data());
+		record.i = -record.i - 1;
+		page->updateRecord(firstRid, std::string(reinterpret_cast<char*>(&record), sizeof(record)));
+		asyncBufMgr->unPinPage(file1, pageNos[i], true);
+	}
+	asyncBufMgr->flushFile(file1);
+	checkPassFail(asyncBufMgr->getBufStats().diskreads, 0)
+	checkPassFail(asyncBufMgr->getBufStats().diskwrites, numPages)
+	delete asyncBufMgr;
+
+	int rewritten = 0;
+	for (int i = 0; i < numPages; i++)
+	{
+		RecordId firstRid = {pageNos[i], 1, 0};
+		std::string data = file1->readPage(pageNos[i]).getRecord(firstRid);
+		if (reinterpret_cast<const RECORD*>(data.data())->i < 0)
+			rewritten++;
+	}
+	checkPassFail(rewritten, numPages)
+	deleteRelation();
+}
+
+void test18_DurabilityModes() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 18: Index tests in each durability mode" << std::endl;
+
+	const DurabilityMode modes[] = {DURABILITY_ON_CLOSE, DURABILITY_GROUP,
+	                                DURABILITY_PER_COMMIT, DURABILITY_NONE};
+	for (std::size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+	{
+		File::setDurability(modes[i], 1 /* group_interval_ms */);
+		createRelationForward(2000);
+		file1->sync();
+		indexTests(2000);
+		deleteRelation();
+	}
+	checkPassFail(File::durability(), DURABILITY_NONE)
+}
+
+void test19_WalRecovery() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 19: Redo recovery of an index whose buffer pool was lost" << std::endl;
+
+	const std::string logName = relationName + ".wal";
+	unlink(logName.c_str());	// left over from a crashed run
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		// The child builds the relation and its index through a small buffer
+		// pool with a write-ahead log, inserts some more keys, and dies without
+		// writing back the dirty pages.
+		LogManager log(logName);
+		File::setLogManager(&log);
+		createRelationForward(20000);
+		BufMgr *walBufMgr = new BufMgr(20);
+		BTreeIndex *index = new BTreeIndex(relationName, intIndexName, walBufMgr, offsetof(tuple,i), INTEGER);
+		RecordId firstRid = {file1->getFirstPageNo(), 1, 0};
+		for (int key = 20000; key < 20100; key++)
+		{
+			index->insertEntry(&key, firstRid);
+		}
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	checkPassFail(WEXITSTATUS(status), 0)
+
+	{
+		LogManager log(logName);
+		checkPassFail((log.redoneRecords() > 0), true)
+	}
+	unlink(logName.c_str());
+
+	file1 = new PageFile(relationName, false);
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,0,GTE,20000,LT), 20000)
+		checkPassFail(intScan(&index,19990,GTE,20100,LT), 110)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	deleteRelation();
+}
+
+void test20_PageChecksums() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 20: Index tests with page checksums, and corrupt pages" << std::endl;
+
+	checkPassFail(crc32c("123456789", 9), 0xe3069283u)
+
+	File::setPageChecksums(true);
+	createRelationForward(2000);
+	indexTests(2000);
+	checkPassFail(file1->hasPageChecksums(), true)
+
+	// Damage a page of the relation behind the buffer pool's back.
+	bufMgr->flushFile(file1);
+	const PageId pageNo = file1->getFirstPageNo();
+	corruptByte(relationName, File::pagePosition(pageNo) + std::streamoff(Page::SIZE / 2));
+	bool caught = false;
+	try
+	{
+		file1->readPage(pageNo);
+	}
+	catch(const PageChecksumException &e)
+	{
+		caught = true;
+	}
+	checkPassFail(caught, true)
+
+	// And a page of a blob file, whose checksum is in the page's last bytes.
+	const std::string blobName = relationName + ".blob";
+	{
+		BlobFile blob = BlobFile::create(blobName);
+		PageId blobPageNo;
+		Page blobPage = blob.allocatePage(blobPageNo);
+		memset(reinterpret_cast<char*>(&blobPage), 'b', Page::SIZE - Page::CHECKSUM_SIZE);
+		blob.writePage(blobPageNo, blobPage);
+		blob.readPage(blobPageNo);
+
+		corruptByte(blobName, File::pagePosition(blobPageNo) + std::streamoff(Page::SIZE - 1));
+		caught = false;
+		try
+		{
+			blob.readPage(blobPageNo);
+		}
+		catch(const PageChecksumException &e)
+		{
+			caught = true;
+		}
+		checkPassFail(caught, true)
+	}
+	File::remove(blobName);
+
+	// Files keep the setting they were created with.
+	File::setPageChecksums(false);
+	checkPassFail(file1->hasPageChecksums(), true)
+	deleteRelation();
+}
+
+void test21_FreeSpaceMap() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 21: Record inserts through the free-space map fill holes" << std::endl;
+
+	createRelationForward(5000);
+
+	// Delete every other record of every page.
+	std::vector<std::string> deleted;
+	int pagesBefore = 0;
+	for (FileIterator iter = file1->begin(); iter != file1->end(); ++iter)
+	{
+		Page page = *iter;
+		std::vector<RecordId> rids;
+		for (PageIterator pageIter = page.begin(); pageIter != page.end(); ++pageIter)
+		{
+			rids.push_back(pageIter.getCurrentRecord());
+		}
+		for (std::size_t i = 0; i < rids.size(); i += 2)
+		{
+			deleted.push_back(page.getRecord(rids[i]));
+			page.deleteRecord(rids[i]);
+		}
+		file1->writePage(page.page_number(), page);
+		pagesBefore++;
+	}
+
+	// Putting them back reuses the room they left, rather than growing the
+	// file; only the last hole of a page may be too small for a record.
+	for (std::size_t i = 0; i < deleted.size(); i++)
+	{
+		file1->insertRecord(deleted[i]);
+	}
+	int pagesAfter = 0;
+	for (FileIterator iter = file1->begin(); iter != file1->end(); ++iter)
+	{
+		pagesAfter++;
+	}
+	checkPassFail((pagesAfter <= pagesBefore + 1), true)
+
+	indexTests(5000);
+	deleteRelation();
+}
+
+void test22_ExtentAllocation() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 22: Blob pages are allocated in extents" << std::endl;
+
+	const std::string blobName = relationName + ".blob";
+	File::setPageChecksums(true);
+	PageId pageNo = 0;
+	{
+		BlobFile blob = BlobFile::create(blobName);
+		PageId first;
+		blob.allocatePage(first);
+		for (int i = 1; i < 100; i++)
+		{
+			blob.allocatePage(pageNo);
+		}
+		checkPassFail(pageNo, first + 99)
+
+		// The first extent is on disk as soon as its first page is handed out.
+		struct stat st;
+		stat(blobName.c_str(), &st);
+		checkPassFail((st.st_size >= (off_t)File::pagePosition(first + BlobFile::MIN_EXTENT_PAGES)), true)
+
+		// A page never written reads as zeros, which its checksum allows.
+		bool caught = false;
+		try
+		{
+			blob.readPage(pageNo - 1);
+		}
+		catch(const PageChecksumException &e)
+		{
+			caught = true;
+		}
+		checkPassFail(caught, false)
+	}
+	File::setPageChecksums(false);
+
+	// The pages reserved but not handed out are given back on close.
+	{
+		BlobFile blob = BlobFile::open(blobName);
+		PageId next;
+		blob.allocatePage(next);
+		checkPassFail(next, pageNo + 1)
+	}
+	File::remove(blobName);
+
+	// Index pages come from extents too.
+	createRelationForward(50000);
+	indexTests(50000);
+	deleteRelation();
+}
+
+void test23_BlobFreeList() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 23: Deleted blob pages are reused and the free tail truncated" << std::endl;
+
+	const std::string blobName = relationName + ".blob";
+	{
+		BlobFile blob = BlobFile::create(blobName);
+		std::vector<PageId> pageNos(10);
+		for (int i = 0; i < 10; i++)
+		{
+			Page* page;
+			bufMgr->allocPage(&blob, pageNos[i], page);
+			bufMgr->unPinPage(&blob, pageNos[i], true);
+		}
+		bufMgr->flushFile(&blob);
+
+		// Disposing of a page works whether it is in the buffer pool or not.
+		Page* page;
+		bufMgr->readPage(&blob, pageNos[3], page);
+		bufMgr->unPinPage(&blob, pageNos[3], false);
+		bufMgr->disposePage(&blob, pageNos[3]);
+		bufMgr->disposePage(&blob, pageNos[5]);
+
+		// Most recently freed first.
+		PageId reused;
+		blob.allocatePage(reused);
+		checkPassFail(reused, pageNos[5])
+		blob.allocatePage(reused);
+		checkPassFail(reused, pageNos[3])
+		PageId fresh;
+		blob.allocatePage(fresh);
+		checkPassFail(fresh, pageNos[9] + 1)
+
+		// Pages reserved but not handed out yet cannot be deleted.
+		bool caught = false;
+		try
+		{
+			blob.deletePage(fresh + 1);
+		}
+		catch (const InvalidPageException &e)
+		{
+			caught = true;
+		}
+		checkPassFail(caught, true)
+
+		// Free the last pages and one in the middle; only the tail goes, along
+		// with the rest of the reserved extent.
+		blob.deletePage(fresh);
+		blob.deletePage(pageNos[9]);
+		blob.deletePage(pageNos[8]);
+		blob.deletePage(pageNos[2]);
+		checkPassFail((blob.truncateFreeTail() >= 3), true)
+		struct stat st;
+		stat(blobName.c_str(), &st);
+		checkPassFail(st.st_size, (off_t)File::pagePosition(pageNos[8]))
+		checkPassFail(blob.truncateFreeTail(), 0)
+
+		blob.allocatePage(reused);
+		checkPassFail(reused, pageNos[2])
+		blob.allocatePage(fresh);
+		checkPassFail(fresh, pageNos[8])
+	}
+	File::remove(blobName);
+}
+
+void test24_CachedFileHeader() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 24: The file header is cached and written back at sync points" << std::endl;
+
+	const std::string name = relationName + ".hdr";
+	{
+		PageFile file = PageFile::create(name);
+		PageId pageNo;
+		for (int i = 0; i < 3; i++)
+		{
+			file.allocatePage(pageNo);
+		}
+
+		// Every File object for the file sees the cached header...
+		PageFile other = PageFile::open(name);
+		int pages = 0;
+		for (FileIterator iter = other.begin(); iter != other.end(); ++iter)
+		{
+			pages++;
+		}
+		checkPassFail(pages, 3)
+		// ...which is not on disk yet with DURABILITY_NONE.
+		checkPassFail(numPagesOnDisk(name), 0)
+
+		// The free-space map and the page directory have a page each.
+		file.sync();
+		checkPassFail(numPagesOnDisk(name), 6)
+
+		file.allocatePage(pageNo);
+	}
+	// Closing the file writes it back too.
+	checkPassFail(numPagesOnDisk(name), 7)
+	File::remove(name);
+}
+
+void test25_DirectIo() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 25: Index tests with direct I/O" << std::endl;
+
+	File::setIoBackend(DIRECT_BACKEND);
+	createRelationForward(5000);
+	indexTests(5000);
+
+	deleteRelation();
+
+	// Transfers that are not aligned are bounced through memory that is, and
+	// keep the rest of the blocks they touch.
+	const std::string name = relationName + ".direct";
+	{
+		std::unique_ptr<IoHandle> io(IoHandle::open(DIRECT_BACKEND, name, true));
+		std::string bytes(6000, 'a');
+		io->write(0, &bytes[0], bytes.size());
+		io->write(4090, "0123456789ab", 12);
+		std::vector<char> unaligned(6001);
+		io->read(1, &unaligned[1], 6000);
+		checkPassFail(std::string(&unaligned[4090], 12), "0123456789ab")
+		checkPassFail(unaligned[4089], 'a')
+		checkPassFail(unaligned[4102], 'a')
+		checkPassFail(unaligned[6000], 0)
+	}
+	File::remove(name);
+	File::setIoBackend(POSIX_BACKEND);
+}
+
+void test26_PageCompression() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 26: Index tests with compressed pages" << std::endl;
+
+	File::setPageCompression(true);
+	createRelationForward(5000);
+	checkPassFail(file1->hasPageCompression(), true)
+	checkPassFail(file1->hasPageChecksums(), true)
+	indexTests(5000);
+
+	// The records are padded with spaces, so most of each page is left out.
+	struct stat st;
+	stat(relationName.c_str(), &st);
+	checkPassFail((st.st_blocks * 512 < st.st_size), true)
+	deleteRelation();
+
+	// Pages that do not compress are stored as they are, next to ones that do.
+	const std::string blobName = relationName + ".lz";
+	{
+		BlobFile blob = BlobFile::create(blobName);
+		PageId emptyNo, noiseNo;
+		Page empty = blob.allocatePage(emptyNo);
+		blob.writePage(emptyNo, empty);
+		Page noise = blob.allocatePage(noiseNo);
+		char* bytes = reinterpret_cast<char*>(&noise);
+		srand(26);
+		for (std::size_t i = 0; i < Page::SIZE; i++)
+		{
+			bytes[i] = rand();
+		}
+		blob.writePage(noiseNo, noise);
+
+		BlobFile reopened = BlobFile::open(blobName);
+		Page read = reopened.readPage(noiseNo);
+		checkPassFail(memcmp(&read, &noise, Page::SIZE - Page::CHECKSUM_SIZE), 0)
+		read = reopened.readPage(emptyNo);
+		checkPassFail(memcmp(&read, &empty, Page::SIZE - Page::CHECKSUM_SIZE), 0)
+
+		// A corrupted compressed page is still caught by its checksum.
+		corruptByte(blobName, File::pagePosition(emptyNo) + std::streamoff(8));
+		bool caught = false;
+		try
+		{
+			reopened.readPage(emptyNo);
+		}
+		catch(const PageChecksumException &e)
+		{
+			caught = true;
+		}
+		checkPassFail(caught, true)
+	}
+	File::remove(blobName);
+	File::setPageCompression(false);
+}
+
+void test27_ConcurrentOpenClose() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 27: Threads opening and closing the same files" << std::endl;
+
+	const int numFiles = 8;
+	const int numThreads = 8;
+	std::vector<std::string> names;
+	std::vector<PageId> pageNos;
+	for (int i = 0; i < numFiles; i++)
+	{
+		names.push_back(relationName + ".open" + std::to_string(i));
+		BlobFile blob = BlobFile::create(names.back());
+		PageId pageNo;
+		Page page = blob.allocatePage(pageNo);
+		memset(reinterpret_cast<char*>(&page), 'a' + i, Page::SIZE / 2);
+		blob.writePage(pageNo, page);
+		pageNos.push_back(pageNo);
+	}
+
+	// Fewer handles than files, so the threads keep evicting each other's
+	// handles; these stay open throughout and are read alongside.
+	File::setMaxOpenHandles(3);
+	File::clearHandleCacheStats();
+	std::vector<BlobFile> held;
+	for (int i = 0; i < numFiles; i++)
+	{
+		held.push_back(BlobFile::open(names[i]));
+	}
+	std::atomic<int> mismatches(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; t++)
+	{
+		threads.push_back(std::thread([&, t]() {
+			for (int k = 0; k < 500; k++)
+			{
+				const int i = (t + k * (t + 1)) % numFiles;
+				BlobFile blob = BlobFile::open(names[i]);
+				Page page = blob.readPage(pageNos[i]);
+				Page heldPage = held[(i + 1) % numFiles].readPage(pageNos[(i + 1) % numFiles]);
+				if (reinterpret_cast<const char*>(&page)[0] != 'a' + i
+				    || reinterpret_cast<const char*>(&heldPage)[0] != 'a' + (i + 1) % numFiles)
+				{
+					mismatches++;
+				}
+			}
+		}));
+	}
+	for (int t = 0; t < numThreads; t++)
+	{
+		threads[t].join();
+	}
+	checkPassFail(mismatches.load(), 0)
+	checkPassFail((File::handleCacheStats().evictions > 0), true)
+	checkPassFail(File::isOpen(names[0]), true)
+	held.clear();
+
+	int stillOpen = 0;
+	for (int i = 0; i < numFiles; i++)
+	{
+		if (File::isOpen(names[i]))
+		{
+			stillOpen++;
+		}
+		File::remove(names[i]);
+	}
+	checkPassFail(stillOpen, 0)
+	File::setMaxOpenHandles(256);
+}
+
+void test28_DeletePages() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 28: Deleting pages anywhere on the used list" << std::endl;
+
+	// Once with checksums, which must not cover the list pointers updated on
+	// the neighbours of a deleted page.
+	for (int round = 0; round < 2; round++)
+	{
+		File::setPageChecksums(round == 1);
+		createRelationForward(5000);
+		std::vector<PageId> used;
+		for (FileIterator iter = file1->begin(); iter != file1->end(); ++iter)
+		{
+			used.push_back(iter.getCurrentPage());
+		}
+
+		// the head, the tail and one in the middle
+		const PageId deleted[] = {used.front(), used.back(), used[used.size() / 2]};
+		for (std::size_t i = 0; i < 3; i++)
+		{
+			file1->deletePage(deleted[i]);
+			used.erase(std::find(used.begin(), used.end(), deleted[i]));
+		}
+		// The last page deleted is reused.  The iterator goes by page number,
+		// not by where pages are on the used list.
+		PageId reused;
+		file1->allocatePage(reused);
+		checkPassFail(reused, deleted[2])
+		used.insert(std::lower_bound(used.begin(), used.end(), reused), reused);
+
+		std::vector<PageId> walked;
+		for (FileIterator iter = file1->begin(); iter != file1->end(); ++iter)
+		{
+			walked.push_back(iter.getCurrentPage());
+		}
+		checkPassFail((walked == used), true)
+
+		// Every other page is left, then none.
+		for (std::size_t i = 0; i < used.size(); i += 2)
+		{
+			file1->deletePage(used[i]);
+		}
+		int left = 0;
+		for (FileIterator iter = file1->begin(); iter != file1->end(); ++iter)
+		{
+			left++;
+		}
+		checkPassFail(left, (int)(used.size() / 2))
+		for (std::size_t i = used.size(); i-- > 0; )
+		{
+			if (i % 2 == 1)
+			{
+				file1->deletePage(used[i]);
+			}
+		}
+		checkPassFail((file1->begin() == file1->end()), true)
+		deleteRelation();
+	}
+	File::setPageChecksums(false);
+}
+
+void test29_PageDirectory() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 29: Used pages from the page directory, scanned in parallel" << std::endl;
+
+	createRelationForward(20000);
+	const PageId deleted = file1->usedPages()[3];
+	Page deletedPage = file1->readPage(deleted);
+	int deletedRecords = 0;
+	for (PageIterator pageIter = deletedPage.begin(); pageIter != deletedPage.end(); ++pageIter)
+	{
+		deletedRecords++;
+	}
+	file1->deletePage(deleted);
+	const std::vector<PageId> used = file1->usedPages();
+	std::vector<PageId> walked;
+	for (FileIterator iter = file1->begin(); iter != file1->end(); ++iter)
+	{
+		walked.push_back(iter.getCurrentPage());
+	}
+	checkPassFail((walked == used), true)
+	checkPassFail((PageFile::open(relationName).usedPages() == used), true)
+
+	// Each thread counts the records of its part of the file.
+	const int numThreads = 4;
+	std::vector<std::pair<FileIterator, FileIterator> > parts = file1->partition(numThreads);
+	std::vector<int> records(numThreads, 0);
+	std::vector<std::size_t> pages(numThreads, 0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; t++)
+	{
+		threads.push_back(std::thread([&, t]() {
+			for (FileIterator iter = parts[t].first; iter != parts[t].second; ++iter)
+			{
+				Page page = *iter;
+				for (PageIterator pageIter = page.begin(); pageIter != page.end(); ++pageIter)
+				{
+					records[t]++;
+				}
+				pages[t]++;
+			}
+		}));
+	}
+	int totalRecords = 0;
+	for (int t = 0; t < numThreads; t++)
+	{
+		threads[t].join();
+		totalRecords += records[t];
+		checkPassFail((pages[t] >= used.size() / numThreads), true)
+	}
+	checkPassFail(totalRecords, 20000 - deletedRecords)
+	deleteRelation();
+}
+
+void test30_FuzzyCheckpoint() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 30: Fuzzy checkpoints while an index is built, then recovery" << std::endl;
+
+	const std::string logName = relationName + ".wal";
+	unlink(logName.c_str());	// left over from a crashed run
+	unlink((logName + ".checkpoint").c_str());
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		// As in test 19, but the checkpointer writes frames back while the
+		// index is built; the child dies after a last checkpoint and some more
+		// inserts.
+		LogManager log(logName);
+		File::setLogManager(&log);
+		createRelationForward(20000);
+		BufMgr *walBufMgr = new BufMgr(20);
+		walBufMgr->startCheckpointer(5, 10);
+		BTreeIndex *index = new BTreeIndex(relationName, intIndexName, walBufMgr, offsetof(tuple,i), INTEGER);
+		RecordId firstRid = {file1->getFirstPageNo(), 1, 0};
+		for (int key = 20000; key < 20100; key++)
+		{
+			index->insertEntry(&key, firstRid);
+		}
+		walBufMgr->stopCheckpointer();
+		walBufMgr->checkpoint();
+		for (int key = 20100; key < 20200; key++)
+		{
+			index->insertEntry(&key, firstRid);
+		}
+		_exit(walBufMgr->getBufStats().checkpoints > 1 ? 0 : 1);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	checkPassFail(WEXITSTATUS(status), 0)
+
+	// The log before the checkpoint is punched out and not replayed.
+	struct stat st;
+	checkPassFail(stat(logName.c_str(), &st), 0)
+	checkPassFail((st.st_blocks * 512 < st.st_size), true)
+	{
+		LogManager log(logName);
+		checkPassFail((log.redoneRecords() > 0), true)
+	}
+	unlink(logName.c_str());
+	unlink((logName + ".checkpoint").c_str());
+
+	file1 = new PageFile(relationName, false);
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,0,GTE,20000,LT), 20000)
+		checkPassFail(intScan(&index,19990,GTE,20200,LT), 210)
+
+		// Without a log the checkpoint writes every dirty frame and leaves them
+		// in the pool.
+		RecordId firstRid = {file1->getFirstPageNo(), 1, 0};
+		for (int key = 20200; key < 20300; key++)
+		{
+			index.insertEntry(&key, firstRid);
+		}
+		bufMgr->getBufStats().clear();
+		checkPassFail(bufMgr->checkpoint(), 0)
+		checkPassFail((bufMgr->getBufStats().diskwrites > 0), true)
+		checkPassFail(bufMgr->getBufStats().checkpoints, 1)
+		checkPassFail(intScan(&index,20200,GTE,20300,LT), 100)
+		checkPassFail(bufMgr->getBufStats().diskreads, 0)
+		bufMgr->getBufStats().clear();
+	}
+	checkPassFail(bufMgr->getBufStats().diskwrites, 0)
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	deleteRelation();
+}
+
+void test31_ShadowPaging() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 31: Copy-on-write index updates, committed by switching the root" << std::endl;
+
+	createRelationForward(20000);
+	BTreeIndex::setShadowPaging(true);
+	RecordId firstRid = {file1->getFirstPageNo(), 1, 0};
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeIndex::setShadowPaging(false);
+		checkPassFail(intScan(&index,0,GTE,20000,LT), 20000)
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+		// A scan reads the tree it started on while inserts commit new ones.
+		int low = 0, high = 30000;
+		index.startScan(&low, GTE, &high, LT);
+		RecordId rid;
+		int scanned = 0;
+		for (; scanned < 100; scanned++)
+		{
+			index.scanNext(rid);
+		}
+		for (int key = 20000; key < 20300; key++)
+		{
+			index.insertEntry(&key, firstRid);
+		}
+		try
+		{
+			while (true)
+			{
+				index.scanNext(rid);
+				scanned++;
+			}
+		}
+		catch(const IndexScanCompletedException &e)
+		{
+		}
+		index.endScan();
+		checkPassFail(scanned, 20000)
+		checkPassFail(intScan(&index,19990,GTE,20300,LT), 310)
+
+		// Each insert copies its path to the root; the copies reuse the pages
+		// of the ones they replace, freed once no scan reads them.
+		const PageId pagesBefore = numPagesOnDisk(intIndexName);
+		for (int key = 20300; key < 20600; key++)
+		{
+			index.insertEntry(&key, firstRid);
+		}
+		checkPassFail((numPagesOnDisk(intIndexName) < pagesBefore + 100), true)
+	}
+
+	// Every insert is on disk when it returns, even if the buffer pool is lost.
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		BufMgr *crashBufMgr = new BufMgr(20);
+		BTreeIndex *index = new BTreeIndex(relationName, intIndexName, crashBufMgr, offsetof(tuple,i), INTEGER);
+		for (int key = 20600; key < 21000; key++)
+		{
+			index->insertEntry(&key, firstRid);
+		}
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	checkPassFail(WEXITSTATUS(status), 0)
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,0,GTE,21000,LT), 21000)
+		checkPassFail(intScan(&index,20590,GTE,20610,LT), 20)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	// A meta page write torn by a crash leaves the other meta page, which
+	// still points at the tree committed before it.
+	for (int checksums = 0; checksums < 2; checksums++)
+	{
+		File::setPageChecksums(checksums == 1);
+		BTreeIndex::setShadowPaging(true);
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		}
+		BTreeIndex::setShadowPaging(false);
+		File::setPageChecksums(false);
+
+		struct stat st;
+		stat(intIndexName.c_str(), &st);
+		std::string before(st.st_size, '\0');
+		int fd = open(intIndexName.c_str(), O_RDONLY);
+		if (pread(fd, &before[0], before.size(), 0) != (ssize_t)before.size())
+			std::cout << "could not read " << intIndexName << std::endl;
+		close(fd);
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+			int key = 20000;
+			index.insertEntry(&key, firstRid);
+		}
+
+		// the crash leaves the first bytes of the meta page written
+		std::string torn = before;
+		int tornPages = 0;
+		fd = open(intIndexName.c_str(), O_RDONLY);
+		for (PageId pageNo = 1; pageNo <= 2; pageNo++)
+		{
+			const off_t position = File::pagePosition(pageNo);
+			char after[32];
+			if (pread(fd, after, sizeof(after), position) != (ssize_t)sizeof(after))
+				std::cout << "could not read " << intIndexName << std::endl;
+			if (memcmp(after, &before[position], sizeof(after)) != 0)
+			{
+				memcpy(&torn[position], after, sizeof(after));
+				tornPages++;
+			}
+		}
+		close(fd);
+		checkPassFail(tornPages, 1)
+		fd = open(intIndexName.c_str(), O_WRONLY | O_TRUNC);
+		if (pwrite(fd, torn.data(), torn.size(), 0) != (ssize_t)torn.size())
+			std::cout << "could not write " << intIndexName << std::endl;
+		close(fd);
+
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+			checkPassFail(intScan(&index,0,GTE,21000,LT), 20000)
+			int key = 20000;
+			index.insertEntry(&key, firstRid);
+		}
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+			checkPassFail(intScan(&index,0,GTE,21000,LT), 20001)
+		}
+		File::remove(intIndexName);
+	}
+	deleteRelation();
+}
+
+void test32_AccessHints() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 32: Index tests with access hints, on each I/O backend" << std::endl;
+
+	const IoBackend backends[] = {POSIX_BACKEND, MMAP_BACKEND, DIRECT_BACKEND, STREAM_BACKEND};
+	for (int b = 0; b < 4; b++)
+	{
+		File::setIoBackend(backends[b]);
+		createRelationForward(20000);
+		indexTests(20000);
+
+		// Dropped pages read back as they were.
+		const PageId pageNo = file1->getFirstPageNo();
+		RecordId firstRid = {pageNo, 1, 0};
+		const std::string before = file1->readPage(pageNo).getRecord(firstRid);
+		const AccessAdvice advice[] = {ADVICE_SEQUENTIAL, ADVICE_RANDOM, ADVICE_WILLNEED, ADVICE_DONTNEED, ADVICE_NORMAL};
+		for (int a = 0; a < 5; a++)
+		{
+			file1->advisePages(pageNo, 0, advice[a]);
+		}
+		checkPassFail((file1->readPage(pageNo).getRecord(firstRid) == before), true)
+		deleteRelation();
+	}
+	File::setIoBackend(POSIX_BACKEND);
+
+	File::setAccessHints(false);
+	createRelationForward(5000);
+	indexTests(5000);
+	deleteRelation();
+	File::setAccessHints(true);
+}
+
 // -----------------------------------------------------------------------------
 // createRelationForward
 // -----------------------------------------------------------------------------
@@ -719,6 +1845,33 @@ void errorTests()
   }
 }
 
+// -----------------------------------------------------------------------------
+// corruptByte
+// -----------------------------------------------------------------------------
+
+void corruptByte(const std::string& filename, const off_t position)
+{
+	int fd = open(filename.c_str(), O_RDWR);
+	char byte;
+	if (pread(fd, &byte, 1, position) != 1)
+		byte = 0;
+	byte = ~byte;
+	if (pwrite(fd, &byte, 1, position) != 1)
+		std::cout << "could not corrupt " << filename << std::endl;
+	close(fd);
+}
+
+PageId numPagesOnDisk(const std::string& filename)
+{
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+		header.num_pages = 0;
+	close(fd);
+	return header.num_pages;
+}
+
 void deleteRelation()
 {
 	if(file1)
@@ -735,3 +1888,250 @@ void deleteRelation()
 	{
 	}
 }
+
+void test33_LostCheckpoint() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 33: Recovery with the checkpoint file missing or older than the cut log" << std::endl;
+
+	const std::string logName = relationName + ".wal";
+	const std::string staleName = logName + ".stale";
+	for (int stale = 0; stale < 2; stale++)
+	{
+		unlink(logName.c_str());
+		unlink((logName + ".checkpoint").c_str());
+		unlink(staleName.c_str());
+
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			// Keeps a copy of the first checkpoint, then checkpoints again so
+			// that the log is cut past it, and dies after more inserts.
+			LogManager log(logName);
+			File::setLogManager(&log);
+			createRelationForward(20000);
+			BufMgr *walBufMgr = new BufMgr(20);
+			BTreeIndex *index = new BTreeIndex(relationName, intIndexName, walBufMgr, offsetof(tuple,i), INTEGER);
+			walBufMgr->checkpoint();
+			if (link((logName + ".checkpoint").c_str(), staleName.c_str()) != 0)
+				_exit(1);
+			RecordId firstRid = {file1->getFirstPageNo(), 1, 0};
+			for (int key = 20000; key < 20500; key++)
+			{
+				index->insertEntry(&key, firstRid);
+			}
+			walBufMgr->checkpoint();
+			for (int key = 20500; key < 20600; key++)
+			{
+				index->insertEntry(&key, firstRid);
+			}
+			_exit(0);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		checkPassFail(WEXITSTATUS(status), 0)
+
+		// The copy points into the part of the log that has been punched out.
+		Lsn staleLsn = 0;
+		int fd = open(staleName.c_str(), O_RDONLY);
+		checkPassFail(pread(fd, &staleLsn, sizeof(staleLsn), 0), (ssize_t)sizeof(staleLsn))
+		close(fd);
+		fd = open(logName.c_str(), O_RDONLY);
+		checkPassFail((lseek(fd, 0, SEEK_DATA) > (off_t)staleLsn), true)
+		close(fd);
+
+		if (stale)
+			rename(staleName.c_str(), (logName + ".checkpoint").c_str());
+		else
+			unlink((logName + ".checkpoint").c_str());
+		{
+			LogManager log(logName);
+			checkPassFail((log.redoneRecords() > 0), true)
+		}
+		unlink(logName.c_str());
+		unlink((logName + ".checkpoint").c_str());
+		unlink(staleName.c_str());
+
+		file1 = new PageFile(relationName, false);
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+			checkPassFail(intScan(&index,0,GTE,20000,LT), 20000)
+			checkPassFail(intScan(&index,19990,GTE,20600,LT), 610)
+		}
+		try
+		{
+			File::remove(intIndexName);
+		}
+		catch(const FileNotFoundException &e)
+		{
+		}
+		deleteRelation();
+	}
+}
+
+void test34_UncommittedWork() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 34: Changing more pages than the pool holds under a write-ahead log" << std::endl;
+
+	const std::string logName = relationName + ".wal";
+	unlink(logName.c_str());	// left over from a crashed run
+	unlink((logName + ".checkpoint").c_str());
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		LogManager log(logName);
+		File::setLogManager(&log);
+		createRelationForward(5000);
+		BufMgr *walBufMgr = new BufMgr(10);
+		std::vector<PageId> pageNos;
+		for (FileIterator iter = file1->begin(); iter != file1->end() && pageNos.size() < 20; ++iter)
+		{
+			pageNos.push_back((*iter).page_number());
+		}
+
+		// Frames with uncommitted changes cannot be evicted, so the eleventh
+		// page changed without a commit finds no frame.
+		int changed = 0;
+		bool exceeded = false;
+		try
+		{
+			for (std::size_t i = 0; i < pageNos.size(); i++)
+			{
+				Page *page;
+				walBufMgr->readPage(file1, pageNos[i], page);
+				RecordId rid = {pageNos[i], 1, 0};
+				std::string record = page->getRecord(rid);
+				record[offsetof(tuple,s)] = 'u';
+				page->updateRecord(rid, record);
+				walBufMgr->unPinPage(file1, pageNos[i], true);
+				changed++;
+			}
+		}
+		catch (const BufferExceededException &e)
+		{
+			exceeded = true;
+		}
+		if (!exceeded || changed != 10)
+			_exit(1);
+
+		// Committing every few pages leaves frames to evict.
+		walBufMgr->commit();
+		try
+		{
+			for (std::size_t i = 0; i < pageNos.size(); i++)
+			{
+				Page *page;
+				walBufMgr->readPage(file1, pageNos[i], page);
+				RecordId rid = {pageNos[i], 1, 0};
+				std::string record = page->getRecord(rid);
+				record[offsetof(tuple,s)] = 'c';
+				page->updateRecord(rid, record);
+				walBufMgr->unPinPage(file1, pageNos[i], true);
+				if (i % 5 == 4)
+					walBufMgr->commit(false);
+			}
+		}
+		catch (const BufferExceededException &e)
+		{
+			_exit(2);
+		}
+
+		// While this thread has uncommitted changes, another thread can neither
+		// commit them nor add its own.
+		Page *page;
+		RecordId firstRid = {pageNos[0], 1, 0};
+		walBufMgr->readPage(file1, pageNos[0], page);
+		std::string record = page->getRecord(firstRid);
+		record[offsetof(tuple,s)] = 'w';
+		page->updateRecord(firstRid, record);
+		walBufMgr->unPinPage(file1, pageNos[0], true);
+		int refused = 0;
+		std::thread other([&]() {
+			try
+			{
+				walBufMgr->commit();
+			}
+			catch (const LogWriterException &e)
+			{
+				refused++;
+			}
+			Page *otherPage;
+			RecordId otherRid = {pageNos[1], 1, 0};
+			walBufMgr->readPage(file1, pageNos[1], otherPage);
+			std::string otherRecord = otherPage->getRecord(otherRid);
+			otherRecord[offsetof(tuple,s)] = 'w';
+			otherPage->updateRecord(otherRid, otherRecord);
+			try
+			{
+				walBufMgr->unPinPage(file1, pageNos[1], true);
+			}
+			catch (const LogWriterException &e)
+			{
+				// still pinned; undo the change
+				refused++;
+				otherRecord[offsetof(tuple,s)] = 'c';
+				otherPage->updateRecord(otherRid, otherRecord);
+				walBufMgr->unPinPage(file1, pageNos[1], false);
+			}
+		});
+		other.join();
+		if (refused != 2)
+			_exit(3);
+		walBufMgr->readPage(file1, pageNos[0], page);
+		record[offsetof(tuple,s)] = 'c';
+		page->updateRecord(firstRid, record);
+		walBufMgr->unPinPage(file1, pageNos[0], true);
+		walBufMgr->commit();
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	checkPassFail(WEXITSTATUS(status), 0)
+
+	{
+		LogManager log(logName);
+	}
+	unlink(logName.c_str());
+	unlink((logName + ".checkpoint").c_str());
+
+	// Every committed change survives the child's pool.
+	file1 = new PageFile(relationName, false);
+	int committed = 0;
+	int pages = 0;
+	for (FileIterator iter = file1->begin(); iter != file1->end() && pages < 20; ++iter, pages++)
+	{
+		Page page = *iter;
+		RecordId rid = {page.page_number(), 1, 0};
+		if (page.getRecord(rid)[offsetof(tuple,s)] == 'c')
+			committed++;
+	}
+	checkPassFail(committed, 20)
+	deleteRelation();
+}
+
+void test35_ManyFiles() {
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Test 35: A private buffer pool used for more files than a shared one can name" << std::endl;
+
+	BufMgr *privateBufMgr = new BufMgr(10);
+	int written = 0;
+	for (int i = 0; i < 4200; i++)
+	{
+		const std::string name = relationName + ".many." + std::to_string(i);
+		{
+			PageFile file = PageFile::create(name);
+			PageId pageNo;
+			Page *page;
+			privateBufMgr->allocPage(&file, pageNo, page);
+			page->insertRecord("many");
+			privateBufMgr->unPinPage(&file, pageNo, true);
+			privateBufMgr->flushFile(&file);
+			RecordId rid = {pageNo, 1, 0};
+			if (file.readPage(pageNo).getRecord(rid) == "many")
+				written++;
+		}
+		File::remove(name);
+	}
+	checkPassFail(written, 4200)
+	delete privateBufMgr;
+}
@@ -15,6 +15,14 @@
 //#include <gtest/gtest.h>
 #include "types.h"
 
+/**
+ * Page size in bytes, chosen when building (make PAGE_SIZE=16384): a power of
+ * two from 4 KB to 64 KB.  All of the tree has to be built with the same one.
+ */
+#ifndef BADGERDB_PAGE_SIZE
+#define BADGERDB_PAGE_SIZE 8192
+#endif
+
 namespace badgerdb {
 
 /**
@@ -58,6 +66,11 @@ struct PageHeader {
    */
   PageId next_page_number;
 
+  /**
+   * Number of the previous used page in the file.
+   */
+  PageId prev_page_number;
+
   /**
    * Returns true if this page header is equal to the other.
    *
@@ -68,7 +81,8 @@ struct PageHeader {
     return num_slots == rhs.num_slots &&
         num_free_slots == rhs.num_free_slots &&
         current_page_number == rhs.current_page_number &&
-        next_page_number == rhs.next_page_number;
+        next_page_number == rhs.next_page_number &&
+        prev_page_number == rhs.prev_page_number;
   }
 };
 
@@ -108,15 +122,29 @@ class PageIterator;
 class Page {
  public:
   /**
-   * Page size in bytes.  If this is changed, database files created with a
-   * different page size value will be unreadable by the resulting binaries.
+   * Page size in bytes, BADGERDB_PAGE_SIZE.  If this is changed, database
+   * files created with a different page size value will be unreadable by the
+   * resulting binaries.
+   */
+  static const std::size_t SIZE = BADGERDB_PAGE_SIZE;
+
+  /**
+   * Size in bytes of the aligned sectors a page is divided into when only the
+   * changed parts of it are written back.
+   */
+  static const std::size_t SECTOR_SIZE = 512;
+
+  /**
+   * Size in bytes of the checksum at the end of every page.  Files created
+   * with File::setPageChecksums() store a CRC32C of the rest of the page in it;
+   * other users of whole pages (such as B+Tree nodes) must leave it free.
    */
-  static const std::size_t SIZE = 8192;
+  static const std::size_t CHECKSUM_SIZE = sizeof(std::uint32_t);
 
   /**
    * Size of page free space area in bytes.
    */
-  static const std::size_t DATA_SIZE = SIZE - sizeof(PageHeader);
+  static const std::size_t DATA_SIZE = SIZE - sizeof(PageHeader) - CHECKSUM_SIZE;
 
   /**
    * Number of page indicating that it's invalid.
@@ -200,6 +228,13 @@ class Page {
    */
   PageId next_page_number() const { return header_.next_page_number; }
 
+  /**
+   * Returns the number of the used page before this page in its file.
+   *
+   * @return  Page number of previous used page in file.
+   */
+  PageId prev_page_number() const { return header_.prev_page_number; }
+
   /**
    * Returns an iterator at the first record in the page.
    *
@@ -239,6 +274,15 @@ class Page {
     header_.next_page_number = new_next_page_number;
   }
 
+  /**
+   * Sets the number of the used page before this page in its file.
+   *
+   * @param prev_page_number  Page number of previous used page in file.
+   */
+  void set_prev_page_number(const PageId new_prev_page_number) {
+    header_.prev_page_number = new_prev_page_number;
+  }
+
   /**
    * Deletes the record with the given ID.  Page is compacted upon delete to
    * ensure that data of all records is contiguous.  Slot array is compacted if
@@ -333,6 +377,11 @@ class Page {
 
   char data_[DATA_SIZE];
 
+  /**
+   * Checksum of the page as stored on disk, if its file has page checksums.
+   */
+  std::uint32_t checksum_;
+
   friend class File;
   friend class PageFile;
   friend class BlobFile;
@@ -341,7 +390,16 @@ class Page {
 
 static_assert(Page::SIZE > sizeof(PageHeader),
               "Page size must be large enough to hold header and data.");
+static_assert(Page::SIZE >= 4096 && Page::SIZE <= 65536 &&
+              (Page::SIZE & (Page::SIZE - 1)) == 0,
+              "Page size must be a power of two from 4 KB to 64 KB.");
+static_assert(Page::DATA_SIZE <= UINT16_MAX,
+              "Offsets into the page data must fit the slots and page header.");
 static_assert(Page::DATA_SIZE > 0,
               "Page must have some space to hold data.");
+static_assert(Page::SIZE % Page::SECTOR_SIZE == 0,
+              "Page size must be a whole number of sectors.");
+static_assert(sizeof(Page) == Page::SIZE,
+              "Page must be laid out exactly as it is on disk.");
 
 }
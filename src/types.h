@@ -24,6 +24,12 @@ typedef std::uint16_t SlotId;
  */
 typedef std::uint32_t FrameId;
 
+/**
+ * @brief Identifier for a file registered with a buffer pool.  Unlike a File
+ * pointer it means the same thing in every process sharing the pool.
+ */
+typedef std::uint32_t FileId;
+
 /**
  * @brief Identifier for a record in a page.
  */